@@ -0,0 +1,833 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+#include <math.h>
+#include <stdbool.h>
+#include "loader.h"
+#include "cpu.h"
+#include "ppu.h"
+#include "mapper.h"
+#include "controller.h"
+#include "apu.h"
+#include "console.h"
+#include "state.h"
+
+static uint8_t const length_table[32] = {
+	10, 254, 20, 2, 40, 4, 80, 6, 160, 8, 60, 10, 14, 12, 26, 14,
+	12, 16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30
+};
+
+static uint8_t const duty_table[4][8] = {
+	{ 0, 1, 0, 0, 0, 0, 0, 0 },
+	{ 0, 1, 1, 0, 0, 0, 0, 0 },
+	{ 0, 1, 1, 1, 1, 0, 0, 0 },
+	{ 1, 0, 0, 1, 1, 1, 1, 1 }
+};
+
+static uint8_t const triangle_sequence[32] = {
+	15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+	0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15
+};
+
+// NTSC, in CPU cycles
+static uint16_t const noise_periods[16] = { 4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068 };
+static uint16_t const dmc_rates[16] = { 428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54 };
+
+/*
+ * Frame counter: the cycles from the start of the sequence of every step and what it
+ * clocks, in 4-step mode (the last step raises the IRQ) and in 5-step mode (no IRQ,
+ * one step clocks nothing). The sequence starts over after its last step.
+ */
+enum { QUARTER = 0x01, HALF = 0x02, FRAME_IRQ = 0x04 };
+
+static int const frame_steps[2][5] = { { 7457, 14913, 22371, 29829 }, { 7457, 14913, 22371, 29829, 37281 } };
+static uint8_t const frame_actions[2][5] = { { QUARTER, QUARTER | HALF, QUARTER, QUARTER | HALF | FRAME_IRQ }, { QUARTER, QUARTER | HALF, QUARTER, 0, QUARTER | HALF } };
+static int const frame_periods[2] = { 29830, 37282 };
+
+#define FRAME_IRQ_STEP 3
+
+/*************************************************** Units ********************************************************/
+static void clock_envelope(struct envelope *envelope) {
+	if (envelope->start) {
+		envelope->start = false;
+		envelope->decay = 15;
+		envelope->divider = envelope->parameter;
+	} else if (envelope->divider) {
+		envelope->divider--;
+	} else {
+		envelope->divider = envelope->parameter;
+		if (envelope->decay)
+			envelope->decay--;
+		else if (envelope->loop)
+			envelope->decay = 15;
+	}
+}
+
+static int envelope_volume(struct envelope const *envelope) {
+	return envelope->constant ? envelope->parameter : envelope->decay;
+}
+
+// pulse 1 negates with the ones' complement, pulse 2 with the two's
+static int sweep_target(struct pulse const *pulse, int channel) {
+	int change = pulse->timer >> pulse->sweep.shift;
+	if (!pulse->sweep.negate)
+		return pulse->timer + change;
+	int target = pulse->timer - change - (channel == 0);
+	return target > 0 ? target : 0;
+}
+
+// too low a period or a sweep going past $7FF silences the channel, whether the sweep is enabled or not
+static bool muted(struct pulse const *pulse, int channel) {
+	return pulse->timer < 8 || sweep_target(pulse, channel) > 0x7FF;
+}
+
+static void clock_sweep(struct pulse *pulse, int channel) {
+	if (!pulse->sweep.divider && pulse->sweep.enabled && pulse->sweep.shift && !muted(pulse, channel))
+		pulse->timer = sweep_target(pulse, channel);
+	if (!pulse->sweep.divider || pulse->sweep.reload) {
+		pulse->sweep.divider = pulse->sweep.period;
+		pulse->sweep.reload = false;
+	} else {
+		pulse->sweep.divider--;
+	}
+}
+
+// envelopes and the linear counter
+static void clock_quarter_frame(struct apu *apu) {
+	clock_envelope(&apu->pulse[0].envelope);
+	clock_envelope(&apu->pulse[1].envelope);
+	clock_envelope(&apu->noise.envelope);
+	struct triangle *triangle = &apu->triangle;
+	if (triangle->reload)
+		triangle->linear_counter = triangle->linear_reload;
+	else if (triangle->linear_counter)
+		triangle->linear_counter--;
+	if (!triangle->control)
+		triangle->reload = false;
+}
+
+// length counters and sweeps
+static void clock_half_frame(struct apu *apu) {
+	for (int channel = 0; channel < 2; channel++) {
+		struct pulse *pulse = &apu->pulse[channel];
+		if (pulse->length && !pulse->envelope.loop)
+			pulse->length--;
+		clock_sweep(pulse, channel);
+	}
+	if (apu->triangle.length && !apu->triangle.control)
+		apu->triangle.length--;
+	if (apu->noise.length && !apu->noise.envelope.loop)
+		apu->noise.length--;
+}
+
+static void clock_frame_counter(struct apu *apu) {
+	int mode = apu->frame_counter.five_step;
+	uint8_t actions = frame_actions[mode][apu->frame_counter.step];
+	if (actions & QUARTER)
+		clock_quarter_frame(apu);
+	if (actions & HALF)
+		clock_half_frame(apu);
+	if (actions & FRAME_IRQ && !apu->frame_counter.irq_inhibit) {
+		apu->frame_counter.irq = true;
+		cpu_irq(&apu->console->cpu, IRQ_FRAME_COUNTER, true);
+	}
+	if (++apu->frame_counter.step == 4 + mode) {
+		apu->frame_counter.step = 0;
+		apu->frame_counter.start += frame_periods[mode];
+	}
+}
+
+static unsigned long long next_frame_step(struct apu const *apu) {
+	return apu->frame_counter.start + frame_steps[apu->frame_counter.five_step][apu->frame_counter.step];
+}
+
+/************************************************** Channels ******************************************************/
+enum { PULSE_1, PULSE_2, TRIANGLE, NOISE, DMC, CHANNELS };
+
+static int pulse_volume(struct pulse const *pulse, int channel) {
+	return pulse->length && !muted(pulse, channel) ? envelope_volume(&pulse->envelope) : 0;
+}
+
+// silenced by one of its counters, the triangle holds its step; periods below 2 are ultrasonic and held too
+static bool triangle_running(struct triangle const *triangle) {
+	return triangle->length && triangle->linear_counter && triangle->timer >= 2;
+}
+
+static int noise_volume(struct noise const *noise) {
+	return noise->length ? envelope_volume(&noise->envelope) : 0;
+}
+
+static inline uint16_t clock_lfsr(uint16_t shift, bool mode) {
+	return shift >> 1 | ((shift ^ shift >> (mode ? 6 : 1)) & 1) << 14;
+}
+
+static void restart_sample(struct dmc *dmc) {
+	dmc->address = dmc->sample_address;
+	dmc->remaining = dmc->sample_length;
+}
+
+// the memory reader fills the sample buffer, the CPU is halted meanwhile
+static void fetch_sample(struct apu *apu) {
+	struct dmc *dmc = &apu->dmc;
+	dmc->buffer = cpu_dma_read(&apu->console->cpu, dmc->address);
+	dmc->buffer_full = true;
+	dmc->address = dmc->address == 0xFFFF ? 0x8000 : dmc->address + 1;
+	if (--dmc->remaining)
+		return;
+	if (dmc->loop) {
+		restart_sample(dmc);
+	} else if (dmc->irq_enabled) {
+		dmc->irq = true;
+		cpu_irq(&apu->console->cpu, IRQ_DMC, true);
+	}
+}
+
+// one bit of the shift register moves the level by 2; a new output cycle empties the buffer, which is filled again at once
+static void clock_dmc(struct apu *apu) {
+	struct dmc *dmc = &apu->dmc;
+	if (!dmc->silence) {
+		if (dmc->shift & 1) {
+			if (dmc->level <= 125)
+				dmc->level += 2;
+		} else if (dmc->level >= 2) {
+			dmc->level -= 2;
+		}
+		dmc->shift >>= 1;
+	}
+	if (--dmc->bits)
+		return;
+	dmc->bits = 8;
+	dmc->silence = !dmc->buffer_full;
+	if (dmc->buffer_full) {
+		dmc->shift = dmc->buffer;
+		dmc->buffer_full = false;
+		if (dmc->remaining)
+			fetch_sample(apu);
+	}
+}
+
+// silent with an empty buffer, the DMC has nothing left to play or fetch: only its bit counter moves
+static bool dmc_running(struct dmc const *dmc) {
+	return !dmc->silence || dmc->buffer_full;
+}
+
+static int *countdown(struct apu *apu, int channel) {
+	switch (channel) {
+	case PULSE_1:
+	case PULSE_2:
+		return &apu->pulse[channel].countdown;
+	case TRIANGLE:
+		return &apu->triangle.countdown;
+	case NOISE:
+		return &apu->noise.countdown;
+	default:
+		return &apu->dmc.countdown;
+	}
+}
+
+static int timer_period(struct apu const *apu, int channel) {
+	switch (channel) {
+	case PULSE_1:
+	case PULSE_2:
+		return 2 * (apu->pulse[channel].timer + 1);
+	case TRIANGLE:
+		return apu->triangle.timer + 1;
+	case NOISE:
+		return noise_periods[apu->noise.period];
+	default:
+		return dmc_rates[apu->dmc.rate];
+	}
+}
+
+// the output of a channel, volume as given by the functions above
+static int channel_level(struct apu const *apu, int channel, int volume) {
+	switch (channel) {
+	case PULSE_1:
+	case PULSE_2:
+		return duty_table[apu->pulse[channel].duty][apu->pulse[channel].step] * volume;
+	case TRIANGLE:
+		return triangle_sequence[apu->triangle.step];
+	case NOISE:
+		return apu->noise.shift & 1 ? 0 : volume;
+	default:
+		return apu->dmc.level;
+	}
+}
+
+// one expiry of the timer of a heard channel, which returns its new output
+static int clock_channel(struct apu *apu, int channel, int volume) {
+	switch (channel) {
+	case PULSE_1:
+	case PULSE_2:
+		apu->pulse[channel].step = (apu->pulse[channel].step + 1) & 7;
+		break;
+	case TRIANGLE:
+		apu->triangle.step = (apu->triangle.step + 1) & 31;
+		break;
+	case NOISE:
+		apu->noise.shift = clock_lfsr(apu->noise.shift, apu->noise.mode);
+		break;
+	default:
+		clock_dmc(apu);
+		break;
+	}
+	return channel_level(apu, channel, volume);
+}
+
+static inline int run_timer(int *countdown, int period, int cycles) {
+	if (cycles < *countdown) {
+		*countdown -= cycles;
+		return 0;
+	}
+	cycles -= *countdown;
+	*countdown = period - cycles % period;
+	return 1 + cycles / period;
+}
+
+/*
+ * Moves a channel which is not heard forward in one go: run_timer() tells how many times
+ * its timer expired meanwhile. The LFSR of the noise has no such shortcut, and a running
+ * DMC is walked since its fetches halt the CPU.
+ */
+static void advance(struct apu *apu, int channel, int cycles) {
+	int period = timer_period(apu, channel);
+	switch (channel) {
+	case PULSE_1:
+	case PULSE_2: {
+		struct pulse *pulse = &apu->pulse[channel];
+		pulse->step = (pulse->step + run_timer(&pulse->countdown, period, cycles)) & 7;
+		break;
+	}
+	case TRIANGLE:
+		if (triangle_running(&apu->triangle))
+			apu->triangle.step = (apu->triangle.step + run_timer(&apu->triangle.countdown, period, cycles)) & 31;
+		break;
+	case NOISE:
+		for (int steps = run_timer(&apu->noise.countdown, period, cycles); steps > 0; steps--)
+			apu->noise.shift = clock_lfsr(apu->noise.shift, apu->noise.mode);
+		break;
+	default: {
+		struct dmc *dmc = &apu->dmc;
+		if (!dmc_running(dmc)) {
+			dmc->bits = 8 - (8 - dmc->bits + run_timer(&dmc->countdown, period, cycles)) % 8;
+			break;
+		}
+		while (cycles >= dmc->countdown) {
+			cycles -= dmc->countdown;
+			dmc->countdown = period;
+			clock_dmc(apu);
+		}
+		dmc->countdown -= cycles;
+		break;
+	}
+	}
+}
+
+/*************************************************** Mixer ********************************************************/
+/*
+ * The nonlinear mixer of the console, looked up by the sum of the pulse levels and the
+ * weighted sum of the triangle, noise and DMC ones. Its output only changes when a level
+ * does, and every change is a step that goes into the samples around the instant it
+ * happens as a band-limited step: the integral of a windowed sinc cut off a little
+ * below half the sample rate, so that the harmonics of square waves past what the
+ * sample rate holds fade out instead of folding back as noise. The kernel is centered
+ * STEP_WIDTH / 2 samples later, which delays the sound by 0.17 ms. A high-pass filter
+ * then removes the DC offset as the console's own output stage does.
+ */
+#define STEP_WIDTH 16 // samples a step is spread over
+#define STEP_PHASES 64 // positions of a step between two samples, finer than the CPU cycles of a sample at 48 kHz
+#define STEP_CUTOFF 0.45f // of the sample rate
+#define PI 3.14159265f
+
+static float pulse_table[31], tnd_table[203];
+static float step_kernel[STEP_PHASES][STEP_WIDTH];
+
+static void build_mixer_tables(void) {
+	for (int n = 1; n < 31; n++)
+		pulse_table[n] = 95.52f / (8128.0f / n + 100);
+	for (int n = 1; n < 203; n++)
+		tnd_table[n] = 163.67f / (24329.0f / n + 100);
+}
+
+// every row holds the differences between consecutive samples of the step, so that they add up to the whole of it
+static void build_step_kernel(void) {
+	static float integral[STEP_WIDTH * STEP_PHASES + 1];
+	float sum = 0;
+	for (int i = 0; i <= STEP_WIDTH * STEP_PHASES; i++) {
+		float x = (float) i / STEP_PHASES - STEP_WIDTH / 2; // samples from the center
+		float angle = 2 * PI * i / (STEP_WIDTH * STEP_PHASES);
+		float window = 0.42f - 0.5f * cosf(angle) + 0.08f * cosf(2 * angle); // Blackman
+		sum += window * (x ? sinf(2 * PI * STEP_CUTOFF * x) / (PI * x) : 2 * STEP_CUTOFF);
+		integral[i] = sum;
+	}
+	for (int phase = 0; phase < STEP_PHASES; phase++) {
+		float *kernel = step_kernel[phase];
+		for (int i = 0; i < STEP_WIDTH; i++) {
+			int start = i * STEP_PHASES - phase;
+			kernel[i] = integral[(i + 1) * STEP_PHASES - phase] - (start > 0 ? integral[start] : 0);
+		}
+		// what the window leaves out of the last sample, made up for so that no DC creeps in
+		float total = integral[STEP_WIDTH * STEP_PHASES - phase];
+		for (int i = 0; i < STEP_WIDTH; i++)
+			kernel[i] /= total;
+	}
+}
+
+// the output as the levels are, time cycles into the span being synthesized; a step of 0 costs less than telling it apart
+static void mix(struct apu *apu, int const level[CHANNELS], int time) {
+	float output = pulse_table[level[PULSE_1] + level[PULSE_2]] + tnd_table[3 * level[TRIANGLE] + 2 * level[NOISE] + level[DMC]];
+	unsigned position = apu->phase + time * apu->sample_rate;
+	float const *kernel = step_kernel[position % APU_CLOCK * STEP_PHASES / APU_CLOCK];
+	float *pending = apu->pending + position / APU_CLOCK;
+	float step = output - apu->output;
+	for (int i = 0; i < STEP_WIDTH; i++) // a fixed width the compiler turns into a few vector operations
+		pending[i] += step * kernel[i];
+	apu->output = output;
+}
+
+static void complete_samples(struct apu *apu, int cycles) {
+	unsigned position = apu->phase + cycles * apu->sample_rate;
+	int completed = position / APU_CLOCK;
+	apu->phase = position % APU_CLOCK;
+	if (!completed)
+		return;
+	for (int i = 0; i < completed; i++) {
+		float level = apu->level + apu->pending[i];
+		apu->filter = apu->filter_coefficient * (apu->filter + level - apu->level);
+		apu->level = level;
+		if (apu->sample_count == APU_SAMPLES) {
+			apu->dropped_samples++;
+			continue;
+		}
+		float sample = apu->filter * 32767;
+		apu->samples[apu->sample_count++] = sample > 32767 ? 32767 : sample < -32768 ? -32768 : (int16_t) sample;
+	}
+	memmove(apu->pending, apu->pending + completed, (APU_PENDING - completed) * sizeof(*apu->pending));
+	memset(apu->pending + APU_PENDING - completed, 0, completed * sizeof(*apu->pending));
+}
+
+/*
+ * The channels heard are walked together from one timer expiry to the next, the others
+ * move forward at once. What changed since the last span (a register write, the frame
+ * counter) is a step at its start.
+ */
+static void synthesize(struct apu *apu, int cycles) {
+	int volume[CHANNELS] = {
+		pulse_volume(&apu->pulse[0], 0), pulse_volume(&apu->pulse[1], 1),
+		triangle_running(&apu->triangle), noise_volume(&apu->noise), dmc_running(&apu->dmc)
+	};
+	int level[CHANNELS], period[CHANNELS], left[CHANNELS];
+	int heard[CHANNELS], count = 0;
+	for (int channel = 0; channel < CHANNELS; channel++) {
+		level[channel] = channel_level(apu, channel, volume[channel]);
+		if (!volume[channel]) {
+			advance(apu, channel, cycles);
+			continue;
+		}
+		heard[count++] = channel;
+		period[channel] = timer_period(apu, channel);
+		left[channel] = *countdown(apu, channel);
+	}
+	mix(apu, level, 0);
+
+	int time = 0;
+	for (;;) {
+		int next = cycles - time + 1;
+		for (int i = 0; i < count; i++)
+			if (left[heard[i]] < next)
+				next = left[heard[i]];
+		if (next > cycles - time)
+			break;
+		time += next;
+		for (int i = 0; i < count; i++) {
+			int channel = heard[i];
+			if ((left[channel] -= next))
+				continue;
+			left[channel] = period[channel];
+			level[channel] = clock_channel(apu, channel, volume[channel]);
+		}
+		mix(apu, level, time);
+	}
+	for (int i = 0; i < count; i++)
+		*countdown(apu, heard[i]) = left[heard[i]] - (cycles - time);
+	complete_samples(apu, cycles);
+}
+
+/************************************************** Catch-up ******************************************************/
+/*
+ * Runs the APU up to the given cycle, in spans that end at the next step of the frame
+ * counter, short enough for their steps to fit in the pending samples. The DMC can halt
+ * the CPU to fetch a byte meanwhile, which only moves the CPU further.
+ */
+void apu_sync(struct apu *apu, unsigned long long cycle) {
+	while (apu->cycle < cycle) {
+		unsigned long long frame_step = next_frame_step(apu);
+		if (frame_step <= apu->cycle) { // only from a loaded state
+			clock_frame_counter(apu);
+			continue;
+		}
+		unsigned long long end = frame_step < cycle ? frame_step : cycle;
+		if (apu->sample_rate && end > apu->cycle + apu->span)
+			end = apu->cycle + apu->span;
+		int cycles = end - apu->cycle;
+		if (apu->sample_rate)
+			synthesize(apu, cycles);
+		else
+			for (int channel = 0; channel < CHANNELS; channel++)
+				advance(apu, channel, cycles);
+		apu->cycle = end;
+		if (end == frame_step)
+			clock_frame_counter(apu);
+	}
+}
+
+// the next cycle at which the CPU must see the APU: the frame IRQ or a DMC fetch (ULLONG_MAX: none coming)
+unsigned long long apu_next_event(struct apu const *apu) {
+	unsigned long long next = ULLONG_MAX;
+	if (!apu->frame_counter.five_step && !apu->frame_counter.irq_inhibit && !apu->frame_counter.irq)
+		next = apu->frame_counter.start + frame_steps[0][FRAME_IRQ_STEP];
+	struct dmc const *dmc = &apu->dmc;
+	if (dmc->buffer_full && dmc->remaining) {
+		unsigned long long fetch = apu->cycle + dmc->countdown + (dmc->bits - 1) * dmc_rates[dmc->rate];
+		if (fetch < next)
+			next = fetch;
+	}
+	return next;
+}
+
+// the samples synthesized up to the current CPU cycle move into samples (NULL: thrown away), at most capacity of them
+int apu_drain(struct apu *apu, int16_t *samples, int capacity) {
+	apu_sync(apu, cpu_cycles(&apu->console->cpu));
+	int count = apu->sample_count < capacity ? apu->sample_count : capacity;
+	if (samples)
+		memcpy(samples, apu->samples, count * sizeof(*samples));
+	apu->sample_count -= count;
+	memmove(apu->samples, apu->samples + count, apu->sample_count * sizeof(*samples));
+	return count;
+}
+
+/************************************************* Registers ******************************************************/
+static void write_envelope(struct envelope *envelope, uint8_t data) {
+	envelope->loop = data & 0x20;
+	envelope->constant = data & 0x10;
+	envelope->parameter = data & 0x0F;
+}
+
+static void write_pulse(struct apu *apu, int channel, int reg, uint8_t data) {
+	struct pulse *pulse = &apu->pulse[channel];
+	switch (reg) {
+	case 0:
+		pulse->duty = data >> 6;
+		write_envelope(&pulse->envelope, data);
+		break;
+	case 1:
+		pulse->sweep.enabled = data & 0x80;
+		pulse->sweep.period = data >> 4 & 0x07;
+		pulse->sweep.negate = data & 0x08;
+		pulse->sweep.shift = data & 0x07;
+		pulse->sweep.reload = true;
+		break;
+	case 2:
+		pulse->timer = (pulse->timer & 0x0700) | data;
+		break;
+	case 3:
+		pulse->timer = (pulse->timer & 0x00FF) | (data & 0x07) << 8;
+		if (apu->enabled & 1 << channel)
+			pulse->length = length_table[data >> 3];
+		pulse->step = 0;
+		pulse->envelope.start = true;
+		break;
+	}
+}
+
+static void write_status(struct apu *apu, uint8_t data) {
+	apu->enabled = data & 0x1F;
+	if (!(data & 0x01))
+		apu->pulse[0].length = 0;
+	if (!(data & 0x02))
+		apu->pulse[1].length = 0;
+	if (!(data & 0x04))
+		apu->triangle.length = 0;
+	if (!(data & 0x08))
+		apu->noise.length = 0;
+	struct dmc *dmc = &apu->dmc;
+	if (!(data & 0x10)) {
+		dmc->remaining = 0;
+	} else if (!dmc->remaining) {
+		restart_sample(dmc);
+		if (!dmc->buffer_full)
+			fetch_sample(apu);
+	}
+	dmc->irq = false;
+	cpu_irq(&apu->console->cpu, IRQ_DMC, false);
+}
+
+// the sequence starts over 3 or 4 cycles after the write, depending on its parity; 5-step mode clocks everything at once
+static void write_frame_counter(struct apu *apu, uint8_t data) {
+	apu->frame_counter.five_step = data & 0x80;
+	apu->frame_counter.irq_inhibit = data & 0x40;
+	if (apu->frame_counter.irq_inhibit) {
+		apu->frame_counter.irq = false;
+		cpu_irq(&apu->console->cpu, IRQ_FRAME_COUNTER, false);
+	}
+	apu->frame_counter.start = apu->cycle + 3 + (apu->cycle & 1);
+	apu->frame_counter.step = 0;
+	if (apu->frame_counter.five_step) {
+		clock_quarter_frame(apu);
+		clock_half_frame(apu);
+	}
+}
+
+// $4000-$4013, $4015 and $4017, once the APU has caught up with the cycle of the write
+void apu_write(struct apu *apu, uint16_t address, uint8_t data) {
+	if (address < 0x4008) {
+		write_pulse(apu, address >> 2 & 1, address & 0x03, data);
+		return;
+	}
+	struct triangle *triangle = &apu->triangle;
+	struct noise *noise = &apu->noise;
+	struct dmc *dmc = &apu->dmc;
+	switch (address) {
+	case 0x4008:
+		triangle->control = data & 0x80;
+		triangle->linear_reload = data & 0x7F;
+		break;
+	case 0x400A:
+		triangle->timer = (triangle->timer & 0x0700) | data;
+		break;
+	case 0x400B:
+		triangle->timer = (triangle->timer & 0x00FF) | (data & 0x07) << 8;
+		if (apu->enabled & 0x04)
+			triangle->length = length_table[data >> 3];
+		triangle->reload = true;
+		break;
+	case 0x400C:
+		write_envelope(&noise->envelope, data);
+		break;
+	case 0x400E:
+		noise->mode = data & 0x80;
+		noise->period = data & 0x0F;
+		break;
+	case 0x400F:
+		if (apu->enabled & 0x08)
+			noise->length = length_table[data >> 3];
+		noise->envelope.start = true;
+		break;
+	case 0x4010:
+		dmc->irq_enabled = data & 0x80;
+		dmc->loop = data & 0x40;
+		dmc->rate = data & 0x0F;
+		if (!dmc->irq_enabled) {
+			dmc->irq = false;
+			cpu_irq(&apu->console->cpu, IRQ_DMC, false);
+		}
+		break;
+	case 0x4011:
+		dmc->level = data & 0x7F;
+		break;
+	case 0x4012:
+		dmc->sample_address = 0xC000 | data << 6;
+		break;
+	case 0x4013:
+		dmc->sample_length = data << 4 | 1;
+		break;
+	case 0x4015:
+		write_status(apu, data);
+		break;
+	case 0x4017:
+		write_frame_counter(apu, data);
+		break;
+	}
+}
+
+// $4015: channels with their length counter running, DMC bytes left, both IRQ; reading acknowledges the frame IRQ
+uint8_t apu_read_status(struct apu *apu) {
+	uint8_t status = (apu->pulse[0].length > 0)
+		| (apu->pulse[1].length > 0) << 1
+		| (apu->triangle.length > 0) << 2
+		| (apu->noise.length > 0) << 3
+		| (apu->dmc.remaining > 0) << 4
+		| apu->frame_counter.irq << 6
+		| apu->dmc.irq << 7;
+	apu->frame_counter.irq = false;
+	cpu_irq(&apu->console->cpu, IRQ_FRAME_COUNTER, false);
+	return status;
+}
+
+/************************************************** Power-up ******************************************************/
+// every channel silent, the frame counter as if $4017 had been written with 0; the sample rate is kept
+void apu_power_up(struct apu *apu) {
+	apu->cycle = 0;
+	memset(apu->pulse, 0, sizeof(apu->pulse));
+	memset(&apu->triangle, 0, sizeof(apu->triangle));
+	memset(&apu->noise, 0, sizeof(apu->noise));
+	memset(&apu->dmc, 0, sizeof(apu->dmc));
+	memset(&apu->frame_counter, 0, sizeof(apu->frame_counter));
+	apu->pulse[0].countdown = apu->pulse[1].countdown = 2;
+	apu->triangle.countdown = 1;
+	apu->noise.shift = 1;
+	apu->noise.countdown = noise_periods[0];
+	apu->dmc.countdown = dmc_rates[0];
+	apu->dmc.bits = 8;
+	apu->dmc.silence = true;
+	apu->enabled = 0;
+
+	apu->phase = 0;
+	apu->output = apu->level = apu->filter = 0;
+	memset(apu->pending, 0, sizeof(apu->pending));
+	apu->sample_count = 0;
+	apu->dropped_samples = 0;
+}
+
+// up to APU_CLOCK, 0 stops synthesizing samples; the high-pass filter is set for about 90 Hz at that rate
+void apu_set_sample_rate(struct apu *apu, int sample_rate) {
+	apu->sample_rate = sample_rate;
+	apu->filter_coefficient = sample_rate ? 1 - 2 * PI * 90 / sample_rate : 0;
+	apu->span = sample_rate ? (APU_PENDING - STEP_WIDTH) * APU_CLOCK / sample_rate : 0;
+	if (sample_rate && !pulse_table[1]) {
+		build_mixer_tables();
+		build_step_kernel();
+	}
+}
+
+/**************************************************** State *******************************************************/
+_Static_assert(sizeof(((struct apu_state *) 0)->pending) == sizeof(((struct apu *) 0)->pending), "the pending samples are saved as they are");
+
+static void save_envelope(struct envelope const *envelope, uint8_t state[6]) {
+	state[0] = envelope->start;
+	state[1] = envelope->loop;
+	state[2] = envelope->constant;
+	state[3] = envelope->parameter;
+	state[4] = envelope->divider;
+	state[5] = envelope->decay;
+}
+
+static void load_envelope(struct envelope *envelope, uint8_t const state[6]) {
+	envelope->start = state[0];
+	envelope->loop = state[1];
+	envelope->constant = state[2];
+	envelope->parameter = state[3] & 0x0F;
+	envelope->divider = state[4] & 0x0F;
+	envelope->decay = state[5] & 0x0F;
+}
+
+void apu_save_state(struct apu const *apu, struct apu_state *state) {
+	state->cycle = apu->cycle;
+	state->frame_start = apu->frame_counter.start;
+	for (int channel = 0; channel < 2; channel++) {
+		struct pulse const *pulse = &apu->pulse[channel];
+		state->countdown[channel] = pulse->countdown;
+		state->pulse_timer[channel] = pulse->timer;
+		state->pulse_duty[channel] = pulse->duty;
+		state->pulse_step[channel] = pulse->step;
+		state->length[channel] = pulse->length;
+		save_envelope(&pulse->envelope, state->envelope[channel]);
+		state->sweep[channel][0] = pulse->sweep.enabled;
+		state->sweep[channel][1] = pulse->sweep.negate;
+		state->sweep[channel][2] = pulse->sweep.reload;
+		state->sweep[channel][3] = pulse->sweep.period;
+		state->sweep[channel][4] = pulse->sweep.shift;
+		state->sweep[channel][5] = pulse->sweep.divider;
+	}
+	state->countdown[2] = apu->triangle.countdown;
+	state->triangle_timer = apu->triangle.timer;
+	state->triangle_step = apu->triangle.step;
+	state->length[2] = apu->triangle.length;
+	state->triangle_control = apu->triangle.control;
+	state->triangle_reload = apu->triangle.reload;
+	state->linear_reload = apu->triangle.linear_reload;
+	state->linear_counter = apu->triangle.linear_counter;
+	state->countdown[3] = apu->noise.countdown;
+	state->noise_shift = apu->noise.shift;
+	state->noise_mode = apu->noise.mode;
+	state->noise_period = apu->noise.period;
+	state->length[3] = apu->noise.length;
+	save_envelope(&apu->noise.envelope, state->envelope[2]);
+	struct dmc const *dmc = &apu->dmc;
+	state->countdown[4] = dmc->countdown;
+	state->dmc_sample_address = dmc->sample_address;
+	state->dmc_sample_length = dmc->sample_length;
+	state->dmc_address = dmc->address;
+	state->dmc_remaining = dmc->remaining;
+	state->dmc_irq_enabled = dmc->irq_enabled;
+	state->dmc_loop = dmc->loop;
+	state->dmc_irq = dmc->irq;
+	state->dmc_rate = dmc->rate;
+	state->dmc_level = dmc->level;
+	state->dmc_shift = dmc->shift;
+	state->dmc_bits = dmc->bits;
+	state->dmc_silence = dmc->silence;
+	state->dmc_buffer = dmc->buffer;
+	state->dmc_buffer_full = dmc->buffer_full;
+	state->enabled = apu->enabled;
+	state->five_step = apu->frame_counter.five_step;
+	state->irq_inhibit = apu->frame_counter.irq_inhibit;
+	state->frame_irq = apu->frame_counter.irq;
+	state->frame_step = apu->frame_counter.step;
+	state->phase = apu->phase;
+	state->output = apu->output;
+	state->level = apu->level;
+	state->filter = apu->filter;
+	memcpy(state->pending, apu->pending, sizeof(state->pending));
+}
+
+void apu_load_state(struct apu *apu, struct apu_state const *state) {
+	apu->cycle = state->cycle;
+	apu->frame_counter.start = state->frame_start;
+	for (int channel = 0; channel < 2; channel++) {
+		struct pulse *pulse = &apu->pulse[channel];
+		pulse->countdown = state->countdown[channel];
+		pulse->timer = state->pulse_timer[channel] & 0x07FF;
+		pulse->duty = state->pulse_duty[channel] & 0x03;
+		pulse->step = state->pulse_step[channel] & 0x07;
+		pulse->length = state->length[channel];
+		load_envelope(&pulse->envelope, state->envelope[channel]);
+		pulse->sweep.enabled = state->sweep[channel][0];
+		pulse->sweep.negate = state->sweep[channel][1];
+		pulse->sweep.reload = state->sweep[channel][2];
+		pulse->sweep.period = state->sweep[channel][3] & 0x07;
+		pulse->sweep.shift = state->sweep[channel][4] & 0x07;
+		pulse->sweep.divider = state->sweep[channel][5] & 0x07;
+	}
+	apu->triangle.countdown = state->countdown[2];
+	apu->triangle.timer = state->triangle_timer & 0x07FF;
+	apu->triangle.step = state->triangle_step & 0x1F;
+	apu->triangle.length = state->length[2];
+	apu->triangle.control = state->triangle_control;
+	apu->triangle.reload = state->triangle_reload;
+	apu->triangle.linear_reload = state->linear_reload & 0x7F;
+	apu->triangle.linear_counter = state->linear_counter & 0x7F;
+	apu->noise.countdown = state->countdown[3];
+	apu->noise.shift = state->noise_shift & 0x7FFF;
+	apu->noise.mode = state->noise_mode;
+	apu->noise.period = state->noise_period & 0x0F;
+	apu->noise.length = state->length[3];
+	load_envelope(&apu->noise.envelope, state->envelope[2]);
+	struct dmc *dmc = &apu->dmc;
+	dmc->countdown = state->countdown[4];
+	dmc->sample_address = state->dmc_sample_address;
+	dmc->sample_length = state->dmc_sample_length;
+	dmc->address = state->dmc_address;
+	dmc->remaining = state->dmc_remaining;
+	dmc->irq_enabled = state->dmc_irq_enabled;
+	dmc->loop = state->dmc_loop;
+	dmc->irq = state->dmc_irq;
+	dmc->rate = state->dmc_rate & 0x0F;
+	dmc->level = state->dmc_level & 0x7F;
+	dmc->shift = state->dmc_shift;
+	dmc->bits = state->dmc_bits;
+	dmc->silence = state->dmc_silence;
+	dmc->buffer = state->dmc_buffer;
+	dmc->buffer_full = state->dmc_buffer_full;
+	apu->enabled = state->enabled & 0x1F;
+	apu->frame_counter.five_step = state->five_step;
+	apu->frame_counter.irq_inhibit = state->irq_inhibit;
+	apu->frame_counter.irq = state->frame_irq;
+	apu->frame_counter.step = state->frame_step;
+	apu->phase = state->phase;
+	apu->output = state->output;
+	apu->level = state->level;
+	apu->filter = state->filter;
+	memcpy(apu->pending, state->pending, sizeof(apu->pending));
+}
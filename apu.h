@@ -0,0 +1,125 @@
+#ifndef HEADER_APU
+#define HEADER_APU
+
+struct console;
+
+#define APU_SAMPLES 4096 // synthesized between two drains, later ones are dropped
+#define APU_PENDING 64 // samples ahead of the last complete one that steps of the output can reach
+
+struct envelope {
+	bool start;
+	bool loop; // also halts the length counter
+	bool constant; // volume is the parameter itself instead of the decay level
+	uint8_t parameter; // constant volume or divider period
+	uint8_t divider;
+	uint8_t decay;
+};
+
+struct pulse {
+	uint8_t duty;
+	uint8_t step; // in the duty sequence
+	uint16_t timer; // 11-bit period: the sequencer steps every 2 * (timer + 1) CPU cycles
+	int countdown; // CPU cycles until the sequencer steps
+	uint8_t length;
+	struct envelope envelope;
+	struct {
+		bool enabled;
+		bool negate;
+		bool reload;
+		uint8_t period;
+		uint8_t shift;
+		uint8_t divider;
+	} sweep;
+};
+
+struct triangle {
+	uint16_t timer; // the sequencer steps every timer + 1 CPU cycles
+	int countdown;
+	uint8_t step; // in the 32-step sequence
+	uint8_t length;
+	bool control; // halts the length counter, keeps reloading the linear counter
+	bool reload;
+	uint8_t linear_reload;
+	uint8_t linear_counter;
+};
+
+struct noise {
+	uint16_t shift; // 15-bit LFSR
+	bool mode; // short sequence: feedback from bit 6 instead of bit 1
+	uint8_t period; // index in the period table
+	int countdown;
+	uint8_t length;
+	struct envelope envelope;
+};
+
+struct dmc {
+	bool irq_enabled;
+	bool loop;
+	bool irq;
+	uint8_t rate; // index in the rate table
+	int countdown;
+	uint8_t level; // 7-bit output
+	uint8_t shift;
+	uint8_t bits; // left in the output cycle, 1 to 8
+	bool silence;
+	uint8_t buffer;
+	bool buffer_full;
+	uint16_t sample_address;
+	uint16_t sample_length;
+	uint16_t address;
+	uint16_t remaining; // bytes of the sample
+};
+
+/*
+ * The APU is not clocked along with the CPU. It keeps the cycle it has run up to and
+ * catches up when it has to: before its registers are accessed, when the frame counter
+ * or the DMC has something for the CPU (apu_next_event, console_run stops there), and
+ * when the samples are drained. Catching up goes from one timer expiry to the next, so
+ * its cost follows the notes being played instead of the cycles, and a silent channel
+ * only has its timer moved forward. Samples are built from the changes of the output.
+ */
+struct apu {
+	unsigned long long cycle; // CPU cycles run so far
+	struct pulse pulse[2];
+	struct triangle triangle;
+	struct noise noise;
+	struct dmc dmc;
+	uint8_t enabled; // $4015: pulse 1, pulse 2, triangle, noise, DMC from bit 0 on
+
+	struct {
+		bool five_step;
+		bool irq_inhibit;
+		bool irq;
+		int step; // next step of the sequence
+		unsigned long long start; // cycle at which the sequence started
+	} frame_counter;
+
+	// the samples being synthesized, part of the state so that going back in time does not click
+	unsigned phase; // sample_rate per CPU cycle, the first pending sample is complete when it reaches APU_CLOCK
+	float output; // of the mixer, every step of which is in the pending samples
+	float level; // of the mixer in the last complete sample
+	float filter; // output of the high-pass removing the DC offset
+	float pending[APU_PENDING]; // steps of the output from the sample being synthesized on
+
+	// output, not part of the state
+	int sample_rate; // 0: nothing is synthesized, the channels only keep time
+	int span; // CPU cycles synthesized at once at most, so that their steps stay within the pending samples
+	float filter_coefficient;
+	int16_t samples[APU_SAMPLES];
+	int sample_count;
+	unsigned long dropped_samples;
+
+	struct console *console; // for the CPU: IRQ line and DMC fetches
+};
+
+#define APU_CLOCK 1789773 // NTSC CPU cycles per second
+
+void apu_power_up(struct apu *apu);
+void apu_set_sample_rate(struct apu *apu, int sample_rate);
+void apu_sync(struct apu *apu, unsigned long long cycle);
+unsigned long long apu_next_event(struct apu const *apu);
+void apu_write(struct apu *apu, uint16_t address, uint8_t data);
+uint8_t apu_read_status(struct apu *apu);
+int apu_drain(struct apu *apu, int16_t *samples, int capacity);
+
+#endif
@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "audio.h"
+
+/*
+ * The emulation thread hands the samples of every frame over to the audio callback
+ * through a single-producer/single-consumer ring without locks, so neither ever waits
+ * for the other. The callback starts playing once the ring holds AUDIO_TARGET samples;
+ * when it runs dry, it holds the last sample and waits for that many again rather than
+ * stuttering. The frames are paced by the host clock and the device plays by its own,
+ * so the two drift apart: the rate the APU synthesizes at is nudged by a few hundredths
+ * of a percent at most, far below what can be heard, to keep the ring around its
+ * target. Audio and video stay locked and the emulation never blocks on the device.
+ */
+#define RING_SIZE 8192 // samples, must be a power of 2
+#define AUDIO_TARGET 2048 // samples in the ring right after a frame is pushed, about 43 ms
+#define MAX_ADJUSTMENT 0.0005f // of the nominal rate, either way, reached a quarter of the target away from it
+#define FILL_SMOOTHING 32 // frames the fill level is averaged over
+
+static int16_t ring[RING_SIZE];
+static atomic_size_t head = 0; // written by the producer
+static atomic_size_t tail = 0; // written by the consumer
+
+// emulation thread
+static float average_fill = AUDIO_TARGET;
+static int sample_rate = AUDIO_RATE;
+static int lowest_rate = AUDIO_RATE, highest_rate = AUDIO_RATE;
+static unsigned long dropped = 0; // samples that found the ring full
+
+// audio callback
+static bool playing = false;
+static int16_t last_sample = 0;
+static atomic_ulong underruns = 0;
+
+// called by the emulation thread with the samples of a frame, then sets the sample rate of the next one
+void audio_push(int16_t const *samples, int count) {
+	size_t h = atomic_load_explicit(&head, memory_order_relaxed);
+	size_t room = RING_SIZE - (h - atomic_load_explicit(&tail, memory_order_acquire));
+	if ((size_t) count > room) {
+		dropped += count - room;
+		count = room;
+	}
+	for (int i = 0; i < count; i++)
+		ring[(h + i) & (RING_SIZE - 1)] = samples[i];
+	atomic_store_explicit(&head, h + count, memory_order_release);
+
+	// fuller than the target: fewer samples per frame
+	size_t fill = h + count - atomic_load_explicit(&tail, memory_order_relaxed);
+	average_fill += (fill - average_fill) / FILL_SMOOTHING;
+	float adjustment = (AUDIO_TARGET - average_fill) / (AUDIO_TARGET / 4) * MAX_ADJUSTMENT;
+	if (adjustment > MAX_ADJUSTMENT)
+		adjustment = MAX_ADJUSTMENT;
+	else if (adjustment < -MAX_ADJUSTMENT)
+		adjustment = -MAX_ADJUSTMENT;
+	sample_rate = (int) (AUDIO_RATE * (1 + adjustment) + 0.5f);
+	if (sample_rate < lowest_rate)
+		lowest_rate = sample_rate;
+	if (sample_rate > highest_rate)
+		highest_rate = sample_rate;
+}
+
+int audio_sample_rate(void) {
+	return sample_rate;
+}
+
+// called by the audio callback for count samples
+void audio_pull(int16_t *samples, int count) {
+	size_t t = atomic_load_explicit(&tail, memory_order_relaxed);
+	size_t available = atomic_load_explicit(&head, memory_order_acquire) - t;
+	if (!playing && available >= AUDIO_TARGET)
+		playing = true;
+	int played = 0;
+	if (playing) {
+		played = available < (size_t) count ? (int) available : count;
+		for (int i = 0; i < played; i++)
+			samples[i] = ring[(t + i) & (RING_SIZE - 1)];
+		atomic_store_explicit(&tail, t + played, memory_order_release);
+		if (played)
+			last_sample = samples[played - 1];
+		if (played < count) {
+			playing = false;
+			atomic_fetch_add(&underruns, 1);
+		}
+	}
+	for (int i = played; i < count; i++)
+		samples[i] = last_sample;
+}
+
+void print_audio_report(void) {
+	printf("Sound: ran dry %lu times, %lu samples dropped, synthesized at %d to %d Hz\n",
+		atomic_load(&underruns), dropped, lowest_rate, highest_rate);
+}
@@ -0,0 +1,11 @@
+#ifndef HEADER_AUDIO
+#define HEADER_AUDIO
+
+#define AUDIO_RATE 48000 // nominal, what the device plays at
+
+void audio_push(int16_t const *samples, int count);
+int audio_sample_rate(void);
+void audio_pull(int16_t *samples, int count);
+void print_audio_report(void);
+
+#endif
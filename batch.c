@@ -0,0 +1,208 @@
+#define _POSIX_C_SOURCE 200809L // clock_gettime, sysconf
+
+#include <time.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include "loader.h"
+#include "cpu.h"
+#include "ppu.h"
+#include "mapper.h"
+#include "controller.h"
+#include "apu.h"
+#include "console.h"
+#include "interleave.h"
+#include "sprites.h"
+#include "pool.h"
+
+/*
+ * Batch runner: many consoles of the same ROM stepped side by side by a worker pool,
+ * one frame of every console per pool run, the way a training loop would step its
+ * environments. Every console gets its own input sequence, derived from its index
+ * and the frame only, so the results are the same whatever the number of threads;
+ * --scaling checks that on 1, 2, 4... threads and prints the speedup.
+ */
+#define INPUT_PERIOD 8 // frames with the same buttons held
+
+static struct {
+	int instances;
+	int threads;
+	long frames;
+	bool scaling;
+} options = { .instances = 64, .frames = 600 };
+
+typedef struct {
+	console **consoles;
+	long frame;
+} batch;
+
+// the PPU of every console calls back here; the pictures are only looked at in the end
+void display_frame_buffer(console *source, uint8_t const *internal_frame_buffer, uint8_t const *line_emphasis) {
+	(void) source, (void) internal_frame_buffer, (void) line_emphasis;
+}
+
+// buttons held by console index from the given frame on, a hash of both
+static uint8_t buttons_of(int index, long frame) {
+	uint32_t x = (uint32_t) index * 0x9E3779B9 ^ (uint32_t) (frame / INPUT_PERIOD) * 0x85EBCA6B;
+	x ^= x >> 15;
+	x *= 0x2C1B3C6D;
+	x ^= x >> 12;
+	return x & ~(BUTTON_SELECT | BUTTON_START) & 0xFF; // no pausing
+}
+
+// a console whose CPU failed stays where it stopped, the others go on
+static void step_console(void *context, int index) {
+	batch *b = context;
+	console *nes = b->consoles[index];
+	if (nes->cpu.failed)
+		return;
+	controller_set_buttons(&nes->controller, 0, buttons_of(index, b->frame));
+	unsigned long frame = nes->frames;
+	while (nes->frames == frame && !nes->cpu.failed)
+		console_run(nes);
+}
+
+// FNV-1a, enough to tell whether two runs produced the same picture
+static uint64_t hash_bytes(uint64_t hash, void const *data, size_t length) {
+	uint8_t const *bytes = data;
+	for (size_t i = 0; i < length; i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001B3;
+	}
+	return hash;
+}
+
+static double now(void) {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+// powers up every console, runs them all for the given frames and returns the hash of the final pictures and RAM; failed tells how many stopped early
+static uint64_t run_batch(console **consoles, int threads, double *seconds, int *failed) {
+	pool *workers = pool_create(threads);
+	if (!workers)
+		exit(EXIT_FAILURE);
+	for (int i = 0; i < options.instances; i++)
+		console_power_up(consoles[i]);
+
+	batch b = { consoles, 0 };
+	double start = now();
+	for (b.frame = 0; b.frame < options.frames; b.frame++)
+		pool_run(workers, options.instances, step_console, &b);
+	*seconds = now() - start;
+	pool_destroy(workers);
+
+	uint64_t hash = 0xCBF29CE484222325;
+	*failed = 0;
+	for (int i = 0; i < options.instances; i++) {
+		if (consoles[i]->cpu.failed) {
+			printf("Console %d failed at frame %lu: ", i, consoles[i]->frames);
+			cpu_print_failure(&consoles[i]->cpu);
+			(*failed)++;
+		}
+		hash = hash_bytes(hash, consoles[i]->ppu.frame_buffer, sizeof(consoles[i]->ppu.frame_buffer));
+		hash = hash_bytes(hash, consoles[i]->cpu.ram, sizeof(consoles[i]->cpu.ram));
+	}
+	return hash;
+}
+
+static void report(int threads, uint64_t hash, double seconds, double single_thread) {
+	double frames = (double) options.instances * options.frames;
+	printf("%3d threads: %9.1f frames/s, %8.1f frames/s per thread", threads, frames / seconds, frames / seconds / threads);
+	if (single_thread > 0)
+		printf(", speedup %5.2f", single_thread / seconds);
+	printf(", hash %016llX\n", (unsigned long long) hash);
+}
+
+static char const *parse_arguments(int argc, char *argv[]) {
+	char const *rom_file_name = NULL;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--instances") && i + 1 < argc) {
+			options.instances = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+			options.threads = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--frames") && i + 1 < argc) {
+			options.frames = strtol(argv[++i], NULL, 10);
+		} else if (!strcmp(argv[i], "--scaling")) {
+			options.scaling = true;
+		} else if (!strcmp(argv[i], "--core") && i + 1 < argc) {
+			i++;
+			if (!strcmp(argv[i], "fast")) {
+				fast_core = true;
+			} else if (!strcmp(argv[i], "jit")) {
+				fast_core = jit_core = true;
+			} else if (strcmp(argv[i], "microcode")) {
+				printf("Unknown CPU core: %s\n", argv[i]);
+				return NULL;
+			}
+		} else if (!strcmp(argv[i], "--lockstep")) {
+			lockstep = true;
+		} else if (argv[i][0] != '-' && !rom_file_name) {
+			rom_file_name = argv[i];
+		} else {
+			printf("Unknown argument: %s\n", argv[i]);
+			return NULL;
+		}
+	}
+	if (options.instances < 1 || options.frames < 1) {
+		puts("Instances and frames must be at least 1!");
+		return NULL;
+	}
+	if (options.threads < 1)
+		options.threads = sysconf(_SC_NPROCESSORS_ONLN) > 0 ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+	if (!rom_file_name)
+		puts("ROM filename is missing!");
+	return rom_file_name;
+}
+
+int main(int argc, char *argv[]) {
+	char const *rom_file_name = parse_arguments(argc, argv);
+	if (!rom_file_name) {
+		puts("Usage: funestus-batch [--instances N] [--threads N] [--frames N] [--scaling] [--core microcode|fast|jit] [--lockstep] ROM");
+		return EXIT_FAILURE;
+	}
+
+	struct rom rom;
+	if (!load_rom(rom_file_name, &rom))
+		return EXIT_FAILURE;
+	// selected before the threads race for them
+	printf("Using the %s tile decoder and the %s sprite finder\n", tile_decoder_name(), sprite_finder_name());
+	console **consoles = calloc(options.instances, sizeof(console *));
+	if (!consoles) {
+		puts("Error on memory allocation!");
+		return EXIT_FAILURE;
+	}
+	for (int i = 0; i < options.instances; i++)
+		if (!(consoles[i] = console_create(&rom)))
+			return EXIT_FAILURE;
+	printf("%d consoles of %zu bytes, %ld frames each\n", options.instances, sizeof(console), options.frames);
+
+	double seconds, single_thread = 0;
+	bool identical = true;
+	int failed;
+	if (options.scaling) {
+		uint64_t reference = run_batch(consoles, 1, &single_thread, &failed);
+		report(1, reference, single_thread, single_thread);
+		for (int threads = 2; threads / 2 < options.threads; threads *= 2) {
+			int used = threads < options.threads ? threads : options.threads; // the last step is all of them
+			uint64_t hash = run_batch(consoles, used, &seconds, &failed);
+			report(used, hash, seconds, single_thread);
+			identical = identical && hash == reference;
+		}
+		puts(identical ? "Results are identical for every thread count" : "Results depend on the thread count!");
+	} else {
+		uint64_t hash = run_batch(consoles, options.threads, &seconds, &failed);
+		report(options.threads, hash, seconds, 0);
+	}
+
+	for (int i = 0; i < options.instances; i++)
+		console_destroy(consoles[i]);
+	free(consoles);
+	unload_rom(&rom);
+	return identical && !failed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
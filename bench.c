@@ -0,0 +1,362 @@
+#define _POSIX_C_SOURCE 200809L // clock_gettime
+
+#include <time.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "loader.h"
+#include "cpu.h"
+#include "ppu.h"
+#include "mapper.h"
+#include "controller.h"
+#include "apu.h"
+#include "video.h"
+#include "console.h"
+#include "interleave.h"
+#include "sprites.h"
+#include "state.h"
+
+#define MAX_RUNS 1000
+#define DOTS_PER_FRAME (341 * 262)
+
+static long frame_counter = 0;
+static uint8_t const *last_frame_buffer;
+static uint8_t const *last_line_emphasis;
+
+static uint8_t synthetic_prg[0x4000];
+static uint8_t synthetic_chr[0x2000];
+static uint32_t converted_frame_buffer[256 * 240];
+static uint8_t decoded_chr[512][8][8];
+static console *synthetic; // NROM with the synthetic PRG and CHR
+
+// the benchmark takes the place of the SDL frontend
+void display_frame_buffer(console *source, uint8_t const *internal_frame_buffer, uint8_t const *line_emphasis) {
+	(void) source;
+	frame_counter++;
+	last_frame_buffer = internal_frame_buffer;
+	last_line_emphasis = line_emphasis;
+}
+
+static uint32_t map_rgb(void *pixel_format, uint8_t red, uint8_t green, uint8_t blue) {
+	(void) pixel_format;
+	return 0xFF000000 | red << 16 | green << 8 | blue; // ARGB8888
+}
+
+static double now(void) {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+/* a loop of common instructions without any PPU access, mirrored at $8000 and $C000
+$8000  LDX #$FF / TXS / LDA #$00 / STA $30 / LDA #$02 / STA $31 / LDY #$00
+$800D  LDA ($30),Y / ADC #$01 / STA ($30),Y / STA $40,X / INC $20 / LDA $20 / LSR A
+$801A  LDA $8000,X / JSR $8027 / INY / DEX / BNE $800D / JMP $800D
+$8027  PHA / PLA / RTS */
+static bool build_synthetic_rom(void) {
+	static uint8_t const program[] = {
+		0xA2, 0xFF, 0x9A, 0xA9, 0x00, 0x85, 0x30, 0xA9, 0x02, 0x85, 0x31, 0xA0, 0x00,
+		0xB1, 0x30, 0x69, 0x01, 0x91, 0x30, 0x95, 0x40, 0xE6, 0x20, 0xA5, 0x20, 0x4A,
+		0xBD, 0x00, 0x80, 0x20, 0x27, 0x80, 0xC8, 0xCA, 0xD0, 0xE9, 0x4C, 0x0D, 0x80,
+		0x48, 0x68, 0x60
+	};
+	memset(synthetic_prg, 0xEA, sizeof(synthetic_prg));
+	memcpy(synthetic_prg, program, sizeof(program));
+	for (int vector = 0x3FFA; vector < 0x4000; vector += 2) {
+		synthetic_prg[vector] = 0x00;
+		synthetic_prg[vector + 1] = 0x80;
+	}
+
+	uint32_t seed = 0x2A03;
+	for (size_t i = 0; i < sizeof(synthetic_chr); i++) {
+		seed = seed * 1103515245 + 12345;
+		synthetic_chr[i] = seed >> 16;
+	}
+
+	decode_tiles(synthetic_chr, decoded_chr, 512);
+	struct rom rom = {
+		.cartridge = { .prg_size = sizeof(synthetic_prg), .chr_size = sizeof(synthetic_chr), .mirroring = MIRROR_VERTICAL },
+		.prg = synthetic_prg,
+		.chr = synthetic_chr,
+		.decoded_chr = decoded_chr
+	};
+	synthetic = console_create(&rom);
+	return synthetic;
+}
+
+// fills the nametables and the palettes through PPUADDR/PPUDATA, like a game would do
+static void fill_canned_vram(struct ppu *ppu) {
+	ppu_write(ppu, 6, 0x20);
+	ppu_write(ppu, 6, 0x00);
+	for (int i = 0; i < 2048; i++)
+		ppu_write(ppu, 7, i * 7);
+	ppu_write(ppu, 6, 0x3F);
+	ppu_write(ppu, 6, 0x00);
+	for (int i = 0; i < 32; i++)
+		ppu_write(ppu, 7, i * 5);
+}
+
+/*************************************************** Workloads ****************************************************/
+// each workload returns how many units (cycles, dots, frames) it has processed
+
+static double run_cpu_synthetic(void) {
+	unsigned long long const cycles = 1000000;
+	cpu_power_up(&synthetic->cpu);
+	cpu_run(&synthetic->cpu, cycles);
+	return cycles;
+}
+
+static double run_cpu_fast(void) {
+	fast_core = true;
+	double cycles = run_cpu_synthetic();
+	fast_core = false;
+	return cycles;
+}
+
+static double run_cpu_jit(void) {
+	fast_core = jit_core = true;
+	double cycles = run_cpu_synthetic();
+	fast_core = jit_core = false;
+	return cycles;
+}
+
+static double run_ppu_render(void) {
+	int const frames = 10;
+	ppu_power_up(&synthetic->ppu);
+	fill_canned_vram(&synthetic->ppu);
+	ppu_sync(&synthetic->ppu, (unsigned long long) frames * DOTS_PER_FRAME);
+	return (double) frames * DOTS_PER_FRAME;
+}
+
+// the same frames with 64 sprites of 8x16 spread over the screen, 8 per line in places, and sprites shown
+static double run_sprite_render(void) {
+	int const frames = 10;
+	ppu_power_up(&synthetic->ppu);
+	fill_canned_vram(&synthetic->ppu);
+	ppu_write(&synthetic->ppu, 0, 0x20);
+	ppu_write(&synthetic->ppu, 1, 0x1E);
+	ppu_write(&synthetic->ppu, 3, 0x00);
+	for (int i = 0; i < 64; i++) {
+		ppu_write(&synthetic->ppu, 4, i * 29 % 224);
+		ppu_write(&synthetic->ppu, 4, i * 2);
+		ppu_write(&synthetic->ppu, 4, i & 0xE3);
+		ppu_write(&synthetic->ppu, 4, i * 37);
+	}
+	ppu_sync(&synthetic->ppu, (unsigned long long) frames * DOTS_PER_FRAME);
+	return (double) frames * DOTS_PER_FRAME;
+}
+
+/*
+ * Both pulses, the triangle and the noise holding notes for 1M cycles, sampled at
+ * 48 kHz and drained every frame: the cost of the sound per CPU cycle, to set against
+ * cpu_synthetic.
+ */
+static double run_apu_synthesis(void) {
+	unsigned long long const cycles = 1000000;
+	static uint8_t const writes[][2] = { // register, data
+		{ 0x15, 0x0F },
+		{ 0x00, 0xBF }, { 0x02, 0xFD }, { 0x03, 0x00 }, // 440 Hz, 50 % duty
+		{ 0x04, 0x7F }, { 0x06, 0x53 }, { 0x07, 0x01 }, // 330 Hz, 25 % duty
+		{ 0x08, 0xFF }, { 0x0A, 0x7E }, { 0x0B, 0x00 }, // 440 Hz
+		{ 0x0C, 0x3F }, { 0x0E, 0x03 }, { 0x0F, 0x00 }, // 56 kHz shift rate
+		{ 0x17, 0x40 }
+	};
+	struct apu *apu = &synthetic->apu;
+	apu_power_up(apu);
+	apu_set_sample_rate(apu, 48000);
+	for (size_t i = 0; i < sizeof(writes) / sizeof(writes[0]); i++)
+		apu_write(apu, 0x4000 | writes[i][0], writes[i][1]);
+	for (unsigned long long cycle = 0; cycle < cycles; ) {
+		cycle = cycle + 29781 < cycles ? cycle + 29781 : cycles;
+		apu_sync(apu, cycle);
+		apu->sample_count = 0;
+	}
+	apu_set_sample_rate(apu, 0);
+	return cycles;
+}
+
+static double run_tile_decode(void) {
+	int const passes = 100;
+	for (int i = 0; i < passes; i++)
+		decode_tiles(synthetic_chr, decoded_chr, 512);
+	return passes * 512;
+}
+
+static double run_frame_conversion(void) {
+	int const frames = 100;
+	for (int i = 0; i < frames; i++)
+		convert_frame_buffer(converted_frame_buffer, last_frame_buffer, last_line_emphasis);
+	return frames;
+}
+
+static console *rom_console;
+
+static double run_rom_boot(void) {
+	long const last_frame = frame_counter + 600;
+	console_power_up(rom_console);
+	while (frame_counter < last_frame && !rom_console->cpu.failed)
+		console_run(rom_console);
+	return cpu_cycles(&rom_console->cpu);
+}
+
+static double run_rom_boot_fast(void) {
+	fast_core = true;
+	double cycles = run_rom_boot();
+	fast_core = false;
+	return cycles;
+}
+
+static double run_rom_boot_jit(void) {
+	fast_core = jit_core = true;
+	double cycles = run_rom_boot();
+	fast_core = jit_core = false;
+	return cycles;
+}
+
+// a save and a load of the state the ROM boot left behind
+static double run_state_save_load(void) {
+	int const rounds = 1000;
+	static snapshot *state;
+	if (!state)
+		state = calloc(1, state_size(rom_console));
+	for (int i = 0; i < rounds; i++) {
+		state_save(rom_console, state);
+		state_load(rom_console, state);
+	}
+	return rounds;
+}
+
+/*************************************************** Statistics ***************************************************/
+typedef struct {
+	double min;
+	double median;
+	double p99;
+} statistics;
+
+static int compare_doubles(void const *a, void const *b) {
+	double x = *(double const *) a, y = *(double const *) b;
+	return (x > y) - (x < y);
+}
+
+static statistics summarize(double *samples, int count) {
+	qsort(samples, count, sizeof(double), compare_doubles);
+	int p99_rank = (99 * count + 99) / 100; // nearest rank
+	return (statistics) {
+		.min = samples[0],
+		.median = count % 2 ? samples[count / 2] : (samples[count / 2 - 1] + samples[count / 2]) / 2,
+		.p99 = samples[p99_rank - 1]
+	};
+}
+
+static FILE *json;
+static bool first_result = true;
+
+static void report(char const *name, char const *unit, double *samples, int count) {
+	statistics stats = summarize(samples, count);
+	printf("%-16s %-10s min %12.3f  median %12.3f  p99 %12.3f\n", name, unit, stats.min, stats.median, stats.p99);
+	if (json) {
+		fprintf(json, "%s\n\t\t{ \"name\": \"%s\", \"unit\": \"%s\", \"runs\": %d, \"min\": %.6f, \"median\": %.6f, \"p99\": %.6f }",
+			first_result ? "" : ",", name, unit, count, stats.min, stats.median, stats.p99);
+		first_result = false;
+	}
+}
+
+/*
+ * Every workload is repeated, and each run yields one sample per metric. The time
+ * metrics (ns per unit) come from the run duration, while frames/s is derived
+ * from the frames completed by the PPU during that same run.
+ */
+static void benchmark(char const *name, double (*workload)(void), int runs, char const *unit, bool frame_rate) {
+	double ns_per_unit[MAX_RUNS], frames_per_second[MAX_RUNS];
+
+	workload(); // warm-up
+	for (int run = 0; run < runs; run++) {
+		long first_frame = frame_counter;
+		double start = now();
+		double units = workload();
+		double seconds = now() - start;
+		ns_per_unit[run] = seconds * 1e9 / units;
+		frames_per_second[run] = (frame_counter - first_frame) / seconds;
+	}
+	report(name, unit, ns_per_unit, runs);
+	if (frame_rate) {
+		char rate_name[64];
+		snprintf(rate_name, sizeof(rate_name), "%s_fps", name);
+		report(rate_name, "frames/s", frames_per_second, runs);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	int runs = 15;
+	char const *json_file_name = "bench.json";
+	char const *rom_file_name = NULL;
+	bool failed = false;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-r") && i + 1 < argc)
+			runs = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+			json_file_name = argv[++i];
+		else if (argv[i][0] != '-')
+			rom_file_name = argv[i];
+		else {
+			puts("Usage: funestus-bench [-r RUNS] [-o FILE.json] [ROM]");
+			return EXIT_FAILURE;
+		}
+	}
+	if (runs < 1 || runs > MAX_RUNS) {
+		printf("The number of runs must be between 1 and %d\n", MAX_RUNS);
+		return EXIT_FAILURE;
+	}
+
+	json = fopen(json_file_name, "w");
+	if (!json)
+		printf("Could not open %s, results will not be saved\n", json_file_name);
+	else
+		fprintf(json, "{\n\t\"compiler\": \"%s\",\n\t\"runs\": %d,\n\t\"results\": [", __VERSION__, runs);
+
+	if (!build_synthetic_rom())
+		return EXIT_FAILURE;
+	build_color_table(map_rgb, NULL);
+	if (!tile_decoder_self_test() || !sprite_finder_self_test())
+		return EXIT_FAILURE;
+	printf("Using the %s tile decoder and the %s sprite finder\n", tile_decoder_name(), sprite_finder_name());
+
+	benchmark("cpu_synthetic", run_cpu_synthetic, runs, "ns/cycle", false);
+	benchmark("cpu_fast", run_cpu_fast, runs, "ns/cycle", false);
+	benchmark("cpu_jit", run_cpu_jit, runs, "ns/cycle", false);
+	benchmark("ppu_render", run_ppu_render, runs, "ns/dot", true);
+	benchmark("sprite_render", run_sprite_render, runs, "ns/dot", true);
+	benchmark("apu_synthesis", run_apu_synthesis, runs, "ns/cycle", false);
+	benchmark("tile_decode", run_tile_decode, runs, "ns/tile", false);
+	benchmark("frame_conversion", run_frame_conversion, runs, "ns/frame", false);
+
+	if (rom_file_name) {
+		struct rom rom;
+		if (load_rom(rom_file_name, &rom) && (rom_console = console_create(&rom))) {
+			run_rom_boot(); // a ROM the CPU fails on has no boot to measure
+			if (rom_console->cpu.failed) {
+				cpu_print_failure(&rom_console->cpu);
+				failed = true;
+			} else {
+				benchmark("rom_boot", run_rom_boot, runs, "ns/cycle", true);
+				benchmark("rom_boot_fast", run_rom_boot_fast, runs, "ns/cycle", true);
+				benchmark("rom_boot_jit", run_rom_boot_jit, runs, "ns/cycle", true);
+				benchmark("state_save_load", run_state_save_load, runs, "ns/round", false);
+			}
+			console_destroy(rom_console);
+			unload_rom(&rom);
+		}
+	} else {
+		puts("No ROM given: skipping the ROM boot workload");
+	}
+
+	if (json) {
+		fprintf(json, "\n\t]\n}\n");
+		fclose(json);
+		printf("Results saved to %s\n", json_file_name);
+	}
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
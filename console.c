@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "loader.h"
+#include "cpu.h"
+#include "ppu.h"
+#include "mapper.h"
+#include "controller.h"
+#include "apu.h"
+#include "console.h"
+#include "jit.h"
+
+bool lockstep = false;
+
+// a console for the given ROM, to be powered up before it runs; NULL when out of memory
+console *console_create(struct rom const *rom) {
+	console *nes = calloc(1, sizeof(console));
+	if (!nes) {
+		puts("Error on memory allocation!");
+		return NULL;
+	}
+	nes->cpu.console = nes->ppu.console = nes->apu.console = nes;
+	nes->cartridge = rom->cartridge;
+	nes->prg = rom->prg;
+	if (rom->cartridge.chr_ram) {
+		size_t tiles = rom->cartridge.chr_size / 16;
+		nes->chr = calloc(rom->cartridge.chr_size, 1);
+		nes->ppu.decoded_tiles = malloc(tiles * sizeof(*nes->ppu.decoded_tiles));
+		nes->ppu.decoded = calloc(tiles, sizeof(bool));
+		if (!nes->chr || !nes->ppu.decoded_tiles || !nes->ppu.decoded) {
+			puts("Error on memory allocation!");
+			console_destroy(nes);
+			return NULL;
+		}
+	} else {
+		nes->chr = rom->chr;
+		nes->ppu.decoded_tiles = rom->decoded_chr;
+	}
+	return nes;
+}
+
+void console_destroy(console *nes) {
+	if (!nes)
+		return;
+	if (nes->cartridge.chr_ram) {
+		free(nes->chr);
+		free(nes->ppu.decoded_tiles);
+		free(nes->ppu.decoded);
+	}
+	jit_destroy(nes->cpu.jit);
+	free(nes);
+}
+
+void console_power_up(console *nes) {
+	cpu_power_up(&nes->cpu);
+	ppu_power_up(&nes->ppu);
+	mapper_power_up(nes);
+	controller_power_up(&nes->controller);
+	apu_power_up(&nes->apu);
+	if (nes->cartridge.chr_ram)
+		memset(nes->chr, 0, nes->cartridge.chr_size);
+}
+
+/*
+ * Runs the console up to the end of the CPU cycle in which the PPU reaches its next
+ * event (a completed frame or the start of vblank). In lockstep every CPU cycle is
+ * surrounded by PPU dots: ppu, cpu, ppu, ppu. Otherwise the CPU runs ahead on its
+ * own and the PPU is caught up when its registers are accessed or the event comes.
+ * Both ways stop in the same state: 3 dots per CPU cycle. An OAM DMA charges its
+ * cycles at once and may carry the CPU past the event, and so may a DMC fetch made
+ * while the APU catches up between two runs; the PPU then catches up with the CPU,
+ * through the event.
+ *
+ * An APU event (frame IRQ, DMC fetch) coming first stops the CPU at its cycle instead,
+ * so that the IRQ is seen on time. One that a register write brings closer while the
+ * CPU runs is only seen at the next stop.
+ */
+static void run_cpu(console *nes, unsigned long long cycle) {
+	if (!lockstep) {
+		cpu_run(&nes->cpu, cycle);
+		return;
+	}
+	while (cpu_cycles(&nes->cpu) < cycle) {
+		ppu_exec(&nes->ppu);
+		cpu_exec(&nes->cpu);
+		while (nes->ppu.dot_counter < 3 * cpu_cycles(&nes->cpu))
+			ppu_exec(&nes->ppu);
+	}
+}
+
+void console_run(console *nes) {
+	unsigned long long cycle = ppu_next_event(&nes->ppu) / 3;
+	unsigned long long apu_event = apu_next_event(&nes->apu);
+
+	if (apu_event <= cycle) {
+		run_cpu(nes, apu_event);
+		apu_sync(&nes->apu, cpu_cycles(&nes->cpu));
+	} else if (lockstep) {
+		run_cpu(nes, cycle + 1);
+	} else {
+		cpu_run(&nes->cpu, cycle);
+		if (cpu_cycles(&nes->cpu) == cycle) {
+			ppu_sync(&nes->ppu, 3 * cycle + 1);
+			cpu_exec(&nes->cpu);
+		}
+	}
+	ppu_sync(&nes->ppu, 3 * cpu_cycles(&nes->cpu));
+}
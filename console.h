@@ -0,0 +1,29 @@
+#ifndef HEADER_CONSOLE
+#define HEADER_CONSOLE
+
+extern bool lockstep; // run the PPU in lockstep with the CPU instead of letting it catch up lazily
+
+/*
+ * One console: everything that changes while it runs, so that any number of them can
+ * run side by side in one process, each on one thread at a time. Consoles running the
+ * same ROM share its PRG and decoded CHR ROM, which are never written; CHR RAM is
+ * their own. Options (fast_core, lockstep) and the trace are process-wide.
+ */
+typedef struct console {
+	struct cpu cpu;
+	struct ppu ppu;
+	struct mapper mapper;
+	struct controller controller;
+	struct apu apu;
+	struct cartridge cartridge;
+	uint8_t *prg;
+	uint8_t *chr; // the CHR ROM of the ROM, or the CHR RAM of this console
+	unsigned long frames; // completed by the PPU since the console was created
+} console;
+
+console *console_create(struct rom const *rom);
+void console_destroy(console *nes);
+void console_power_up(console *nes);
+void console_run(console *nes);
+
+#endif
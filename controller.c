@@ -0,0 +1,64 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "controller.h"
+#include "latency.h"
+#include "state.h"
+
+/*
+ * Standard controllers. The window publishes the buttons held on both ports in one
+ * atomic word whenever they change, and the console samples that word when the game
+ * strobes $4016, as the shift registers of the controllers do: the game sees the
+ * buttons as they are at that moment, not as they were at the start of the frame.
+ */
+
+// from any thread
+void controller_set_buttons(struct controller *controller, int port, uint8_t buttons) {
+	unsigned other = atomic_load_explicit(&controller->pressed, memory_order_relaxed) & (port ? 0x00FF : 0xFF00);
+	atomic_store_explicit(&controller->pressed, other | buttons << (port ? 8 : 0), memory_order_relaxed);
+}
+
+static void latch(struct controller *controller) {
+	unsigned buttons = atomic_load_explicit(&controller->pressed, memory_order_relaxed);
+	controller->shift[0] = buttons;
+	controller->shift[1] = buttons >> 8;
+	if (buttons != controller->latched) {
+		controller->latched = buttons;
+		latency_latch();
+	}
+}
+
+void controller_power_up(struct controller *controller) {
+	controller->shift[0] = controller->shift[1] = 0;
+	controller->strobe = false;
+}
+
+// $4016: the shift registers keep reloading while bit 0 is set, and hold the last load once it is cleared
+void controller_write(struct controller *controller, uint8_t data) {
+	if (controller->strobe || (data & 0x01))
+		latch(controller);
+	controller->strobe = data & 0x01;
+}
+
+// $4016 and $4017: one button per read, A first; official controllers return 1 after the eighth
+uint8_t controller_read(struct controller *controller, int port) {
+	if (controller->strobe)
+		latch(controller);
+	uint8_t bit = controller->shift[port] & 0x01;
+	if (!controller->strobe)
+		controller->shift[port] = controller->shift[port] >> 1 | 0x80;
+	return bit;
+}
+
+void controller_save_state(struct controller const *controller, struct controller_state *state) {
+	state->shift[0] = controller->shift[0];
+	state->shift[1] = controller->shift[1];
+	state->strobe = controller->strobe;
+}
+
+void controller_load_state(struct controller *controller, struct controller_state const *state) {
+	controller->shift[0] = state->shift[0];
+	controller->shift[1] = state->shift[1];
+	controller->strobe = state->strobe;
+}
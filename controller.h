@@ -0,0 +1,25 @@
+#ifndef HEADER_CONTROLLER
+#define HEADER_CONTROLLER
+
+#define BUTTON_A 0x01
+#define BUTTON_B 0x02
+#define BUTTON_SELECT 0x04
+#define BUTTON_START 0x08
+#define BUTTON_UP 0x10
+#define BUTTON_DOWN 0x20
+#define BUTTON_LEFT 0x40
+#define BUTTON_RIGHT 0x80
+
+struct controller {
+	_Atomic unsigned pressed; // port 1 in bits 0-7, port 2 in bits 8-15
+	unsigned latched; // the word at the last latch, to tell when new input reaches the game
+	uint8_t shift[2];
+	bool strobe;
+};
+
+void controller_set_buttons(struct controller *controller, int port, uint8_t buttons);
+void controller_power_up(struct controller *controller);
+void controller_write(struct controller *controller, uint8_t data);
+uint8_t controller_read(struct controller *controller, int port);
+
+#endif
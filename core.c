@@ -1,15 +1,74 @@
+#define _POSIX_C_SOURCE 200809L // clock_gettime
+
+#include <time.h>
 #include <stdio.h>
+#include <limits.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 #include "SDL2/SDL.h"
 #include "loader.h"
 #include "cpu.h"
 #include "ppu.h"
+#include "mapper.h"
+#include "controller.h"
+#include "apu.h"
+#include "video.h"
+#include "console.h"
+#include "interleave.h"
+#include "sprites.h"
+#include "hash.h"
+#include "pacing.h"
+#include "trace.h"
+#include "state.h"
+#include "rewind.h"
+#include "latency.h"
+#include "audio.h"
 
 static uint32_t FRAME_BUFFER_READY; // SDL2 event
 
-static uint32_t frame_buffer[256 * 240];
-static uint32_t nes_color[256];
+
+static struct {
+	bool headless; // run without SDL, as fast as possible
+	long frames; // stop after this amount of frames (0: run forever)
+	int speed; // run N times faster than a real console (0: as fast as possible)
+	bool hash; // print a hash of the last frame buffer before leaving
+	bool self_test; // check the SIMD kernels and checksums against their reference and leave
+	char const *trace; // binary instruction trace file (needs a build with TRACE=1)
+	long trace_pc; // start tracing when the CPU reaches this address (-1: unset)
+	long trace_frame; // start tracing with this frame (-1: unset)
+	long trace_limit; // stop tracing after this amount of instructions (0: no limit)
+	char const *state; // file saved with F5 and loaded with F7 (default: ROM.state)
+	bool load_state; // start from the state file
+	bool save_state; // headless: save the state file after the last frame
+	int rewind; // MB of rewind history (0: none), held Backspace goes back in time
+	int run_ahead; // frames emulated ahead of the one shown, then taken back
+	bool latency; // measure the time from key events to the screen
+	char const *wav; // headless: write the sound to this WAV file
+} options;
+
+// the window asks, the emulation thread saves or loads between two frames
+static atomic_int state_request;
+enum { NO_STATE_REQUEST, SAVE_STATE, LOAD_STATE };
+static atomic_bool rewinding = false;
+static atomic_bool quitting = false; // the window is closed, the emulation thread stops after its frame
+static SDL_Thread *emulation_thread;
+
+static struct rom rom;
+static console *nes;
+
+static long frame_counter = 0; // real frames, run-ahead ones do not count
+static uint8_t const *last_frame_buffer;
+static bool running_ahead = false;
+static bool presenting = true; // the picture of the frame being emulated is shown
+static snapshot *run_ahead_state;
+
+static bool unannounced = false; // a published frame whose event could not be pushed
+static SDL_AudioDeviceID audio_device; // 0: no sound
+static FILE *wav_file;
+static uint32_t wav_bytes;
 
 static struct {
 	SDL_Window *window;
@@ -18,33 +77,138 @@ static struct {
 	SDL_Palette *palette;
 } sdl;
 
+static void run_frame(void) {
+	unsigned long frame = nes->frames; // run-ahead frames included
+	while (nes->frames == frame && !nes->cpu.failed)
+		console_run(nes);
+}
+
+/*
+ * The samples of the frame just run go to the audio ring and the WAV file, or nowhere
+ * while rewinding. Only frames paced in real time are heard, fast-forward produces
+ * sound faster than it can be played. The ring tells the sample rate of the next
+ * frame. Samples are in host byte order, little-endian wherever the frontend runs.
+ */
+static void output_audio(bool play) {
+	int16_t samples[APU_SAMPLES];
+	int count = apu_drain(&nes->apu, samples, APU_SAMPLES);
+	if (!play || !count)
+		return;
+	if (wav_file && fwrite(samples, sizeof(*samples), count, wav_file) == (size_t) count)
+		wav_bytes += count * sizeof(*samples);
+	if (audio_device && paced_in_real_time()) {
+		audio_push(samples, count);
+		apu_set_sample_rate(&nes->apu, audio_sample_rate());
+	}
+}
+
+/*
+ * Run-ahead: the frames after the real one are emulated right away and only the
+ * last one is shown, then the console goes back to the end of the real frame. What
+ * the game does in reaction to input shows up that many frames earlier. Frames that
+ * are not shown skip the color conversion.
+ */
+static void run_ahead(void) {
+	state_save(nes, run_ahead_state);
+	int sample_rate = nes->apu.sample_rate;
+	apu_set_sample_rate(&nes->apu, 0); // the real frames will play them, so nothing to synthesize
+	running_ahead = true;
+	for (int i = 1; i <= options.run_ahead; i++) {
+		presenting = i == options.run_ahead;
+		run_frame();
+	}
+	running_ahead = false;
+	presenting = false;
+	state_load(nes, run_ahead_state);
+	apu_set_sample_rate(&nes->apu, sample_rate);
+}
+
 static int loop_emulation(void *arg) {
 	(void) arg;
 
-	while (true) {
-		ppu_exec();
-		cpu_exec();
-		ppu_exec();
-		ppu_exec();
+	presenting = !options.run_ahead;
+	while ((!options.frames || frame_counter < options.frames) && !atomic_load(&quitting)) {
+		run_frame();
+		if (nes->cpu.failed) { // the picture stays on the last frame
+			cpu_print_failure(&nes->cpu);
+			break;
+		}
+		output_audio(!atomic_load(&rewinding));
+		int request = atomic_exchange(&state_request, NO_STATE_REQUEST);
+		if (request == SAVE_STATE)
+			state_save_file(nes, options.state);
+		else if (request == LOAD_STATE && state_load_file(nes, options.state))
+			rewind_reset();
+		if (atomic_load(&rewinding))
+			rewind_step();
+		else
+			rewind_capture();
+		if (options.run_ahead)
+			run_ahead();
+		pace_frame();
 	}
 	return 0;
 }
 
-void display_frame_buffer(uint8_t const *internal_frame_buffer) {
-	for (int i = 0; i < 256 * 240; i++) {
-		//uint8_t color = internal_frame_buffer[i] * 21;
-		uint8_t color = 0x22;
-		switch (internal_frame_buffer[i]) {
-			case 0: color = 0x3F; break;
-			case 1: color = 0x00; break;
-			case 2: color = 0x10; break;
-			case 3: color = 0x20; break;
-		}
-		frame_buffer[i] = nes_color[color];
+// the frontend runs a single console
+void display_frame_buffer(console *source, uint8_t const *internal_frame_buffer, uint8_t const *line_emphasis) {
+	(void) source;
+	if (!running_ahead) {
+		frame_counter++;
+		trace_frame(frame_counter);
+	}
+	last_frame_buffer = internal_frame_buffer;
+	if (options.headless) {
+		trace_drain(); // nobody else would empty the ring
+		return;
+	}
+	if (!presenting)
+		return;
+
+	convert_frame_buffer(back_frame_buffer(), internal_frame_buffer, line_emphasis);
+	// only one event is pending at a time, frames published meanwhile replace the one it announces
+	bool announce = publish_frame_buffer() || unannounced;
+	latency_published();
+	if (announce) {
+		SDL_Event event;
+		event.type = FRAME_BUFFER_READY;
+		unannounced = SDL_PushEvent(&event) != 1; // the queue is full: the next frame tries again
+	}
+}
+
+// controller 1 on the keyboard: arrows, X (A), Z (B), Enter (Start) and right Shift (Select)
+static uint8_t button_of(SDL_Keycode key) {
+	switch (key) {
+	case SDLK_x: return BUTTON_A;
+	case SDLK_z: return BUTTON_B;
+	case SDLK_RSHIFT: return BUTTON_SELECT;
+	case SDLK_RETURN: return BUTTON_START;
+	case SDLK_UP: return BUTTON_UP;
+	case SDLK_DOWN: return BUTTON_DOWN;
+	case SDLK_LEFT: return BUTTON_LEFT;
+	case SDLK_RIGHT: return BUTTON_RIGHT;
+	default: return 0;
+	}
+}
+
+static uint32_t map_rgb(void *pixel_format, uint8_t red, uint8_t green, uint8_t blue) {
+	return SDL_MapRGBA(pixel_format, red, green, blue, SDL_ALPHA_OPAQUE);
+}
+
+static void SDLCALL play_audio(void *userdata, Uint8 *stream, int length) {
+	(void) userdata;
+	audio_pull((int16_t *) stream, length / sizeof(int16_t));
+}
+
+// 16-bit mono, pulled from the ring the emulation thread fills after every frame; without a device the game runs muted
+static void open_audio(void) {
+	SDL_AudioSpec wanted = { .freq = AUDIO_RATE, .format = AUDIO_S16SYS, .channels = 1, .samples = 512, .callback = play_audio };
+	if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0 || !(audio_device = SDL_OpenAudioDevice(NULL, 0, &wanted, NULL, 0))) {
+		printf("No sound: %s\n", SDL_GetError());
+		return;
 	}
-	SDL_Event event;
-	event.type = FRAME_BUFFER_READY;
-	SDL_PushEvent(&event);
+	apu_set_sample_rate(&nes->apu, AUDIO_RATE);
+	SDL_PauseAudioDevice(audio_device, 0);
 }
 
 static bool initialize_sdl(void) {
@@ -60,6 +224,7 @@ static bool initialize_sdl(void) {
 
 	if (SDL_Init(SDL_INIT_VIDEO) != 0)
 		return false;
+	open_audio();
 
 	sdl.window = SDL_CreateWindow("funestus", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 768, 720, SDL_WINDOW_SHOWN);
 	if (!sdl.window)
@@ -84,32 +249,14 @@ static bool initialize_sdl(void) {
 	if (!sdl.texture)
 		return false;
 
-	// http://drag.wootest.net/misc/palgen.html
-	uint8_t const A = SDL_ALPHA_OPAQUE;
-	SDL_Color colors[64] = {
-		{ 0x46, 0x46, 0x46, A }, { 0x00, 0x06, 0x5A, A }, { 0x00, 0x06, 0x78, A }, { 0x02, 0x06, 0x73, A },
-		{ 0x35, 0x03, 0x4C, A }, { 0x57, 0x00, 0x0E, A }, { 0x5A, 0x00, 0x00, A }, { 0x41, 0x00, 0x00, A },
-		{ 0x12, 0x02, 0x00, A }, { 0x00, 0x14, 0x00, A }, { 0x00, 0x1E, 0x00, A }, { 0x00, 0x1E, 0x00, A },
-		{ 0x00, 0x15, 0x21, A }, { 0x00, 0x00, 0x00, A }, { 0x00, 0x00, 0x00, A }, { 0x00, 0x00, 0x00, A },
-		{ 0x9D, 0x9D, 0x9D, A }, { 0x00, 0x4A, 0xB9, A }, { 0x05, 0x30, 0xE1, A }, { 0x57, 0x18, 0xDA, A },
-		{ 0x9F, 0x07, 0xA7, A }, { 0xCC, 0x02, 0x55, A }, { 0xCF, 0x0B, 0x00, A }, { 0xA4, 0x23, 0x00, A },
-		{ 0x5C, 0x3F, 0x00, A }, { 0x0B, 0x58, 0x00, A }, { 0x00, 0x66, 0x00, A }, { 0x00, 0x67, 0x13, A },
-		{ 0x00, 0x5E, 0x6E, A }, { 0x00, 0x00, 0x00, A }, { 0x00, 0x00, 0x00, A }, { 0x00, 0x00, 0x00, A },
-		{ 0xFE, 0xFF, 0xFF, A }, { 0x1F, 0x9E, 0xFF, A }, { 0x53, 0x76, 0xFF, A }, { 0x98, 0x65, 0xFF, A },
-		{ 0xFC, 0x67, 0xFF, A }, { 0xFF, 0x6C, 0xB3, A }, { 0xFF, 0x74, 0x66, A }, { 0xFF, 0x80, 0x14, A },
-		{ 0xC4, 0x9A, 0x00, A }, { 0x71, 0xB3, 0x00, A }, { 0x28, 0xC4, 0x21, A }, { 0x00, 0xC8, 0x74, A },
-		{ 0x00, 0xBF, 0xD0, A }, { 0x2B, 0x2B, 0x2B, A }, { 0x00, 0x00, 0x00, A }, { 0x00, 0x00, 0x00, A },
-		{ 0xFE, 0xFF, 0xFF, A }, { 0x9E, 0xD5, 0xFF, A }, { 0xAF, 0xC0, 0xFF, A }, { 0xD0, 0xB8, 0xFF, A },
-		{ 0xFE, 0xBF, 0xFF, A }, { 0xFF, 0xC0, 0xE0, A }, { 0xFF, 0xC3, 0xBD, A }, { 0xFF, 0xCA, 0x9C, A },
-		{ 0xE7, 0xD5, 0x8B, A }, { 0xC5, 0xDF, 0x8E, A }, { 0xA6, 0xE6, 0xA3, A }, { 0x94, 0xE8, 0xC5, A },
-		{ 0x92, 0xE4, 0xEB, A }, { 0xA7, 0xA7, 0xA7, A }, { 0x00, 0x00, 0x00, A }, { 0x00, 0x00, 0x00, A }
-	};
+	SDL_Color colors[64];
+	for (int i = 0; i < 64; i++)
+		colors[i] = (SDL_Color) { palette_rgb[i][0], palette_rgb[i][1], palette_rgb[i][2], SDL_ALPHA_OPAQUE };
 
 	SDL_PixelFormat *pixel_format = SDL_AllocFormat(pixel_format_enum);
 	if (!pixel_format)
 		return false;
-	for (int i = 0; i < 64; i++)
-		nes_color[i] = SDL_MapRGBA(pixel_format, colors[i].r, colors[i].g, colors[i].b, colors[i].a);
+	build_color_table(map_rgb, pixel_format);
 	SDL_FreeFormat(pixel_format);
 
 	sdl.palette = SDL_AllocPalette(64);
@@ -122,41 +269,302 @@ static bool initialize_sdl(void) {
 	if (FRAME_BUFFER_READY == (uint32_t) -1)
 		return false;
 
-	SDL_Thread *thread = SDL_CreateThread(loop_emulation, NULL, (void *) NULL);
-	if (!thread)
+	emulation_thread = SDL_CreateThread(loop_emulation, NULL, (void *) NULL);
+	if (!emulation_thread)
 		return false;
-	SDL_DetachThread(thread);
 
 	return true;
 }
 
-int main(int argc, char *argv[]) {
-	if (argc < 2) {
+// FNV-1a, enough to tell whether two runs produced the same picture
+static uint64_t hash_frame_buffer(uint8_t const *internal_frame_buffer) {
+	uint64_t hash = 0xCBF29CE484222325;
+	for (int i = 0; i < 256 * 240; i++) {
+		hash ^= internal_frame_buffer[i];
+		hash *= 0x100000001B3;
+	}
+	return hash;
+}
+
+static double elapsed_seconds(struct timespec const *start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void put_little_endian(uint8_t *bytes, uint32_t value, int count) {
+	for (int i = 0; i < count; i++)
+		bytes[i] = value >> 8 * i;
+}
+
+// 16-bit mono PCM at AUDIO_RATE: the header is written again with the sizes once the sound is complete
+static void write_wav_header(FILE *file, uint32_t data_bytes) {
+	uint8_t header[44];
+	memcpy(header, "RIFF", 4);
+	put_little_endian(header + 4, 36 + data_bytes, 4);
+	memcpy(header + 8, "WAVEfmt ", 8);
+	put_little_endian(header + 16, 16, 4);
+	put_little_endian(header + 20, 1, 2); // PCM
+	put_little_endian(header + 22, 1, 2); // channels
+	put_little_endian(header + 24, AUDIO_RATE, 4);
+	put_little_endian(header + 28, AUDIO_RATE * sizeof(int16_t), 4);
+	put_little_endian(header + 32, sizeof(int16_t), 2);
+	put_little_endian(header + 34, 16, 2);
+	memcpy(header + 36, "data", 4);
+	put_little_endian(header + 40, data_bytes, 4);
+	fwrite(header, sizeof(header), 1, file);
+}
+
+static bool close_wav(void) {
+	fseek(wav_file, 0, SEEK_SET);
+	write_wav_header(wav_file, wav_bytes);
+	bool written = !ferror(wav_file);
+	if (fclose(wav_file) != 0)
+		written = false;
+	printf(written ? "%.1f s of sound written to %s\n" : "Could not write %.1f s of sound to %s\n",
+		wav_bytes / (double) (AUDIO_RATE * sizeof(int16_t)), options.wav);
+	return written;
+}
+
+static int run_headless(void) {
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	loop_emulation(NULL);
+	double seconds = elapsed_seconds(&start);
+	unsigned long long cycle_counter = cpu_cycles(&nes->cpu);
+
+	printf("%ld frames, %llu CPU cycles in %.3f s\n", frame_counter, cycle_counter, seconds);
+	printf("%.1f frames/s, %.0f cycles/s\n", frame_counter / seconds, cycle_counter / seconds);
+	print_pacing_report();
+	print_rewind_report();
+	trace_close();
+	if (wav_file && !close_wav())
+		return EXIT_FAILURE;
+	if (nes->cpu.failed)
+		return EXIT_FAILURE;
+	if (options.save_state && !state_save_file(nes, options.state))
+		return EXIT_FAILURE;
+	if (options.hash) {
+		if (last_frame_buffer)
+			printf("Frame buffer hash: %016llX\n", (unsigned long long) hash_frame_buffer(last_frame_buffer));
+		else
+			puts("Frame buffer hash: no frame was completed");
+	}
+	puts("Finish!");
+	return EXIT_SUCCESS;
+}
+
+static void release_console(void) {
+	console_destroy(nes);
+	unload_rom(&rom);
+}
+
+static char const *parse_arguments(int argc, char *argv[]) {
+	char const *rom_file_name = NULL;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--headless")) {
+			options.headless = true;
+		} else if (!strcmp(argv[i], "--frames") && i + 1 < argc) {
+			options.frames = strtol(argv[++i], NULL, 10);
+			if (options.frames < 0)
+				options.frames = 0;
+		} else if (!strcmp(argv[i], "--speed") && i + 1 < argc) {
+			char *end;
+			long speed = strtol(argv[++i], &end, 10);
+			if (end == argv[i] || *end || speed < 1 || speed > INT_MAX) {
+				printf("Invalid speed: %s (a whole factor of at least 1, or --uncapped)\n", argv[i]);
+				return NULL;
+			}
+			options.speed = speed;
+		} else if (!strcmp(argv[i], "--uncapped")) {
+			options.speed = 0;
+		} else if (!strcmp(argv[i], "--hash")) {
+			options.hash = true;
+		} else if (!strcmp(argv[i], "--core") && i + 1 < argc) {
+			i++;
+			if (!strcmp(argv[i], "fast")) {
+				fast_core = true;
+			} else if (!strcmp(argv[i], "jit")) {
+				fast_core = jit_core = true;
+			} else if (strcmp(argv[i], "microcode")) {
+				printf("Unknown CPU core: %s\n", argv[i]);
+				return NULL;
+			}
+		} else if (!strcmp(argv[i], "--lockstep")) {
+			lockstep = true;
+		} else if (!strcmp(argv[i], "--trace") && i + 1 < argc) {
+			options.trace = argv[++i];
+		} else if (!strcmp(argv[i], "--trace-pc") && i + 1 < argc) {
+			options.trace_pc = strtol(argv[++i], NULL, 16) & 0xFFFF;
+		} else if (!strcmp(argv[i], "--trace-frame") && i + 1 < argc) {
+			options.trace_frame = strtol(argv[++i], NULL, 10);
+		} else if (!strcmp(argv[i], "--trace-limit") && i + 1 < argc) {
+			options.trace_limit = strtol(argv[++i], NULL, 10);
+		} else if (!strcmp(argv[i], "--state") && i + 1 < argc) {
+			options.state = argv[++i];
+		} else if (!strcmp(argv[i], "--load-state")) {
+			options.load_state = true;
+		} else if (!strcmp(argv[i], "--save-state")) {
+			options.save_state = true;
+		} else if (!strcmp(argv[i], "--rewind") && i + 1 < argc) {
+			options.rewind = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--run-ahead") && i + 1 < argc) {
+			options.run_ahead = atoi(argv[++i]);
+			if (options.run_ahead < 0)
+				options.run_ahead = 0;
+		} else if (!strcmp(argv[i], "--latency")) {
+			options.latency = true;
+		} else if (!strcmp(argv[i], "--wav") && i + 1 < argc) {
+			options.wav = argv[++i];
+		} else if (!strcmp(argv[i], "--self-test")) {
+			options.self_test = true;
+			return "";
+		} else if (argv[i][0] != '-' && !rom_file_name) {
+			rom_file_name = argv[i];
+		} else {
+			printf("Unknown argument: %s\n", argv[i]);
+			return NULL;
+		}
+	}
+	if (options.speed < 0)
+		options.speed = options.headless ? 0 : 1; // batch runs go as fast as possible by default
+	if (options.rewind < 0)
+		options.rewind = options.headless ? 0 : 32;
+	if (options.headless && !options.frames) {
+		puts("Headless mode needs a frame count (--frames N)!");
+		return NULL;
+	}
+	if (!rom_file_name)
 		puts("ROM filename is missing!");
+	return rom_file_name;
+}
+
+int main(int argc, char *argv[]) {
+	options.speed = -1;
+	options.rewind = -1;
+	options.trace_pc = -1;
+	options.trace_frame = -1;
+	char const *rom_file_name = parse_arguments(argc, argv);
+	if (!rom_file_name) {
+		puts("Usage: funestus [--headless --frames N [--hash]] [--speed N | --uncapped] [--core microcode|fast|jit] [--lockstep] ROM");
+		puts("       [--trace FILE [--trace-pc XXXX] [--trace-frame N] [--trace-limit N]]");
+		puts("       [--state FILE] [--load-state] [--save-state] [--rewind MB] [--run-ahead N] [--latency] [--wav FILE]");
+		puts("       funestus --self-test");
+		return EXIT_FAILURE;
+	}
+	if (options.self_test) {
+		bool passed = tile_decoder_self_test();
+		passed = sprite_finder_self_test() && passed;
+		passed = hash_self_test() && passed;
+		passed = fast_core_self_test() && passed;
+		return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+	if (!load_rom(rom_file_name, &rom))
 		return EXIT_FAILURE;
+	atexit(release_console);
+	if (!(nes = console_create(&rom)))
+		return EXIT_FAILURE;
+	console_power_up(nes);
+	if (!options.state) {
+		char *state = malloc(strlen(rom_file_name) + sizeof(".state"));
+		if (!state)
+			return EXIT_FAILURE;
+		sprintf(state, "%s.state", rom_file_name);
+		options.state = state;
 	}
-	if (!load_rom(argv[1]))
+	if (options.load_state && !state_load_file(nes, options.state))
+		return EXIT_FAILURE;
+	if (options.rewind > 0 && !rewind_open(nes, options.rewind))
+		puts("Rewind is disabled");
+	if (options.run_ahead && !(run_ahead_state = calloc(1, state_size(nes))))
+		return EXIT_FAILURE;
+	if (options.latency)
+		latency_enable();
+	if (options.trace && !trace_open(options.trace, options.trace_pc, options.trace_frame, options.trace_limit))
 		return EXIT_FAILURE;
 
+	// real time, fast-forward (hold Tab) and uncapped (U toggles) can be switched while running
+	if (options.speed > 1)
+		set_fast_forward_speed(options.speed);
+	set_fast_forward(options.speed > 1);
+	set_uncapped(options.speed == 0);
+
+	if (options.headless) {
+		if (options.wav) {
+			if (!(wav_file = fopen(options.wav, "wb"))) {
+				printf("Could not write %s\n", options.wav);
+				return EXIT_FAILURE;
+			}
+			write_wav_header(wav_file, 0);
+			apu_set_sample_rate(&nes->apu, AUDIO_RATE);
+		}
+		return run_headless();
+	}
+
 	bool start_up = initialize_sdl();
 
 	if (start_up) {
 		puts("Emulation is afoot!\n");
 		SDL_Event event;
+		unsigned long presented_frames = 0;
+		uint8_t buttons = 0;
 
 		while (SDL_WaitEvent(&event)) {
 			if (event.type == SDL_QUIT) {
 				break;
 			}
+			if (event.type == SDL_KEYDOWN && !event.key.repeat) {
+				if (event.key.keysym.sym == SDLK_TAB)
+					set_fast_forward(true);
+				if (event.key.keysym.sym == SDLK_u)
+					toggle_uncapped();
+				if (event.key.keysym.sym == SDLK_F5)
+					atomic_store(&state_request, SAVE_STATE);
+				if (event.key.keysym.sym == SDLK_F7)
+					atomic_store(&state_request, LOAD_STATE);
+				if (event.key.keysym.sym == SDLK_BACKSPACE)
+					atomic_store(&rewinding, true);
+			}
+			if (event.type == SDL_KEYUP && event.key.keysym.sym == SDLK_TAB)
+				set_fast_forward(options.speed > 1);
+			if (event.type == SDL_KEYUP && event.key.keysym.sym == SDLK_BACKSPACE)
+				atomic_store(&rewinding, false);
+			if ((event.type == SDL_KEYDOWN || event.type == SDL_KEYUP) && !event.key.repeat && button_of(event.key.keysym.sym)) {
+				if (event.type == SDL_KEYDOWN)
+					buttons |= button_of(event.key.keysym.sym);
+				else
+					buttons &= ~button_of(event.key.keysym.sym);
+				controller_set_buttons(&nes->controller, 0, buttons);
+				latency_key();
+			}
 			if (event.type == FRAME_BUFFER_READY) {
+				uint32_t const *frame_buffer = acquire_frame_buffer();
+				if (!frame_buffer)
+					continue;
 				SDL_UpdateTexture(sdl.texture, NULL, frame_buffer, 256 * 4);
 				SDL_RenderClear(sdl.renderer);
 				SDL_RenderCopy(sdl.renderer, sdl.texture, NULL, NULL);
 				SDL_RenderPresent(sdl.renderer);
+				latency_presented();
+				presented_frames++;
+				trace_drain();
 			}
 		} 
+		// the reports and the trace are complete once the emulation is over
+		atomic_store(&quitting, true);
+		SDL_WaitThread(emulation_thread, NULL);
+		printf("%ld frames emulated, %lu presented, %lu dropped\n", frame_counter, presented_frames, dropped_frame_buffers());
+		print_pacing_report();
+		print_rewind_report();
+		print_latency_report();
+		if (audio_device)
+			print_audio_report();
+		trace_close();
 	}
 
+	if (audio_device)
+		SDL_CloseAudioDevice(audio_device);
 	if (sdl.palette)
 		SDL_FreePalette(sdl.palette);
 	if (sdl.texture)
@@ -170,7 +578,7 @@ int main(int argc, char *argv[]) {
 	SDL_Quit();
 
 	puts("Finish!");
-	if (!start_up)
+	if (!start_up || nes->cpu.failed)
 		return EXIT_FAILURE;
 	return EXIT_SUCCESS;
 }
@@ -1,7 +1,9 @@
 #ifndef HEADER_CORE
 #define HEADER_CORE
 
-void display_frame_buffer(uint8_t const *internal_frame_buffer);
+struct console;
 
-#endif
+// provided by the frontend, called by the PPU of every console when it completes a frame
+void display_frame_buffer(struct console *nes, uint8_t const *internal_frame_buffer, uint8_t const *line_emphasis);
 
+#endif
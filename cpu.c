@@ -1,149 +1,229 @@
+
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
 #include "debug.h"
 #include "loader.h"
+#include "cpu.h"
 #include "ppu.h"
+#include "mapper.h"
+#include "controller.h"
+#include "apu.h"
+#include "console.h"
+#include "trace.h"
+#include "state.h"
+#include "jit.h"
 
-static struct {
-	uint8_t a;
-	uint8_t x;
-	uint8_t y;
-	uint8_t s;
-	union {
-		struct {
-			uint8_t pcl;
-			uint8_t pch;
-		};
-		uint16_t pc;
-	};
-} reg = { .a = 0xAA, .pcl = 0xFF };
-
-static struct {
-	bool n;
-	bool v;
-	bool b;
-	bool d;
-	bool i;
-	bool z;
-	bool c;
-} flag = { .z = true };
-
-static struct {
-	union {
-		struct {
-			uint8_t address_lo;
-			uint8_t address_hi;
-		};
-		uint16_t address;
-	};
-	uint8_t data;
-} transient;
-
-static enum {
+enum {
 	NONE = 0x0000,
 	NMI = 0xFFFA,
 	RESET = 0xFFFC,
 	IRQ = 0xFFFE
-} interrupt_vector = RESET;
+};
 
-static uint8_t ram[0x800]; // 2k
+// the PPU runs 3 dots per CPU cycle, and one of them happens before the CPU step (see console_run)
+static void sync_ppu(struct cpu *cpu) {
+	ppu_sync(&cpu->console->ppu, 3 * cpu->step_counter - 2);
+}
 
-static uint8_t read_memory(uint16_t address) {
-	if (address > 0x7FFF) {
-		uint16_t const prg_mask = 0x3FFF; // 1x 16k PRG bank
-		uint8_t data = prg[address & prg_mask]; // mapper_read(address);
-		printf("  memory_read  %04X -> PRG %04X -> %02X\n", address, address & prg_mask, data);
-		return data;
-	}
-	if (address < 0x2000) {
-		uint8_t data = ram[address & 0x07FF];
-		printf("  memory_read  %04X -> RAM %03X -> %02X\n", address, address & 0x07FF, data);
+// for I/O handlers outside of the CPU whose effects depend on the PPU being up to date
+void cpu_sync_ppu(struct cpu *cpu) {
+	sync_ppu(cpu);
+}
+
+/*
+ * Unmapped addresses read back the last value left on the data bus. That is nearly
+ * always the high byte of the address itself, fetched as the last operand byte, so
+ * it is used instead of tracking the bus on every access.
+ */
+static uint8_t read_open_bus(console *nes, uint16_t address) {
+	(void) nes;
+	printf("  memory_read  %04X -> open bus -> %02X\n", address, address >> 8);
+	return address >> 8;
+}
+
+static void write_nowhere(console *nes, uint16_t address, uint8_t data) {
+	(void) nes, (void) address, (void) data;
+	printf("  memory_write %04X -> nowhere -> %02X\n", address, data);
+}
+
+static uint8_t read_ppu_register(console *nes, uint16_t address) {
+	sync_ppu(&nes->cpu);
+	uint8_t data = ppu_read(&nes->ppu, address & 0x0007);
+	printf("  memory_read  %04X -> \033[1;34mPPU\033[0m %X -> %02X\n", address, address & 0x0007, data);
+	return data;
+}
+
+static void write_ppu_register(console *nes, uint16_t address, uint8_t data) {
+	sync_ppu(&nes->cpu);
+	ppu_write(&nes->ppu, address & 0x0007, data);
+	printf("  memory_write %04X -> \033[1;34mPPU\033[0m %X -> %02X\n", address, address & 0x0007, data);
+}
+
+// $4000-$40FF: APU and controller registers up to $4017, open bus above; the APU catches up before being accessed
+static uint8_t read_io_register(console *nes, uint16_t address) {
+	if (address == 0x4015) {
+		apu_sync(&nes->apu, nes->cpu.step_counter);
+		uint8_t data = apu_read_status(&nes->apu);
+		printf("  read_memory  %04X -> \033[1;46mAPU\033[0m -> %02X\n", address, data);
 		return data;
 	}
-	if (address < 0x4000) {
-		uint8_t data = ppu_read(address & 0x0007);
-		printf("  memory_read  %04X -> \033[1;34mPPU\033[0m %X -> %02X\n", address, address & 0x0007, data);
+	if (address == 0x4016 || address == 0x4017) {
+		uint8_t data = (address >> 8 & 0xE0) | controller_read(&nes->controller, address & 0x0001); // only D0 is driven
+		printf("  read_memory  %04X -> \033[1;45mCTRL\033[0m -> %02X\n", address, data);
 		return data;
 	}
-	if (address == 0x4016 || address == 0x4017) {
-		printf("  read_memory  %04X -> \033[1;45mCTRL\033[0m %04X -> %02X\n", address, address & 0x3FFF, prg[address & 0x3FFF]);
-		return 0x00;
+	return read_open_bus(nes, address);
+}
+
+/*
+ * OAM DMA: the CPU is halted while 256 bytes of the given page go to OAMDATA, one byte
+ * every 2 cycles after a halt cycle (and one more to get in step when the write is on
+ * an odd cycle). Nothing else can touch the bus meanwhile, so the page is copied at
+ * once and the 513 or 514 cycles are charged in one go: the next step of the CPU comes
+ * that much later, and console_run lets the PPU catch up.
+ */
+static void oam_dma(struct cpu *cpu, uint8_t page) {
+	uint8_t const *source = cpu->read_page[page];
+	uint8_t buffer[256];
+	if (!source) {
+		for (int i = 0; i < 256; i++)
+			buffer[i] = cpu->read_io[page](cpu->console, page << 8 | i);
+		source = buffer;
 	}
-	printf(" \033[1;41m memory_read  %04X ERR \033[0m\n", address);
-	exit(EXIT_FAILURE);
-	return 0x00;
+	ppu_oam_dma(&cpu->console->ppu, source);
+	cpu->step_counter += 513 + (cpu->step_counter & 1);
+}
+
+// a DMC sample fetch: the CPU is halted for 4 cycles while the APU reads the byte (from the cartridge, never from I/O)
+uint8_t cpu_dma_read(struct cpu *cpu, uint16_t address) {
+	uint8_t const *page = cpu->read_page[address >> 8];
+	cpu->step_counter += 4;
+	return page ? page[address & 0xFF] : cpu->read_io[address >> 8](cpu->console, address);
 }
 
-static void write_memory(uint16_t address, uint8_t data) {
-	if (address < 0x2000) {
-		ram[address & 0x07FF] = data;
-		printf("  memory_write %04X -> RAM %03X -> %02X\n", address, address & 0x07FF, data);
+static void write_io_register(console *nes, uint16_t address, uint8_t data) {
+	if (address == 0x4014) {
+		sync_ppu(&nes->cpu);
+		printf("  memory_write %04X -> \033[1;35mOAMDMA\033[0m ---> %02X\n", address, data);
+		oam_dma(&nes->cpu, data);
 		return;
 	}
-	if (address < 0x4000) {
-		ppu_write(address & 0x0007, data);
-		printf("  memory_write %04X -> \033[1;34mPPU\033[0m %X -> %02X\n", address, address & 0x0007, data);
+	if (address == 0x4016) {
+		controller_write(&nes->controller, data);
+		printf("  write_memory %04X -> \033[1;45mCTRL\033[0m -> %02X\n", address, data);
 		return;
 	}
-	if (address == 0x4014) {
-		// cpu-ppu dma
-		printf("  memory_write %04X -> \033[1;35mOAMDMA\033[0m ---> %02X\n", address, data);
+	if (address <= 0x4017) {
+		apu_sync(&nes->apu, nes->cpu.step_counter);
+		apu_write(&nes->apu, address, data);
+		printf("  write_memory %04X -> \033[1;46mAPU\033[0m %02X -> %02X\n", address, address & 0x001F, data);
 		return;
 	}
-	if (address >= 0x4000 && address <= 0x4017) {
-		printf("  write_memory %04X -> \033[1;45mCTRL\033[0m %04X -> %02X\n", address, address & 0x000F, data);
-		return;
+	write_nowhere(nes, address, data);
+}
+
+// maps count pages from first_page onto memory, readable and optionally writable in place (otherwise write_io applies)
+void cpu_map_memory(struct cpu *cpu, uint8_t first_page, int count, uint8_t *memory, bool writable) {
+	for (int page = first_page; page < first_page + count; page++) {
+		uint8_t *target = memory + ((page - first_page) << 8);
+		cpu->read_page[page] = target;
+		cpu->write_page[page] = writable ? target : NULL;
+	}
+}
+
+// maps count pages from first_page onto I/O handlers, for reads, writes or both (NULL: leave as is)
+void cpu_map_io(struct cpu *cpu, uint8_t first_page, int count, read_handler read, write_handler write) {
+	for (int page = first_page; page < first_page + count; page++) {
+		if (read) {
+			cpu->read_page[page] = NULL;
+			cpu->read_io[page] = read;
+		}
+		if (write) {
+			cpu->write_page[page] = NULL;
+			cpu->write_io[page] = write;
+		}
 	}
-	printf(" \033[1;41m memory_write %04X -> %02X ERR\033[0m\n", address, data);
-	exit(EXIT_FAILURE);
-	return;
 }
 
-typedef void (*instruction_step)(void);
+// console memory map, with the 16k of PRG mirrored in $8000-$FFFF until the mapper sets its own
+static void map_console_memory(struct cpu *cpu) {
+	for (int page = 0; page < 256; page++) {
+		cpu->read_page[page] = cpu->write_page[page] = NULL;
+		cpu->read_io[page] = read_open_bus;
+		cpu->write_io[page] = write_nowhere;
+	}
+	for (int mirror = 0x00; mirror < 0x20; mirror += 0x08)
+		cpu_map_memory(cpu, mirror, 0x08, cpu->ram, true);
+	cpu_map_io(cpu, 0x20, 0x20, read_ppu_register, write_ppu_register);
+	cpu_map_io(cpu, 0x40, 0x01, read_io_register, write_io_register);
+	cpu_map_memory(cpu, 0x80, 0x40, cpu->console->prg, false);
+	cpu_map_memory(cpu, 0xC0, 0x40, cpu->console->prg, false);
+}
+
+static uint8_t read_memory(struct cpu *cpu, uint16_t address) {
+	uint8_t const *page = cpu->read_page[address >> 8];
+	uint8_t data = page ? page[address & 0xFF] : cpu->read_io[address >> 8](cpu->console, address);
+	printf("  memory_read  %04X -> %02X\n", address, data);
+	TRACE_ACCESS(address, data, false);
+	return data;
+}
+
+static void write_memory(struct cpu *cpu, uint16_t address, uint8_t data) {
+	TRACE_ACCESS(address, data, true);
+	uint8_t *page = cpu->write_page[address >> 8];
+	if (page)
+		page[address & 0xFF] = data;
+	else
+		cpu->write_io[address >> 8](cpu->console, address, data);
+	printf("  memory_write %04X -> %02X\n", address, data);
+}
+
 typedef instruction_step instruction[7];
 
-static instruction const set[256];
-static instruction_step const *current_step;
-static unsigned long long step_counter = 0;
+static instruction const set[256]; // shared by every console, only the position in it is per console
+
+bool fast_core = false;
+bool jit_core = false;
 
-inline static void update_flags_nz(uint8_t reg) {
-	flag.n = (reg & 0x80);
-	flag.z = !reg;
+#define LONGEST_INSTRUCTION 7 // cycles
+
+inline static void update_flags_nz(struct cpu *cpu, uint8_t reg) {
+	cpu->flag.n = (reg & 0x80);
+	cpu->flag.z = !reg;
 }
 
-inline static uint8_t group_status_flags(void) {
+inline static uint8_t group_status_flags(struct cpu const *cpu) {
 	uint8_t p = 0x20;
-	if (flag.n) p |= 0x80;
-	if (flag.v) p |= 0x40;
-	if (flag.b) p |= 0x10;
-	if (flag.d) p |= 0x08;
-	if (flag.i) p |= 0x04;
-	if (flag.z) p |= 0x02;
-	if (flag.c) p |= 0x01;
+	if (cpu->flag.n) p |= 0x80;
+	if (cpu->flag.v) p |= 0x40;
+	if (cpu->flag.b) p |= 0x10;
+	if (cpu->flag.d) p |= 0x08;
+	if (cpu->flag.i) p |= 0x04;
+	if (cpu->flag.z) p |= 0x02;
+	if (cpu->flag.c) p |= 0x01;
 	return p;
 }
 
-inline static void ungroup_status_flags(uint8_t p) {
-	flag.n = p & 0x80;
-	flag.v = p & 0x40;
-	// flag.b is not updated
-	flag.d = p & 0x08;
-	flag.i = p & 0x04;
-	flag.z = p & 0x02;
-	flag.c = p & 0x01;
+inline static void ungroup_status_flags(struct cpu *cpu, uint8_t p) {
+	cpu->flag.n = p & 0x80;
+	cpu->flag.v = p & 0x40;
+	// flag b is not updated
+	cpu->flag.d = p & 0x08;
+	cpu->flag.i = p & 0x04;
+	cpu->flag.z = p & 0x02;
+	cpu->flag.c = p & 0x01;
 }
 
 #include "steps.c"
 
-static void terminate(void) {
+// the CPU jams on the opcode, a cycle at a time, and the console goes on so that whoever runs it can tell and stop
+static void terminate(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	for (int i = 0; i < 256; i++)
-		if ((current_step - 1) == set[i])
-			fprintf(stdout, "ILLEGAL/UNIMPLEMENTED OPCODE \033[1;33m %02X \033[0m\n", i);
-	getchar();
-	exit(EXIT_FAILURE);
+	cpu->current_step--;
+	cpu->failed = true;
 }
 
 #pragma GCC diagnostic push
@@ -386,25 +466,184 @@ static instruction const set[256] = {
 };
 #pragma GCC diagnostic pop
 
-static instruction_step const *current_step = set[0x00];
+#include "instructions.c"
 
-void cpu_exec(void) {
+void cpu_exec(struct cpu *cpu) {
 	printf(">> A %02X, X %02X, Y %02X, S %02X, P %02X, PC %04X, %c%c.%c%c%c%c%c #%06llu ",
-		reg.a, reg.x, reg.y, reg.s, group_status_flags(), reg.pc,
-		flag.n ? 'n' : '.',
-		flag.v ? 'v' : '.',
-		flag.b ? 'b' : '.',
-		flag.d ? 'd' : '.',
-		flag.i ? 'i' : '.',
-		flag.z ? 'z' : '.',
-		flag.c ? 'c' : '.',
-		step_counter
+		cpu->reg.a, cpu->reg.x, cpu->reg.y, cpu->reg.s, group_status_flags(cpu), cpu->reg.pc,
+		cpu->flag.n ? 'n' : '.',
+		cpu->flag.v ? 'v' : '.',
+		cpu->flag.b ? 'b' : '.',
+		cpu->flag.d ? 'd' : '.',
+		cpu->flag.i ? 'i' : '.',
+		cpu->flag.z ? 'z' : '.',
+		cpu->flag.c ? 'c' : '.',
+		cpu->step_counter
 	);
-	step_counter++;
-	(*current_step++)();
+	cpu->step_counter++;
+	(*cpu->current_step++)(cpu);
+}
+
+// runs the CPU on its own until the given cycle; the PPU is only caught up when its registers are accessed
+void cpu_run(struct cpu *cpu, unsigned long long cycle) {
+#ifndef TRACE
+	int unasked = 0; // instructions the JIT has said it has nothing for
+#endif
+	while (cpu->step_counter < cycle) {
+#ifndef TRACE
+		if (jit_core && !cpu->jit_failed && cpu->current_step == set[cpu->opcode]) {
+			// translations skip the interrupt check between their instructions, so none may be pending
+			if (cpu->interrupt_vector || (cpu->irq_lines && !cpu->flag.i))
+				unasked = 0;
+			else if (unasked)
+				unasked--;
+			else {
+				int cycles = jit_execute(cpu, cycle - cpu->step_counter);
+				if (cycles > 0) {
+					cpu->step_counter += cycles;
+					fetch_opcode(cpu); // what the last step of the last instruction translated would do
+					continue;
+				}
+				unasked = -cycles;
+			}
+		}
+#endif
+		// the fast core needs an instruction boundary and room for a whole instruction before the limit
+		if (fast_core && cpu->step_counter + LONGEST_INSTRUCTION <= cycle && cpu->current_step == set[cpu->opcode])
+			execute_instruction(cpu);
+		else
+			cpu_exec(cpu);
+	}
+}
+
+// for whoever stops running a console once its CPU has failed
+void cpu_print_failure(struct cpu const *cpu) {
+	fprintf(stdout, "ILLEGAL/UNIMPLEMENTED OPCODE \033[1;33m %02X \033[0m at $%04X\n", cpu->opcode, (uint16_t) (cpu->reg.pc - 1));
+}
+
+unsigned long long cpu_cycles(struct cpu const *cpu) {
+	return cpu->step_counter;
+}
+
+// puts the CPU back into its power-up state, so that the next steps run the reset sequence
+void cpu_power_up(struct cpu *cpu) {
+	memset(&cpu->reg, 0, sizeof(cpu->reg));
+	cpu->reg.a = 0xAA;
+	cpu->reg.pcl = 0xFF;
+	memset(&cpu->flag, 0, sizeof(cpu->flag));
+	cpu->flag.z = true;
+	memset(&cpu->transient, 0, sizeof(cpu->transient));
+	memset(cpu->ram, 0, sizeof(cpu->ram));
+	map_console_memory(cpu);
+	cpu->interrupt_vector = RESET;
+	cpu->irq_lines = 0;
+	cpu->current_step = set[0x00];
+	cpu->opcode = 0x00;
+	cpu->step_counter = 0;
+	cpu->failed = false;
+}
+
+void cpu_save_state(struct cpu const *cpu, struct cpu_state *state) {
+	memcpy(state->ram, cpu->ram, sizeof(cpu->ram));
+	state->step_counter = cpu->step_counter;
+	state->pc = cpu->reg.pc;
+	state->address = cpu->transient.address;
+	state->interrupt_vector = cpu->interrupt_vector;
+	state->a = cpu->reg.a;
+	state->x = cpu->reg.x;
+	state->y = cpu->reg.y;
+	state->s = cpu->reg.s;
+	state->p = group_status_flags(cpu);
+	state->data = cpu->transient.data;
+	state->irq_lines = cpu->irq_lines;
+	state->opcode = cpu->opcode;
+	state->step = cpu->current_step - set[cpu->opcode];
+}
+
+// the memory map is rebuilt for the console alone, the mapper maps the cartridge again afterwards
+void cpu_load_state(struct cpu *cpu, struct cpu_state const *state) {
+	memcpy(cpu->ram, state->ram, sizeof(cpu->ram));
+	cpu->step_counter = state->step_counter;
+	cpu->reg.pc = state->pc;
+	cpu->transient.address = state->address;
+	cpu->interrupt_vector = state->interrupt_vector;
+	cpu->reg.a = state->a;
+	cpu->reg.x = state->x;
+	cpu->reg.y = state->y;
+	cpu->reg.s = state->s;
+	ungroup_status_flags(cpu, state->p);
+	cpu->flag.b = state->p & 0x10;
+	cpu->transient.data = state->data;
+	cpu->irq_lines = state->irq_lines;
+	cpu->opcode = state->opcode;
+	cpu->current_step = set[cpu->opcode] + state->step;
+	cpu->failed = false;
+	map_console_memory(cpu);
 }
 
-void cpu_interrupt(void) {
-	interrupt_vector = NMI;
+void cpu_interrupt(struct cpu *cpu) {
+	cpu->interrupt_vector = NMI;
 }
 
+// the IRQ line is low as long as one of its sources holds it; it is ignored while flag i is set
+void cpu_irq(struct cpu *cpu, uint8_t source, bool asserted) {
+	if (asserted)
+		cpu->irq_lines |= source;
+	else
+		cpu->irq_lines &= ~source;
+}
+
+/******************************************************* Self-test ******************************************************/
+/*
+ * An OAM DMA halts the CPU for 513 or 514 cycles, which may carry it past the end of
+ * the run: the fast core must then leave the rest of the instruction, the fetch that
+ * polls the NMI, to the next run just as the microcode does. A loop of $4014 writes,
+ * a store and a read-modify-write, with a delay that grows every time, moves them
+ * across the start of vblank; both cores run it in turns and have to stay identical.
+ */
+static uint8_t const test_program[] = {
+	0x78, 0xD8, 0xA2, 0xFF, 0x9A, // $C000: SEI, CLD, LDX #$FF, TXS
+	0xA9, 0x80, 0x8D, 0x00, 0x20, // $C005: LDA #$80, STA $2000 (NMI on)
+	0xA6, 0x20, 0xCA, 0xD0, 0xFD, // $C00A: LDX $20, DEX, BNE $C00C
+	0xA0, 0x0E, 0xA9, 0x02, 0x99, 0x06, 0x40, // $C00F: LDY #$0E, LDA #$02, STA $4006,Y
+	0xA2, 0x14, 0xFE, 0x00, 0x40, // $C016: LDX #$14, INC $4000,X
+	0xE6, 0x20, 0x4C, 0x0A, 0xC0, // $C01B: INC $20, JMP $C00A
+	0xE6, 0x11, 0x40 // $C020: INC $11, RTI
+};
+#define TEST_FRAMES 60
+
+bool fast_core_self_test(void) {
+	static uint8_t prg[0x4000];
+	memcpy(prg, test_program, sizeof(test_program));
+	prg[0x3FFA] = prg[0x3FFE] = 0x20; // NMI and IRQ at $C020, reset at $C000
+	prg[0x3FFB] = prg[0x3FFD] = prg[0x3FFF] = 0xC0;
+	struct rom rom = { .cartridge = { .prg_size = sizeof(prg), .chr_size = 0x2000, .chr_ram = true }, .prg = prg };
+
+	console *microcode = console_create(&rom), *fast = console_create(&rom);
+	if (!microcode || !fast) {
+		console_destroy(microcode);
+		console_destroy(fast);
+		return false;
+	}
+	console_power_up(microcode);
+	console_power_up(fast);
+	bool fast_option = fast_core, jit_option = jit_core;
+	jit_core = false;
+	int errors = 0;
+	while (!errors && microcode->frames < TEST_FRAMES) {
+		fast_core = false;
+		console_run(microcode);
+		fast_core = true;
+		console_run(fast);
+		struct cpu_state expected = { 0 }, state = { 0 }; // padding included
+		cpu_save_state(&microcode->cpu, &expected);
+		cpu_save_state(&fast->cpu, &state);
+		errors = memcmp(&expected, &state, sizeof(state)) != 0 || microcode->frames != fast->frames;
+	}
+	fast_core = fast_option;
+	jit_core = jit_option;
+	fprintf(stdout, "Fast core vs microcode: %s\n", errors ? "FAILED" : "ok");
+	console_destroy(microcode);
+	console_destroy(fast);
+	return !errors;
+}
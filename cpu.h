@@ -1,9 +1,92 @@
 #ifndef HEADER_CPU
 #define HEADER_CPU
 
-void cpu_exec(void);
-void cpu_interrupt(void);
+struct console;
+struct cpu;
+struct jit;
 
-#endif
+typedef uint8_t (*read_handler)(struct console *nes, uint16_t address);
+typedef void (*write_handler)(struct console *nes, uint16_t address, uint8_t data);
+typedef void (*instruction_step)(struct cpu *cpu);
+
+#define IRQ_MAPPER 0x01
+#define IRQ_FRAME_COUNTER 0x02
+#define IRQ_DMC 0x04
+
+struct cpu {
+	struct {
+		uint8_t a;
+		uint8_t x;
+		uint8_t y;
+		uint8_t s;
+		union {
+			struct {
+				uint8_t pcl;
+				uint8_t pch;
+			};
+			uint16_t pc;
+		};
+	} reg;
+
+	struct {
+		bool n;
+		bool v;
+		bool b;
+		bool d;
+		bool i;
+		bool z;
+		bool c;
+	} flag;
+
+	struct {
+		union {
+			struct {
+				uint8_t address_lo;
+				uint8_t address_hi;
+			};
+			uint16_t address;
+		};
+		uint8_t data;
+	} transient;
 
+	uint16_t interrupt_vector; // NMI, RESET or IRQ while the next opcode is replaced by the interrupt sequence
+	uint8_t irq_lines; // IRQ_* sources holding the IRQ line low
+	uint8_t opcode; // last fetched, current_step runs through its microcode
+	instruction_step const *current_step;
+	unsigned long long step_counter;
+	bool failed; // an opcode without microcode was fetched, the CPU is jammed on it until powered up or loaded
 
+	/*
+	 * Memory map: one entry per 256-byte page. A page is either memory accessed in place
+	 * through a host pointer (RAM and its mirrors, PRG banks), or I/O going through
+	 * handlers (PPU, APU and controller registers, open bus). Mappers switch banks by
+	 * pointing pages elsewhere, so the CPU never pays a branch per mapping.
+	 */
+	uint8_t *read_page[256]; // NULL: go through read_io
+	uint8_t *write_page[256]; // NULL: go through write_io
+	read_handler read_io[256];
+	write_handler write_io[256];
+
+	uint8_t ram[0x800]; // 2k
+	struct console *console; // the console the handlers are given
+	struct jit *jit; // translations of the code it runs, made when first needed (see jit.c)
+	bool jit_failed; // none can be made on this host or with this memory, it runs the fast core
+};
+
+void cpu_exec(struct cpu *cpu);
+void cpu_run(struct cpu *cpu, unsigned long long cycle);
+void cpu_power_up(struct cpu *cpu);
+unsigned long long cpu_cycles(struct cpu const *cpu);
+void cpu_print_failure(struct cpu const *cpu);
+void cpu_interrupt(struct cpu *cpu);
+void cpu_irq(struct cpu *cpu, uint8_t source, bool asserted);
+void cpu_sync_ppu(struct cpu *cpu);
+uint8_t cpu_dma_read(struct cpu *cpu, uint16_t address);
+void cpu_map_memory(struct cpu *cpu, uint8_t first_page, int count, uint8_t *memory, bool writable);
+void cpu_map_io(struct cpu *cpu, uint8_t first_page, int count, read_handler read, write_handler write);
+bool fast_core_self_test(void);
+
+extern bool fast_core;
+extern bool jit_core; // runs hot code translated to x86-64, on top of the fast core
+
+#endif
@@ -0,0 +1,265 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <immintrin.h>
+#include "hash.h"
+
+typedef uint32_t (*crc32_function)(uint32_t crc, uint8_t const *data, size_t length);
+
+/**************************************************** CRC32 bitwise *****************************************************/
+// basic crc32 calculation with inverted polynomial and without lookup table, the reference for the others
+static uint32_t crc32_bitwise(uint32_t crc, uint8_t const *data, size_t length) {
+	for (size_t i = 0; i < length; i++) {
+		crc ^= data[i];
+
+		for (int i = 0; i < 8; i++) {
+			if (crc & 1)
+				crc = ((crc >> 1) ^ 0xEDB88320);
+			else
+				crc >>= 1;
+		}
+	}
+	return crc;
+}
+
+/*************************************************** CRC32 slice-by-8 ***************************************************/
+// table[k][b]: the CRC of byte b followed by k zero bytes, so that 8 bytes are folded with 8 independent lookups
+static uint32_t table[8][256];
+
+static void build_tables(void) {
+	for (int b = 0; b < 256; b++)
+		table[0][b] = crc32_bitwise(0, (uint8_t const[]) { b }, 1);
+	for (int b = 0; b < 256; b++)
+		for (int k = 1; k < 8; k++)
+			table[k][b] = table[k - 1][b] >> 8 ^ table[0][table[k - 1][b] & 0xFF];
+}
+
+static uint32_t crc32_slice_by_8(uint32_t crc, uint8_t const *data, size_t length) {
+	for (; length >= 8; data += 8, length -= 8) {
+		uint32_t low, high;
+		memcpy(&low, data, 4);
+		memcpy(&high, data + 4, 4);
+		low ^= crc;
+		crc = table[7][low & 0xFF] ^ table[6][low >> 8 & 0xFF] ^ table[5][low >> 16 & 0xFF] ^ table[4][low >> 24]
+			^ table[3][high & 0xFF] ^ table[2][high >> 8 & 0xFF] ^ table[1][high >> 16 & 0xFF] ^ table[0][high >> 24];
+	}
+	for (; length; data++, length--)
+		crc = crc >> 8 ^ table[0][(crc ^ *data) & 0xFF];
+	return crc;
+}
+
+/***************************************************** CRC32 PCLMUL *****************************************************/
+/*
+ * Folds 64 bytes at a time with carry-less multiplications, then reduces the 128-bit
+ * remainder with Barrett's method ("Fast CRC Computation for Generic Polynomials Using
+ * PCLMULQDQ Instruction", Intel, 2009). The constants are those of the bit-reflected
+ * CRC32 polynomial. The tail shorter than 16 bytes goes through the tables.
+ */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_pclmul(uint32_t crc, uint8_t const *data, size_t length) {
+	if (length < 64)
+		return crc32_slice_by_8(crc, data, length);
+
+	__m128i const k1k2 = _mm_set_epi64x(0x01C6E41596, 0x0154442BD4);
+	__m128i const k3k4 = _mm_set_epi64x(0x00CCAA009E, 0x01751997D0);
+	__m128i const k5k0 = _mm_set_epi64x(0x0000000000, 0x0163CD6124);
+	__m128i const poly = _mm_set_epi64x(0x01F7011641, 0x01DB710641);
+	__m128i const low_32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+	__m128i x1 = _mm_loadu_si128((__m128i const *) (data + 0x00));
+	__m128i x2 = _mm_loadu_si128((__m128i const *) (data + 0x10));
+	__m128i x3 = _mm_loadu_si128((__m128i const *) (data + 0x20));
+	__m128i x4 = _mm_loadu_si128((__m128i const *) (data + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+	data += 64;
+	length -= 64;
+
+	// four independent 128-bit lanes, each folded 64 bytes ahead
+	for (; length >= 64; data += 64, length -= 64) {
+		__m128i x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+		__m128i x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+		__m128i x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+		__m128i x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((__m128i const *) (data + 0x00)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((__m128i const *) (data + 0x10)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((__m128i const *) (data + 0x20)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((__m128i const *) (data + 0x30)));
+	}
+
+	// the four lanes into one, then the remaining blocks of 16 bytes
+	__m128i lanes[3] = { x2, x3, x4 };
+	for (int i = 0; i < 3; i++) {
+		__m128i x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, lanes[i]), x5);
+	}
+	for (; length >= 16; data += 16, length -= 16) {
+		__m128i x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((__m128i const *) data)), x5);
+	}
+
+	// 128 bits to 64
+	x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, low_32);
+	x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	// Barrett reduction to 32 bits
+	x2 = _mm_and_si128(x1, low_32);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+	x2 = _mm_and_si128(x2, low_32);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	crc = _mm_extract_epi32(x1, 1);
+
+	return crc32_slice_by_8(crc, data, length);
+}
+
+/******************************************************* Selection ******************************************************/
+static struct {
+	char const *name;
+	crc32_function calculate;
+} const implementations[] = { // from the fastest to the slowest
+	{ "pclmul", crc32_pclmul },
+	{ "slice-by-8", crc32_slice_by_8 },
+	{ "bitwise", crc32_bitwise }
+};
+
+#define IMPLEMENTATIONS (int) (sizeof(implementations) / sizeof(implementations[0]))
+
+static bool supported(int implementation) {
+	if (implementation == 0)
+		return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+	return true;
+}
+
+static int selected = -1;
+
+// not thread-safe the first time: call it before starting threads that hash
+char const *crc32_implementation_name(void) {
+	if (selected < 0) {
+		__builtin_cpu_init();
+		build_tables();
+		for (selected = 0; !supported(selected); selected++)
+			;
+	}
+	return implementations[selected].name;
+}
+
+uint32_t calculate_crc32(uint8_t const *data, size_t length) {
+	if (selected < 0)
+		crc32_implementation_name();
+	return ~implementations[selected].calculate(0xFFFFFFFF, data, length);
+}
+
+/********************************************************* SHA-1 ********************************************************/
+static uint32_t rotate_left(uint32_t value, int bits) {
+	return value << bits | value >> (32 - bits);
+}
+
+static void sha1_block(uint32_t state[5], uint8_t const block[64]) {
+	uint32_t w[80];
+	for (int i = 0; i < 16; i++)
+		w[i] = (uint32_t) block[i * 4] << 24 | block[i * 4 + 1] << 16 | block[i * 4 + 2] << 8 | block[i * 4 + 3];
+	for (int i = 16; i < 80; i++)
+		w[i] = rotate_left(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+	uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+	for (int i = 0; i < 80; i++) {
+		uint32_t f, k;
+		if (i < 20)
+			f = (b & c) | (~b & d), k = 0x5A827999;
+		else if (i < 40)
+			f = b ^ c ^ d, k = 0x6ED9EBA1;
+		else if (i < 60)
+			f = (b & c) | (b & d) | (c & d), k = 0x8F1BBCDC;
+		else
+			f = b ^ c ^ d, k = 0xCA62C1D6;
+		uint32_t temp = rotate_left(a, 5) + f + e + k + w[i];
+		e = d;
+		d = c;
+		c = rotate_left(b, 30);
+		b = a;
+		a = temp;
+	}
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+}
+
+void calculate_sha1(uint8_t const *data, size_t length, uint8_t digest[20]) {
+	uint32_t state[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+	size_t done = 0;
+	for (; length - done >= 64; done += 64)
+		sha1_block(state, data + done);
+
+	// the last bytes, the 0x80 marker and the length in bits fill one or two more blocks
+	uint8_t tail[128] = { 0 };
+	size_t rest = length - done;
+	memcpy(tail, data + done, rest);
+	tail[rest] = 0x80;
+	size_t tail_length = rest < 56 ? 64 : 128;
+	uint64_t bits = (uint64_t) length * 8;
+	for (int i = 0; i < 8; i++)
+		tail[tail_length - 1 - i] = bits >> (i * 8);
+	for (size_t block = 0; block < tail_length; block += 64)
+		sha1_block(state, tail + block);
+
+	for (int i = 0; i < 20; i++)
+		digest[i] = state[i / 4] >> (24 - i % 4 * 8);
+}
+
+/******************************************************* Self-test ******************************************************/
+static uint8_t test_data[4099];
+
+bool hash_self_test(void) {
+	crc32_implementation_name();
+	uint32_t seed = 0x2A03;
+	for (size_t i = 0; i < sizeof(test_data); i++) {
+		seed = seed * 1103515245 + 12345;
+		test_data[i] = seed >> 16;
+	}
+
+	bool passed = true;
+	for (int implementation = 0; implementation < IMPLEMENTATIONS; implementation++) {
+		if (!supported(implementation)) {
+			printf("CRC32 %-10s: not supported by this CPU\n", implementations[implementation].name);
+			continue;
+		}
+		crc32_function calculate = implementations[implementation].calculate;
+		int errors = ~calculate(0xFFFFFFFF, (uint8_t const *) "123456789", 9) != 0xCBF43926;
+		// every length up to a few blocks, against the bitwise reference
+		for (size_t length = 0; length <= sizeof(test_data); length += length < 300 ? 1 : 97)
+			if (calculate(0xFFFFFFFF, test_data, length) != crc32_bitwise(0xFFFFFFFF, test_data, length))
+				errors++;
+		printf("CRC32 %-10s: %s\n", implementations[implementation].name, errors ? "FAILED" : "ok");
+		if (errors)
+			passed = false;
+	}
+
+	static uint8_t const abc_sha1[20] = {
+		0xA9, 0x99, 0x3E, 0x36, 0x47, 0x06, 0x81, 0x6A, 0xBA, 0x3E,
+		0x25, 0x71, 0x78, 0x50, 0xC2, 0x6C, 0x9C, 0xD0, 0xD8, 0x9D
+	};
+	static uint8_t const long_sha1[20] = { // "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"
+		0x84, 0x98, 0x3E, 0x44, 0x1C, 0x3B, 0xD2, 0x6E, 0xBA, 0xAE,
+		0x4A, 0xA1, 0xF9, 0x51, 0x29, 0xE5, 0xE5, 0x46, 0x70, 0xF1
+	};
+	uint8_t digest[20], long_digest[20];
+	calculate_sha1((uint8_t const *) "abc", 3, digest);
+	char const *long_message = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+	calculate_sha1((uint8_t const *) long_message, strlen(long_message), long_digest);
+	bool sha1_passed = !memcmp(digest, abc_sha1, 20) && !memcmp(long_digest, long_sha1, 20);
+	printf("SHA-1           : %s\n", sha1_passed ? "ok" : "FAILED");
+	return passed && sha1_passed;
+}
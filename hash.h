@@ -0,0 +1,10 @@
+#ifndef HEADER_HASH
+#define HEADER_HASH
+
+uint32_t calculate_crc32(uint8_t const *data, size_t length);
+void calculate_sha1(uint8_t const *data, size_t length, uint8_t digest[20]);
+
+char const *crc32_implementation_name(void);
+bool hash_self_test(void);
+
+#endif
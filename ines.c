@@ -0,0 +1,64 @@
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "loader.h"
+
+// NES 2.0 sizes are either a count of units, or 2^E * (M * 2 + 1) bytes when the count's high nibble is $F
+static size_t rom_size(int low, int high, size_t unit) {
+	if (high == 0x0F)
+		return ((size_t) 1 << (low >> 2)) * ((low & 0x03) * 2 + 1);
+	return (size_t) (high << 8 | low) * unit;
+}
+
+// fills the cartridge from an iNES or NES 2.0 header, returns NULL or what is wrong with it;
+// corrections (when not NULL) tells which fields were guessed rather than read
+char const *parse_header(uint8_t const header[16], struct cartridge *cartridge, int *corrections) {
+	int guessed = 0;
+	if (memcmp(header, "NES\x1A", 4))
+		return "Not an iNES ROM, the header magic is missing";
+	memset(cartridge, 0, sizeof(*cartridge));
+	cartridge->nes2 = (header[7] & 0x0C) == 0x08;
+	cartridge->mapper = header[6] >> 4 | (header[7] & 0xF0);
+	cartridge->battery = header[6] & 0x02;
+	if (header[6] & 0x08)
+		cartridge->mirroring = MIRROR_FOUR_SCREEN;
+	else
+		cartridge->mirroring = (header[6] & 0x01) ? MIRROR_VERTICAL : MIRROR_HORIZONTAL;
+
+	if (cartridge->nes2) {
+		cartridge->mapper |= (header[8] & 0x0F) << 8;
+		cartridge->submapper = header[8] >> 4;
+		cartridge->prg_size = rom_size(header[4], header[9] & 0x0F, 0x4000);
+		cartridge->chr_size = rom_size(header[5], header[9] >> 4, 0x2000);
+		int prg_ram_shift = (header[10] & 0x0F) ? (header[10] & 0x0F) : (header[10] >> 4); // volatile or battery-backed
+		cartridge->prg_ram_size = prg_ram_shift ? 64 << prg_ram_shift : 0;
+		if (!cartridge->chr_size && (header[11] & 0x0F)) {
+			cartridge->chr_size = 64 << (header[11] & 0x0F);
+			cartridge->chr_ram = true;
+		}
+	} else {
+		// iNES: bytes 12-15 should be zero, otherwise byte 7 is most likely garbage ("DiskDude!")
+		if (header[12] | header[13] | header[14] | header[15]) {
+			cartridge->mapper &= 0x0F;
+			guessed |= CORRECTED_DISKDUDE;
+		}
+		cartridge->prg_size = header[4] * 0x4000;
+		cartridge->chr_size = header[5] * 0x2000;
+		cartridge->prg_ram_size = header[8] ? header[8] * 0x2000 : 0x2000;
+		if (!header[8])
+			guessed |= CORRECTED_PRG_RAM;
+	}
+	if (!cartridge->chr_size) {
+		cartridge->chr_size = 0x2000;
+		cartridge->chr_ram = true;
+		guessed |= CORRECTED_CHR_RAM;
+	}
+
+	if (corrections)
+		*corrections = guessed;
+	if (!cartridge->prg_size || cartridge->prg_size & 0x3FFF || cartridge->prg_size > MAX_PRG_SIZE)
+		return "Unsupported PRG ROM size";
+	if (cartridge->chr_size & 0x1FFF || cartridge->chr_size > MAX_CHR_SIZE)
+		return "Unsupported CHR size";
+	return NULL;
+}
@@ -0,0 +1,477 @@
+/*
+ * Fast core: runs a whole instruction per dispatch and charges its cycles once, when
+ * it fetches the next opcode. Memory is accessed in place through the page table and
+ * the step counter stays where the instruction started; only an access to an I/O page
+ * moves it to the cycle the microcode makes that access in, so that the PPU, the APU
+ * and the mappers see it at the same cycle, page crossings and taken branches included
+ * (whatever the handler adds, OAM DMA, is kept). Dummy accesses are only made when they
+ * reach I/O, or always in TRACE builds so that both cores record the same accesses.
+ * When a load or a store halts the CPU, the instruction stops before its last step and
+ * leaves it to cpu_run, which may first have to let the PPU catch up to the interrupts.
+ */
+
+// an access in cycle n of the instruction (the first one after the opcode fetch is 1)
+static inline uint8_t read_in(struct cpu *cpu, int n, uint16_t address) {
+	uint8_t const *page = cpu->read_page[address >> 8];
+	uint8_t data;
+	if (page) {
+		data = page[address & 0xFF];
+	} else {
+		cpu->step_counter += n;
+		data = cpu->read_io[address >> 8](cpu->console, address);
+		cpu->step_counter -= n;
+	}
+	TRACE_ACCESS(address, data, false);
+	return data;
+}
+
+// true when the handler halted the CPU (OAM DMA) for cycles of its own
+static inline bool write_in(struct cpu *cpu, int n, uint16_t address, uint8_t data) {
+	TRACE_ACCESS(address, data, true);
+	uint8_t *page = cpu->write_page[address >> 8];
+	if (page) {
+		page[address & 0xFF] = data;
+		return false;
+	}
+	unsigned long long cycle = cpu->step_counter += n;
+	cpu->write_io[address >> 8](cpu->console, address, data);
+	bool halted = cpu->step_counter != cycle;
+	cpu->step_counter -= n;
+	return halted;
+}
+
+static inline void dummy_read_in(struct cpu *cpu, int n, uint16_t address) {
+#ifndef TRACE
+	if (cpu->read_page[address >> 8])
+		return;
+#endif
+	read_in(cpu, n, address);
+}
+
+// the last cycle of an instruction, n, fetches the next opcode
+static inline void finish(struct cpu *cpu, int n) {
+	cpu->step_counter += n;
+	fetch_opcode(cpu);
+}
+
+// the same with the last step of the microcode, which does the operation and the fetch
+static inline void finish_with(struct cpu *cpu, int n, instruction_step last) {
+	cpu->step_counter += n;
+	last(cpu);
+}
+
+// an access in cycle n to the address halted the CPU: the microcode goes on with the last step, in the next cycle
+static inline void stop_before(struct cpu *cpu, int n, uint16_t address, instruction_step last) {
+	cpu->transient.address = address;
+	cpu->step_counter += n;
+	cpu->current_step = set[cpu->opcode];
+	while (*cpu->current_step != last)
+		cpu->current_step++;
+}
+
+/***************************************************** Addressing ******************************************************/
+static inline uint16_t zeropage(struct cpu *cpu) {
+	return read_in(cpu, 1, cpu->reg.pc++);
+}
+
+static inline uint16_t zeropage_x(struct cpu *cpu) {
+	uint8_t address = read_in(cpu, 1, cpu->reg.pc++);
+	dummy_read_in(cpu, 2, cpu->reg.pc);
+	return (uint8_t) (address + cpu->reg.x);
+}
+
+static inline uint16_t absolute(struct cpu *cpu) {
+	uint8_t lo = read_in(cpu, 1, cpu->reg.pc++);
+	return lo | read_in(cpu, 2, cpu->reg.pc++) << 8;
+}
+
+// absolute,X: one more cycle (reading PC again) when the index crosses a page, or always for a write; *n is the cycle of the access
+static inline uint16_t absolute_x(struct cpu *cpu, bool writes, int *n) {
+	uint16_t address = absolute(cpu);
+	*n = 3;
+	if (writes || (address & 0xFF) + cpu->reg.x > 0xFF)
+		dummy_read_in(cpu, (*n)++, cpu->reg.pc);
+	return address + cpu->reg.x;
+}
+
+// absolute,Y: one more cycle (reading the indexed address before the carry into its high byte) when the index crosses a page, or always for a write
+static inline uint16_t absolute_y(struct cpu *cpu, bool writes, int *n) {
+	uint16_t base = absolute(cpu);
+	*n = 3;
+	if (writes || (base & 0xFF) + cpu->reg.y > 0xFF)
+		dummy_read_in(cpu, (*n)++, (base & 0xFF00) | (uint8_t) (base + cpu->reg.y));
+	return base + cpu->reg.y;
+}
+
+// (indirect),Y: same as absolute,Y once the pointer is read from the zero page
+static inline uint16_t indirect_y(struct cpu *cpu, bool writes, int *n) {
+	uint8_t pointer = read_in(cpu, 1, cpu->reg.pc++);
+	uint8_t lo = read_in(cpu, 2, pointer);
+	uint16_t base = lo | read_in(cpu, 3, (uint8_t) (pointer + 1)) << 8;
+	*n = 4;
+	if (writes || lo + cpu->reg.y > 0xFF)
+		dummy_read_in(cpu, (*n)++, (base & 0xFF00) | (uint8_t) (lo + cpu->reg.y));
+	return base + cpu->reg.y;
+}
+
+/***************************************************** Operations ******************************************************/
+// an operation of the microcode on the data read in cycle n
+static inline void load(struct cpu *cpu, int n, uint16_t address, instruction_step operation) {
+	unsigned long long cycle = cpu->step_counter;
+	cpu->transient.data = read_in(cpu, n, address);
+	if (cpu->step_counter != cycle) // a DMC fetch
+		stop_before(cpu, n, address, operation);
+	else
+		finish_with(cpu, n + 1, operation);
+}
+
+static inline void store(struct cpu *cpu, int n, uint16_t address, uint8_t data) {
+	if (write_in(cpu, n, address, data))
+		stop_before(cpu, n, address, fetch_opcode);
+	else
+		finish(cpu, n + 1);
+}
+
+enum { INCREMENT, DECREMENT, SHIFT_LEFT, SHIFT_RIGHT, ROTATE_LEFT, ROTATE_RIGHT };
+
+// read in cycle n, the old data written back (INC and DEC) or PC read (shifts) in n + 1, the result written in n + 2
+static inline void read_modify_write(struct cpu *cpu, int n, uint16_t address, int operation) {
+	uint8_t data = read_in(cpu, n, address);
+	bool carry = cpu->flag.c;
+	bool halted = false;
+	switch (operation) {
+	case INCREMENT: halted = write_in(cpu, n + 1, address, data); data++; break;
+	case DECREMENT: halted = write_in(cpu, n + 1, address, data); data--; break;
+	case SHIFT_LEFT: cpu->flag.c = data & 0x80; data <<= 1; break;
+	case SHIFT_RIGHT: cpu->flag.c = data & 0x01; data >>= 1; break;
+	case ROTATE_LEFT: cpu->flag.c = data & 0x80; data = data << 1 | carry; break;
+	case ROTATE_RIGHT: cpu->flag.c = data & 0x01; data = data >> 1 | carry << 7; break;
+	}
+	if (halted) { // the result is written by the step after
+		cpu->transient.data = data;
+		stop_before(cpu, n + 1, address, store_data);
+		return;
+	}
+	if (operation != INCREMENT && operation != DECREMENT)
+		dummy_read_in(cpu, n + 1, cpu->reg.pc);
+	halted = write_in(cpu, n + 2, address, data);
+	update_flags_nz(cpu, data);
+	if (halted) {
+		cpu->transient.data = data;
+		stop_before(cpu, n + 2, address, fetch_opcode);
+	} else {
+		finish(cpu, n + 3);
+	}
+}
+
+// 2 cycles when not taken, 3 when taken, 4 when the target is in another page
+static inline void branch(struct cpu *cpu, bool taken) {
+	int8_t offset = read_in(cpu, 1, cpu->reg.pc++);
+	if (!taken) {
+		finish(cpu, 2);
+		return;
+	}
+	dummy_read_in(cpu, 2, cpu->reg.pc);
+	uint16_t target = cpu->reg.pc + offset;
+	int n = (target ^ cpu->reg.pc) & 0xFF00 ? 4 : 3;
+	cpu->reg.pc = target;
+	finish(cpu, n);
+}
+
+// the stack accesses of BRK and of the interrupt sequence are reads during a reset
+static inline void push_in(struct cpu *cpu, int n, uint8_t data) {
+	if (cpu->interrupt_vector == RESET)
+		dummy_read_in(cpu, n, 0x100 | cpu->reg.s--);
+	else
+		write_in(cpu, n, 0x100 | cpu->reg.s--, data);
+}
+
+static inline uint8_t pull_in(struct cpu *cpu, int n) {
+	return read_in(cpu, n, 0x100 | ++cpu->reg.s);
+}
+
+// PHP, BRK and the interrupt sequence
+static inline void push_status_in(struct cpu *cpu, int n) {
+	cpu->flag.b = cpu->interrupt_vector ? true : false;
+	push_in(cpu, n, group_status_flags(cpu));
+	if (cpu->interrupt_vector)
+		cpu->flag.i = true;
+}
+
+// must be called with the opcode fetched and no step of it done (cpu->current_step == set[cpu->opcode])
+__attribute__((flatten)) static void execute_instruction(struct cpu *cpu) {
+	int n;
+	uint16_t address;
+	switch (cpu->opcode) {
+	// ASL_accumulator
+	case 0x0A: dummy_read_in(cpu, 1, cpu->reg.pc); finish_with(cpu, 2, shift_left_reg_a); break;
+	// LSR_accumulator
+	case 0x4A: dummy_read_in(cpu, 1, cpu->reg.pc); finish_with(cpu, 2, shift_right_reg_a); break;
+	// ROL_accumulator
+	case 0x2A: dummy_read_in(cpu, 1, cpu->reg.pc); finish_with(cpu, 2, rotate_left_reg_a); break;
+	// ROR_accumulator
+	case 0x6A: dummy_read_in(cpu, 1, cpu->reg.pc); finish_with(cpu, 2, rotate_right_reg_a); break;
+
+	// SEC_implied
+	case 0x38: dummy_read_in(cpu, 1, cpu->reg.pc); finish_with(cpu, 2, set_flag_c); break;
+	// SEI_implied
+	case 0x78: dummy_read_in(cpu, 1, cpu->reg.pc); finish_with(cpu, 2, set_flag_i); break;
+	// CLC_implied
+	case 0x18: dummy_read_in(cpu, 1, cpu->reg.pc); finish_with(cpu, 2, clear_flag_c); break;
+	// CLD_implied
+	case 0xD8: dummy_read_in(cpu, 1, cpu->reg.pc); finish_with(cpu, 2, clear_flag_d); break;
+	// INX_implied
+	case 0xE8: dummy_read_in(cpu, 1, cpu->reg.pc); finish_with(cpu, 2, increment_reg_x); break;
+	// INY_implied
+	case 0xC8: dummy_read_in(cpu, 1, cpu->reg.pc); finish_with(cpu, 2, increment_reg_y); break;
+	// DEX_implied
+	case 0xCA: dummy_read_in(cpu, 1, cpu->reg.pc); finish_with(cpu, 2, decrement_reg_x); break;
+	// DEY_implied
+	case 0x88: dummy_read_in(cpu, 1, cpu->reg.pc); finish_with(cpu, 2, decrement_reg_y); break;
+	// TAX_implied
+	case 0xAA: dummy_read_in(cpu, 1, cpu->reg.pc); finish_with(cpu, 2, transfer_reg_a_to_reg_x); break;
+	// TAY_implied
+	case 0xA8: dummy_read_in(cpu, 1, cpu->reg.pc); finish_with(cpu, 2, transfer_reg_a_to_reg_y); break;
+	// TXA_implied
+	case 0x8A: dummy_read_in(cpu, 1, cpu->reg.pc); finish_with(cpu, 2, transfer_reg_x_to_reg_a); break;
+	// TXS_implied
+	case 0x9A: dummy_read_in(cpu, 1, cpu->reg.pc); finish_with(cpu, 2, transfer_reg_x_to_reg_s); break;
+	// TYA_implied
+	case 0x98: dummy_read_in(cpu, 1, cpu->reg.pc); finish_with(cpu, 2, transfer_reg_y_to_reg_a); break;
+	// NOP_implied
+	case 0xEA: dummy_read_in(cpu, 1, cpu->reg.pc); finish(cpu, 2); break;
+
+	// LDA_immediate
+	case 0xA9: load(cpu, 1, cpu->reg.pc++, put_data_into_reg_a); break;
+	// LDX_immediate
+	case 0xA2: load(cpu, 1, cpu->reg.pc++, put_data_into_reg_x); break;
+	// LDY_immediate
+	case 0xA0: load(cpu, 1, cpu->reg.pc++, put_data_into_reg_y); break;
+	// ADC_immediate
+	case 0x69: load(cpu, 1, cpu->reg.pc++, add_with_carry); break;
+	// SBC_immediate
+	case 0xE9: load(cpu, 1, cpu->reg.pc++, subtract_with_carry); break;
+	// AND_immediate
+	case 0x29: load(cpu, 1, cpu->reg.pc++, bitwise_and); break;
+	// ORA_immediate
+	case 0x09: load(cpu, 1, cpu->reg.pc++, bitwise_or); break;
+	// EOR_immediate
+	case 0x49: load(cpu, 1, cpu->reg.pc++, bitwise_xor); break;
+	// CMP_immediate
+	case 0xC9: load(cpu, 1, cpu->reg.pc++, compare_reg_a); break;
+	// CPX_immediate
+	case 0xE0: load(cpu, 1, cpu->reg.pc++, compare_reg_x); break;
+	// CPY_immediate
+	case 0xC0: load(cpu, 1, cpu->reg.pc++, compare_reg_y); break;
+
+	// BEQ_relative
+	case 0xF0: branch(cpu, cpu->flag.z); break;
+	// BMI_relative
+	case 0x30: branch(cpu, cpu->flag.n); break;
+	// BCS_relative
+	case 0xB0: branch(cpu, cpu->flag.c); break;
+	// BVS_relative
+	case 0x70: branch(cpu, cpu->flag.v); break;
+	// BNE_relative
+	case 0xD0: branch(cpu, !cpu->flag.z); break;
+	// BPL_relative
+	case 0x10: branch(cpu, !cpu->flag.n); break;
+	// BCC_relative
+	case 0x90: branch(cpu, !cpu->flag.c); break;
+
+	// STA_zeropage W
+	case 0x85: store(cpu, 2, zeropage(cpu), cpu->reg.a); break;
+	// STX_zeropage W
+	case 0x86: store(cpu, 2, zeropage(cpu), cpu->reg.x); break;
+	// STY_zeropage W
+	case 0x84: store(cpu, 2, zeropage(cpu), cpu->reg.y); break;
+	// LDA_zeropage R
+	case 0xA5: load(cpu, 2, zeropage(cpu), put_data_into_reg_a); break;
+	// LDX_zeropage R
+	case 0xA6: load(cpu, 2, zeropage(cpu), put_data_into_reg_x); break;
+	// LDY_zeropage R
+	case 0xA4: load(cpu, 2, zeropage(cpu), put_data_into_reg_y); break;
+	// CMP_zeropage R
+	case 0xC5: load(cpu, 2, zeropage(cpu), compare_reg_a); break;
+	// CPX_zeropage R
+	case 0xE4: load(cpu, 2, zeropage(cpu), compare_reg_x); break;
+	// BIT_zeropage R
+	case 0x24: load(cpu, 2, zeropage(cpu), bit_test); break;
+	// AND_zeropage R
+	case 0x25: load(cpu, 2, zeropage(cpu), bitwise_and); break;
+	// ORA_zeropage R
+	case 0x05: load(cpu, 2, zeropage(cpu), bitwise_or); break;
+	// EOR_zeropage R
+	case 0x45: load(cpu, 2, zeropage(cpu), bitwise_xor); break;
+	// ADC_zeropage R
+	case 0x65: load(cpu, 2, zeropage(cpu), add_with_carry); break;
+	// SBC_zeropage R
+	case 0xE5: load(cpu, 2, zeropage(cpu), subtract_with_carry); break;
+	// INC_zeropage M
+	case 0xE6: read_modify_write(cpu, 2, zeropage(cpu), INCREMENT); break;
+	// DEC_zeropage M
+	case 0xC6: read_modify_write(cpu, 2, zeropage(cpu), DECREMENT); break;
+	// ASL_zeropage M
+	case 0x06: read_modify_write(cpu, 2, zeropage(cpu), SHIFT_LEFT); break;
+	// LSR_zeropage M
+	case 0x46: read_modify_write(cpu, 2, zeropage(cpu), SHIFT_RIGHT); break;
+	// ROL_zeropage M
+	case 0x26: read_modify_write(cpu, 2, zeropage(cpu), ROTATE_LEFT); break;
+	// ROR_zeropage M
+	case 0x66: read_modify_write(cpu, 2, zeropage(cpu), ROTATE_RIGHT); break;
+
+	// STA_zeropageX W
+	case 0x95: store(cpu, 3, zeropage_x(cpu), cpu->reg.a); break;
+	// STY_zeropageX W
+	case 0x94: store(cpu, 3, zeropage_x(cpu), cpu->reg.y); break;
+	// LDA_zeropageX R
+	case 0xB5: load(cpu, 3, zeropage_x(cpu), put_data_into_reg_a); break;
+	// LDY_zeropageX R
+	case 0xB4: load(cpu, 3, zeropage_x(cpu), put_data_into_reg_y); break;
+	// CMP_zeropageX R
+	case 0xD5: load(cpu, 3, zeropage_x(cpu), compare_reg_a); break;
+	// AND_zeropageX R
+	case 0x35: load(cpu, 3, zeropage_x(cpu), bitwise_and); break;
+	// ADC_zeropageX R
+	case 0x75: load(cpu, 3, zeropage_x(cpu), add_with_carry); break;
+	// SBC_zeropageX R
+	case 0xF5: load(cpu, 3, zeropage_x(cpu), subtract_with_carry); break;
+	// INC_zeropageX M
+	case 0xF6: read_modify_write(cpu, 3, zeropage_x(cpu), INCREMENT); break;
+	// DEC_zeropageX M
+	case 0xD6: read_modify_write(cpu, 3, zeropage_x(cpu), DECREMENT); break;
+
+	// STA_absolute W
+	case 0x8D: store(cpu, 3, absolute(cpu), cpu->reg.a); break;
+	// STX_absolute W
+	case 0x8E: store(cpu, 3, absolute(cpu), cpu->reg.x); break;
+	// STY_absolute W
+	case 0x8C: store(cpu, 3, absolute(cpu), cpu->reg.y); break;
+	// LDA_absolute R
+	case 0xAD: load(cpu, 3, absolute(cpu), put_data_into_reg_a); break;
+	// LDX_absolute R
+	case 0xAE: load(cpu, 3, absolute(cpu), put_data_into_reg_x); break;
+	// LDY_absolute R
+	case 0xAC: load(cpu, 3, absolute(cpu), put_data_into_reg_y); break;
+	// CMP_absolute R
+	case 0xCD: load(cpu, 3, absolute(cpu), compare_reg_a); break;
+	// ORA_absolute R
+	case 0x0D: load(cpu, 3, absolute(cpu), bitwise_or); break;
+	// EOR_absolute R
+	case 0x4D: load(cpu, 3, absolute(cpu), bitwise_xor); break;
+	// ADC_absolute R
+	case 0x6D: load(cpu, 3, absolute(cpu), add_with_carry); break;
+	// SBC_absolute R
+	case 0xED: load(cpu, 3, absolute(cpu), subtract_with_carry); break;
+	// INC_absolute M
+	case 0xEE: read_modify_write(cpu, 3, absolute(cpu), INCREMENT); break;
+	// DEC_absolute M
+	case 0xCE: read_modify_write(cpu, 3, absolute(cpu), DECREMENT); break;
+	// ROR_absolute M
+	case 0x6E: read_modify_write(cpu, 3, absolute(cpu), ROTATE_RIGHT); break;
+	// JSR_absolute: the return address (the last byte of the instruction) is pushed before the high byte is read
+	case 0x20:
+		address = read_in(cpu, 1, cpu->reg.pc++);
+		dummy_read_in(cpu, 2, cpu->reg.pc);
+		push_in(cpu, 3, cpu->reg.pch);
+		push_in(cpu, 4, cpu->reg.pcl);
+		address |= read_in(cpu, 5, cpu->reg.pc) << 8;
+		cpu->reg.pc = address;
+		finish(cpu, 6);
+		break;
+	// JMP_absolute
+	case 0x4C: cpu->reg.pc = absolute(cpu); finish(cpu, 3); break;
+
+	// STA_absoluteX W
+	case 0x9D: address = absolute_x(cpu, true, &n); store(cpu, n, address, cpu->reg.a); break;
+	// LDA_absoluteX R
+	case 0xBD: address = absolute_x(cpu, false, &n); load(cpu, n, address, put_data_into_reg_a); break;
+	// LDY_absoluteX R
+	case 0xBC: address = absolute_x(cpu, false, &n); load(cpu, n, address, put_data_into_reg_y); break;
+	// AND_absoluteX R
+	case 0x3D: address = absolute_x(cpu, false, &n); load(cpu, n, address, bitwise_and); break;
+	// ORA_absoluteX R
+	case 0x1D: address = absolute_x(cpu, false, &n); load(cpu, n, address, bitwise_or); break;
+	// CMP_absoluteX R
+	case 0xDD: address = absolute_x(cpu, false, &n); load(cpu, n, address, compare_reg_a); break;
+	// ADC_absoluteX R
+	case 0x7D: address = absolute_x(cpu, false, &n); load(cpu, n, address, add_with_carry); break;
+	// SBC_absoluteX R
+	case 0xFD: address = absolute_x(cpu, false, &n); load(cpu, n, address, subtract_with_carry); break;
+	// INC_absoluteX W
+	case 0xFE: address = absolute_x(cpu, true, &n); read_modify_write(cpu, n, address, INCREMENT); break;
+	// DEC_absoluteX W
+	case 0xDE: address = absolute_x(cpu, true, &n); read_modify_write(cpu, n, address, DECREMENT); break;
+
+	// STA_absoluteY W
+	case 0x99: address = absolute_y(cpu, true, &n); store(cpu, n, address, cpu->reg.a); break;
+	// LDA_absoluteY R
+	case 0xB9: address = absolute_y(cpu, false, &n); load(cpu, n, address, put_data_into_reg_a); break;
+	// ORA_absoluteY R
+	case 0x19: address = absolute_y(cpu, false, &n); load(cpu, n, address, bitwise_or); break;
+	// CMP_absoluteY R
+	case 0xD9: address = absolute_y(cpu, false, &n); load(cpu, n, address, compare_reg_a); break;
+
+	// STA_indirectY W
+	case 0x91: address = indirect_y(cpu, true, &n); store(cpu, n, address, cpu->reg.a); break;
+	// LDA_indirectY R
+	case 0xB1: address = indirect_y(cpu, false, &n); load(cpu, n, address, put_data_into_reg_a); break;
+	// ORA_indirectY R
+	case 0x11: address = indirect_y(cpu, false, &n); load(cpu, n, address, bitwise_or); break;
+	// CMP_indirectY R
+	case 0xD1: address = indirect_y(cpu, false, &n); load(cpu, n, address, compare_reg_a); break;
+	// ADC_indirectY R
+	case 0x71: address = indirect_y(cpu, false, &n); load(cpu, n, address, add_with_carry); break;
+	// SBC_indirectY R
+	case 0xF1: address = indirect_y(cpu, false, &n); load(cpu, n, address, subtract_with_carry); break;
+
+	// JMP_indirect: the pointer does not cross page boundaries
+	case 0x6C:
+		address = absolute(cpu);
+		cpu->reg.pcl = read_in(cpu, 3, address);
+		cpu->reg.pch = read_in(cpu, 4, (address & 0xFF00) | (uint8_t) (address + 1));
+		finish(cpu, 5);
+		break;
+
+	// PHA_stack
+	case 0x48: dummy_read_in(cpu, 1, cpu->reg.pc); write_in(cpu, 2, 0x100 | cpu->reg.s--, cpu->reg.a); finish(cpu, 3); break;
+	// PHP_stack
+	case 0x08: dummy_read_in(cpu, 1, cpu->reg.pc); push_status_in(cpu, 2); finish(cpu, 3); break;
+	// PLA_stack
+	case 0x68: dummy_read_in(cpu, 1, cpu->reg.pc); dummy_read_in(cpu, 2, cpu->reg.pc); load(cpu, 3, 0x100 | ++cpu->reg.s, put_data_into_reg_a); break;
+	// PLP_stack
+	case 0x28: dummy_read_in(cpu, 1, cpu->reg.pc); dummy_read_in(cpu, 2, cpu->reg.pc); load(cpu, 3, 0x100 | ++cpu->reg.s, put_data_into_status); break;
+	// RTS_stack
+	case 0x60:
+		dummy_read_in(cpu, 1, cpu->reg.pc++);
+		dummy_read_in(cpu, 2, cpu->reg.pc);
+		address = pull_in(cpu, 3);
+		cpu->reg.pc = address | pull_in(cpu, 4) << 8;
+		dummy_read_in(cpu, 5, cpu->reg.pc++);
+		finish(cpu, 6);
+		break;
+	// RTI_stack
+	case 0x40:
+		dummy_read_in(cpu, 1, cpu->reg.pc++);
+		dummy_read_in(cpu, 2, cpu->reg.pc);
+		ungroup_status_flags(cpu, pull_in(cpu, 3));
+		address = pull_in(cpu, 4);
+		cpu->reg.pc = address | pull_in(cpu, 5) << 8;
+		finish(cpu, 6);
+		break;
+	// BRK_stack, and the interrupt sequence
+	case 0x00:
+		dummy_read_in(cpu, 1, cpu->reg.pc);
+		push_in(cpu, 2, cpu->reg.pch);
+		push_in(cpu, 3, cpu->reg.pcl);
+		push_status_in(cpu, 4);
+		address = read_in(cpu, 5, cpu->interrupt_vector);
+		cpu->reg.pc = address | read_in(cpu, 6, cpu->interrupt_vector + 1) << 8;
+		cpu->interrupt_vector = NONE;
+		finish(cpu, 7);
+		break;
+
+	default: // illegal/unimplemented opcodes: left to the microcode, which reports them
+		cpu_exec(cpu);
+	}
+}
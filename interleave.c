@@ -0,0 +1,188 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <immintrin.h>
+#include "interleave.h"
+
+/*
+ * Combining the two bit planes of a tile row is a bit interleave: bit 7 - p of the
+ * low and high plane bytes become bits 0 and 1 of pixel p. The kernels below do it
+ * for whole tiles at once; the fastest one supported by the host is picked on the
+ * first call, and tile_decoder_self_test() checks all of them against the original
+ * per-pixel formula of the renderer.
+ */
+
+typedef void (*tile_decoder)(uint8_t const *patterns, uint8_t (*pixels)[8][8], int count);
+
+/*************************************************** Scalar *******************************************************/
+static uint64_t spread_bits[256]; // bit 7 - p of the index goes to bit 0 of byte p
+
+static void decode_tiles_scalar(uint8_t const *patterns, uint8_t (*pixels)[8][8], int count) {
+	if (!spread_bits[0xFF]) {
+		for (int byte = 0; byte < 256; byte++)
+			for (int pixel = 0; pixel < 8; pixel++)
+				if (byte & (0x80 >> pixel))
+					spread_bits[byte] |= 1ULL << (pixel * 8);
+	}
+	for (int tile = 0; tile < count; tile++, patterns += 16) {
+		for (int row = 0; row < 8; row++) {
+			uint64_t line = spread_bits[patterns[row]] | spread_bits[patterns[row + 8]] << 1;
+			memcpy(pixels[tile][row], &line, 8);
+		}
+	}
+}
+
+/**************************************************** BMI2 ********************************************************/
+__attribute__((target("bmi2")))
+static void decode_tiles_bmi2(uint8_t const *patterns, uint8_t (*pixels)[8][8], int count) {
+	for (int tile = 0; tile < count; tile++, patterns += 16) {
+		for (int row = 0; row < 8; row++) {
+			// PDEP puts bit b into byte b, the byte swap then mirrors it so that bit 7 lands in pixel 0
+			uint64_t line = _pdep_u64(patterns[row], 0x0101010101010101) | _pdep_u64(patterns[row + 8], 0x0202020202020202);
+			line = __builtin_bswap64(line);
+			memcpy(pixels[tile][row], &line, 8);
+		}
+	}
+}
+
+/*************************************************** SSSE3 ********************************************************/
+__attribute__((target("ssse3")))
+static void decode_tiles_ssse3(uint8_t const *patterns, uint8_t (*pixels)[8][8], int count) {
+	__m128i const bits = _mm_set_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+	__m128i const one = _mm_set1_epi8(1);
+	__m128i const two = _mm_set1_epi8(2);
+
+	for (int tile = 0; tile < count; tile++, patterns += 16) {
+		__m128i planes = _mm_loadu_si128((__m128i const *) patterns);
+		for (int row = 0; row < 8; row += 2) {
+			// replicate the plane bytes of two rows 8 times each, then test one bit per byte
+			__m128i low_index = _mm_set_epi64x(0x0101010101010101 * (row + 1), 0x0101010101010101 * row);
+			__m128i high_index = _mm_add_epi8(low_index, _mm_set1_epi8(8));
+			__m128i low = _mm_and_si128(_mm_shuffle_epi8(planes, low_index), bits);
+			__m128i high = _mm_and_si128(_mm_shuffle_epi8(planes, high_index), bits);
+			low = _mm_and_si128(_mm_cmpeq_epi8(low, bits), one);
+			high = _mm_and_si128(_mm_cmpeq_epi8(high, bits), two);
+			_mm_storeu_si128((__m128i *) pixels[tile][row], _mm_or_si128(low, high));
+		}
+	}
+}
+
+/**************************************************** AVX2 ********************************************************/
+__attribute__((target("avx2")))
+static void decode_tiles_avx2(uint8_t const *patterns, uint8_t (*pixels)[8][8], int count) {
+	__m256i const bits = _mm256_set1_epi64x(0x0102040810204080);
+	__m256i const one = _mm256_set1_epi8(1);
+	__m256i const two = _mm256_set1_epi8(2);
+	// rows 0 and 1 come from the lower lane, rows 2 and 3 from the upper one (each lane holds the whole tile)
+	__m256i const low_index = _mm256_set_epi64x(0x0303030303030303, 0x0202020202020202, 0x0101010101010101, 0);
+	__m256i const high_index = _mm256_add_epi8(low_index, _mm256_set1_epi8(8));
+	__m256i const next_rows = _mm256_set1_epi8(4);
+
+	for (int tile = 0; tile < count; tile++, patterns += 16) {
+		__m256i planes = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const *) patterns));
+		for (int row = 0; row < 8; row += 4) {
+			__m256i offset = row ? next_rows : _mm256_setzero_si256();
+			__m256i low = _mm256_and_si256(_mm256_shuffle_epi8(planes, _mm256_add_epi8(low_index, offset)), bits);
+			__m256i high = _mm256_and_si256(_mm256_shuffle_epi8(planes, _mm256_add_epi8(high_index, offset)), bits);
+			low = _mm256_and_si256(_mm256_cmpeq_epi8(low, bits), one);
+			high = _mm256_and_si256(_mm256_cmpeq_epi8(high, bits), two);
+			_mm256_storeu_si256((__m256i *) pixels[tile][row], _mm256_or_si256(low, high));
+		}
+	}
+}
+
+/************************************************** Selection *****************************************************/
+static struct {
+	char const *name;
+	char const *feature; // as known by __builtin_cpu_supports, NULL if always available
+	tile_decoder decode;
+} const decoders[] = { // from the fastest to the slowest
+	{ "avx2", "avx2", decode_tiles_avx2 },
+	{ "ssse3", "ssse3", decode_tiles_ssse3 },
+	{ "bmi2", "bmi2", decode_tiles_bmi2 },
+	{ "scalar", NULL, decode_tiles_scalar }
+};
+
+#define DECODERS (int) (sizeof(decoders) / sizeof(decoders[0]))
+
+static bool supported(int decoder) {
+	char const *feature = decoders[decoder].feature;
+	if (!feature)
+		return true;
+	// __builtin_cpu_supports only accepts string literals
+	if (!strcmp(feature, "avx2"))
+		return __builtin_cpu_supports("avx2");
+	if (!strcmp(feature, "ssse3"))
+		return __builtin_cpu_supports("ssse3");
+	if (!strcmp(feature, "bmi2"))
+		return __builtin_cpu_supports("bmi2");
+	return false;
+}
+
+static void select_and_decode(uint8_t const *patterns, uint8_t (*pixels)[8][8], int count);
+static tile_decoder selected_decoder = select_and_decode;
+static int selected = DECODERS - 1;
+
+static void select_decoder(void) {
+	__builtin_cpu_init();
+	for (selected = 0; !supported(selected); selected++)
+		;
+	selected_decoder = decoders[selected].decode;
+}
+
+static void select_and_decode(uint8_t const *patterns, uint8_t (*pixels)[8][8], int count) {
+	select_decoder();
+	selected_decoder(patterns, pixels, count);
+}
+
+void decode_tiles(uint8_t const *patterns, uint8_t (*pixels)[8][8], int count) {
+	selected_decoder(patterns, pixels, count);
+}
+
+char const *tile_decoder_name(void) {
+	if (selected_decoder == select_and_decode)
+		select_decoder();
+	return decoders[selected].name;
+}
+
+/************************************************** Self-test *****************************************************/
+// 8192 tiles of 8 rows cover every combination of low and high plane bytes
+#define TEST_TILES 8192
+
+static uint8_t test_patterns[TEST_TILES][16];
+static uint8_t test_pixels[TEST_TILES][8][8];
+
+bool tile_decoder_self_test(void) {
+	for (int combination = 0; combination < 0x10000; combination++) {
+		test_patterns[combination / 8][combination % 8] = combination & 0xFF;
+		test_patterns[combination / 8][combination % 8 + 8] = combination >> 8;
+	}
+
+	bool passed = true;
+	for (int decoder = 0; decoder < DECODERS; decoder++) {
+		if (!supported(decoder)) {
+			printf("Tile decoder %-6s: not supported by this CPU\n", decoders[decoder].name);
+			continue;
+		}
+		memset(test_pixels, 0xFF, sizeof(test_pixels));
+		decoders[decoder].decode(test_patterns[0], test_pixels, TEST_TILES);
+
+		int errors = 0;
+		for (int tile = 0; tile < TEST_TILES; tile++) {
+			for (int row = 0; row < 8; row++) {
+				for (int pixel = 0; pixel < 8; pixel++) {
+					// the original draw_pixel() formula
+					int a = test_patterns[tile][row] & (0x80 >> pixel % 8);
+					int b = test_patterns[tile][row + 8] & (0x80 >> pixel % 8);
+					if (test_pixels[tile][row][pixel] != (a ? 1 : 0) + (b ? 2 : 0))
+						errors++;
+				}
+			}
+		}
+		printf("Tile decoder %-6s: %s\n", decoders[decoder].name, errors ? "FAILED" : "ok");
+		if (errors)
+			passed = false;
+	}
+	return passed;
+}
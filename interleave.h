@@ -0,0 +1,11 @@
+#ifndef HEADER_INTERLEAVE
+#define HEADER_INTERLEAVE
+
+/* Decodes whole tiles from the pattern table layout (8 bytes of the low bit plane
+followed by 8 bytes of the high one) into one 2-bit pixel per byte, row by row. */
+void decode_tiles(uint8_t const *patterns, uint8_t (*pixels)[8][8], int count);
+
+char const *tile_decoder_name(void);
+bool tile_decoder_self_test(void);
+
+#endif
@@ -0,0 +1,1026 @@
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS
+
+#include <stdio.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <sys/mman.h>
+#include "loader.h"
+#include "cpu.h"
+#include "ppu.h"
+#include "mapper.h"
+#include "controller.h"
+#include "apu.h"
+#include "console.h"
+#include "jit.h"
+
+/*
+ * JIT: the tier above the fast core. Code entered HOT times is translated to x86-64,
+ * from the instruction it is entered at to the first jump, call, return or instruction
+ * it cannot translate, past conditional branches (a taken branch exits, or loops back
+ * when it targets an instruction of the same translation). The guest registers and
+ * flags live in host registers for the whole run of a translation and are stored back
+ * when it exits. A translation has the same effects as the fast core would have, at
+ * the same cycles as far as anything outside the CPU can tell:
+ * - it only accesses memory in place: every access to a page that is I/O exits before
+ *   the instruction, and the fast core runs it; the dummy reads of the microcode read
+ *   code, from the same page, or memory that locate has checked, so they are left out;
+ * - the cycles are counted at compile time and charged when it exits, with the page
+ *   crossings and the loops added as they happen; it is only entered with room for
+ *   its longest pass before the next event, and never with an interrupt to take;
+ * - translations are kept per host page rather than per address, so bank switches
+ *   simply find those of the bank now mapped; they hold guest addresses, so a bank
+ *   mapped at two places (NROM-128 mirrors, a bank in two slots) has translations for
+ *   each; code in RAM is compared against the bytes it was translated from before
+ *   each run, and a store into the page the code runs from exits, so that code that
+ *   modifies itself is translated again.
+ * Every exit leaves the CPU at an instruction boundary with the next opcode to fetch,
+ * which cpu_run does like the last step of an instruction would.
+ */
+#define CODE_SIZE (1 << 20) // bytes of host code per console, all translations are dropped once it is full
+#define BLOCK_ROOM 16384 // bytes of host code a translation takes at most
+#define BLOCK_ALIGN 16
+#define PAGE_SLOTS 4096 // hash table of host and guest pages with translations, a power of 2
+#define MAX_PAGES (PAGE_SLOTS / 2)
+#define HOT 16 // entries before code gets translated
+#define MIN_INSTRUCTIONS 3 // fewer cost more to enter than the fast core takes to run them, unless they loop
+#define MAX_INSTRUCTIONS 48
+#define NOT_TRANSLATED -1
+
+struct block {
+	int32_t code; // offset in the code buffer, 0 until translated
+	uint16_t cycles; // of the longest pass, the translation is only entered with that many left
+	uint8_t length; // bytes of 6502 code translated, or if it cannot be, instructions the fast core runs from here without asking
+	uint8_t heat; // entries counted until it gets translated
+};
+
+struct page {
+	uint8_t const *memory; // the host page its translations are made from
+	uint8_t guest_page; // where it is mapped, the translations hold the addresses of its code
+	bool writable; // RAM, checked against the snapshot before running
+	uint8_t snapshot[256]; // the bytes the translations of a writable page were made from
+	struct block block[256];
+};
+
+struct jit {
+	uint8_t *code;
+	size_t used;
+	int page_count;
+	struct page *pages[PAGE_SLOTS];
+	struct page *bound[256]; // per guest page, valid while it maps the same host page
+};
+
+typedef int (*block_code)(struct cpu *cpu, int budget);
+
+#ifdef __x86_64__
+
+/*************************************************** Translation ***************************************************/
+
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+// host registers holding the guest state while a translation runs; none is used by a C call since it makes none
+enum {
+	RA = R8, RX = R9, RY = R10, RS = R11,
+	RN = RBX, // bit 7 is flag n
+	RZ = RBP, // zero when flag z is set
+	RC = R12, RV = R13, // 0 or 1
+	CPU = RDI, BUDGET = RSI, // the arguments
+	EXTRA = R15, // cycles to charge on top of the static count of an exit
+	CROSSING = R14 // the cycle a page crossing costs, or scratch
+};
+
+enum { CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_BE = 0x6 };
+enum { ALU_ADD = 0x03, ALU_OR = 0x0B, ALU_AND = 0x23, ALU_SUB = 0x2B, ALU_XOR = 0x33, ALU_CMP = 0x3B, MOV = 0x8B };
+enum { EXT_ADD = 0, EXT_OR = 1, EXT_AND = 4, EXT_SUB = 5, EXT_XOR = 6, EXT_SHL = 4, EXT_SHR = 5 };
+enum { WIDE = 1, BYTE = 2, WORD = 4 }; // 64-bit operands, 8-bit registers, 16-bit operands
+
+#define RAM offsetof(struct cpu, ram)
+#define STACK (RAM + 0x100)
+#define FLAG(f) offsetof(struct cpu, flag.f)
+#define REG(r) offsetof(struct cpu, reg.r)
+#define READ_PAGE offsetof(struct cpu, read_page)
+#define WRITE_PAGE offsetof(struct cpu, write_page)
+
+// a register, or memory at [base + index << scale + disp]
+typedef struct {
+	int8_t base, index; // index -1: none
+	uint8_t scale;
+	bool memory;
+	int32_t disp;
+} operand;
+
+static operand reg(int r) {
+	return (operand) { .base = r, .index = -1 };
+}
+
+static operand at(int base, int32_t disp) {
+	return (operand) { .base = base, .index = -1, .memory = true, .disp = disp };
+}
+
+static operand at_index(int base, int index, int scale, int32_t disp) {
+	return (operand) { .base = base, .index = index, .scale = scale, .memory = true, .disp = disp };
+}
+
+enum mode { IMPLIED, IMMEDIATE, ZEROPAGE, ZEROPAGE_X, ABSOLUTE, ABSOLUTE_X, ABSOLUTE_Y, INDIRECT, INDIRECT_Y, RELATIVE };
+
+enum operation {
+	UNTRANSLATED,
+	LDA, LDX, LDY, STA, STX, STY, ADC, SBC, AND, ORA, EOR, CMP, CPX, CPY, BIT,
+	INC, DEC, ASL, LSR, ROL, ROR, INX, INY, DEX, DEY, TAX, TAY, TXA, TXS, TYA,
+	SEC, CLC, SEI, CLD, NOP, PHA, PHP, PLA, PLP, JMP, JSR, RTS,
+	BEQ, BNE, BMI, BPL, BCS, BCC, BVS
+};
+
+// the opcodes of the microcode but BRK and RTI, with their cycles before page crossings and taken branches
+static struct {
+	uint8_t operation, mode, cycles;
+} const opcodes[256] = {
+	[0x0A] = { ASL, IMPLIED, 2 }, [0x4A] = { LSR, IMPLIED, 2 }, [0x2A] = { ROL, IMPLIED, 2 }, [0x6A] = { ROR, IMPLIED, 2 },
+	[0x38] = { SEC, IMPLIED, 2 }, [0x78] = { SEI, IMPLIED, 2 }, [0x18] = { CLC, IMPLIED, 2 }, [0xD8] = { CLD, IMPLIED, 2 },
+	[0xE8] = { INX, IMPLIED, 2 }, [0xC8] = { INY, IMPLIED, 2 }, [0xCA] = { DEX, IMPLIED, 2 }, [0x88] = { DEY, IMPLIED, 2 },
+	[0xAA] = { TAX, IMPLIED, 2 }, [0xA8] = { TAY, IMPLIED, 2 }, [0x8A] = { TXA, IMPLIED, 2 }, [0x9A] = { TXS, IMPLIED, 2 },
+	[0x98] = { TYA, IMPLIED, 2 }, [0xEA] = { NOP, IMPLIED, 2 },
+
+	[0xA9] = { LDA, IMMEDIATE, 2 }, [0xA2] = { LDX, IMMEDIATE, 2 }, [0xA0] = { LDY, IMMEDIATE, 2 },
+	[0x69] = { ADC, IMMEDIATE, 2 }, [0xE9] = { SBC, IMMEDIATE, 2 }, [0x29] = { AND, IMMEDIATE, 2 },
+	[0x09] = { ORA, IMMEDIATE, 2 }, [0x49] = { EOR, IMMEDIATE, 2 }, [0xC9] = { CMP, IMMEDIATE, 2 },
+	[0xE0] = { CPX, IMMEDIATE, 2 }, [0xC0] = { CPY, IMMEDIATE, 2 },
+
+	[0xF0] = { BEQ, RELATIVE, 2 }, [0x30] = { BMI, RELATIVE, 2 }, [0xB0] = { BCS, RELATIVE, 2 }, [0x70] = { BVS, RELATIVE, 2 },
+	[0xD0] = { BNE, RELATIVE, 2 }, [0x10] = { BPL, RELATIVE, 2 }, [0x90] = { BCC, RELATIVE, 2 },
+
+	[0x85] = { STA, ZEROPAGE, 3 }, [0x86] = { STX, ZEROPAGE, 3 }, [0x84] = { STY, ZEROPAGE, 3 },
+	[0xA5] = { LDA, ZEROPAGE, 3 }, [0xA6] = { LDX, ZEROPAGE, 3 }, [0xA4] = { LDY, ZEROPAGE, 3 },
+	[0xC5] = { CMP, ZEROPAGE, 3 }, [0xE4] = { CPX, ZEROPAGE, 3 }, [0x24] = { BIT, ZEROPAGE, 3 },
+	[0x25] = { AND, ZEROPAGE, 3 }, [0x05] = { ORA, ZEROPAGE, 3 }, [0x45] = { EOR, ZEROPAGE, 3 },
+	[0x65] = { ADC, ZEROPAGE, 3 }, [0xE5] = { SBC, ZEROPAGE, 3 },
+	[0xE6] = { INC, ZEROPAGE, 5 }, [0xC6] = { DEC, ZEROPAGE, 5 }, [0x06] = { ASL, ZEROPAGE, 5 },
+	[0x46] = { LSR, ZEROPAGE, 5 }, [0x26] = { ROL, ZEROPAGE, 5 }, [0x66] = { ROR, ZEROPAGE, 5 },
+
+	[0x95] = { STA, ZEROPAGE_X, 4 }, [0x94] = { STY, ZEROPAGE_X, 4 }, [0xB5] = { LDA, ZEROPAGE_X, 4 },
+	[0xB4] = { LDY, ZEROPAGE_X, 4 }, [0xD5] = { CMP, ZEROPAGE_X, 4 }, [0x35] = { AND, ZEROPAGE_X, 4 },
+	[0x75] = { ADC, ZEROPAGE_X, 4 }, [0xF5] = { SBC, ZEROPAGE_X, 4 },
+	[0xF6] = { INC, ZEROPAGE_X, 6 }, [0xD6] = { DEC, ZEROPAGE_X, 6 },
+
+	[0x8D] = { STA, ABSOLUTE, 4 }, [0x8E] = { STX, ABSOLUTE, 4 }, [0x8C] = { STY, ABSOLUTE, 4 },
+	[0xAD] = { LDA, ABSOLUTE, 4 }, [0xAE] = { LDX, ABSOLUTE, 4 }, [0xAC] = { LDY, ABSOLUTE, 4 },
+	[0xCD] = { CMP, ABSOLUTE, 4 }, [0x0D] = { ORA, ABSOLUTE, 4 }, [0x4D] = { EOR, ABSOLUTE, 4 },
+	[0x6D] = { ADC, ABSOLUTE, 4 }, [0xED] = { SBC, ABSOLUTE, 4 },
+	[0xEE] = { INC, ABSOLUTE, 6 }, [0xCE] = { DEC, ABSOLUTE, 6 }, [0x6E] = { ROR, ABSOLUTE, 6 },
+	[0x20] = { JSR, ABSOLUTE, 6 }, [0x4C] = { JMP, ABSOLUTE, 3 },
+
+	[0x9D] = { STA, ABSOLUTE_X, 5 }, [0xBD] = { LDA, ABSOLUTE_X, 4 }, [0xBC] = { LDY, ABSOLUTE_X, 4 },
+	[0x3D] = { AND, ABSOLUTE_X, 4 }, [0x1D] = { ORA, ABSOLUTE_X, 4 }, [0xDD] = { CMP, ABSOLUTE_X, 4 },
+	[0x7D] = { ADC, ABSOLUTE_X, 4 }, [0xFD] = { SBC, ABSOLUTE_X, 4 },
+	[0xFE] = { INC, ABSOLUTE_X, 7 }, [0xDE] = { DEC, ABSOLUTE_X, 7 },
+
+	[0x99] = { STA, ABSOLUTE_Y, 5 }, [0xB9] = { LDA, ABSOLUTE_Y, 4 }, [0x19] = { ORA, ABSOLUTE_Y, 4 },
+	[0xD9] = { CMP, ABSOLUTE_Y, 4 },
+
+	[0x91] = { STA, INDIRECT_Y, 6 }, [0xB1] = { LDA, INDIRECT_Y, 5 }, [0x11] = { ORA, INDIRECT_Y, 5 },
+	[0xD1] = { CMP, INDIRECT_Y, 5 }, [0x71] = { ADC, INDIRECT_Y, 5 }, [0xF1] = { SBC, INDIRECT_Y, 5 },
+
+	[0x6C] = { JMP, INDIRECT, 5 },
+
+	[0x48] = { PHA, IMPLIED, 3 }, [0x08] = { PHP, IMPLIED, 3 }, [0x68] = { PLA, IMPLIED, 4 },
+	[0x28] = { PLP, IMPLIED, 4 }, [0x60] = { RTS, IMPLIED, 6 }
+};
+
+static uint8_t const lengths[] = {
+	[IMPLIED] = 1, [IMMEDIATE] = 2, [ZEROPAGE] = 2, [ZEROPAGE_X] = 2, [ABSOLUTE] = 3,
+	[ABSOLUTE_X] = 3, [ABSOLUTE_Y] = 3, [INDIRECT] = 3, [INDIRECT_Y] = 2, [RELATIVE] = 2
+};
+
+struct translation {
+	uint8_t *p; // next byte of host code
+	struct cpu const *cpu;
+	struct page const *page;
+	uint16_t pc; // of the instruction being translated
+	int cycles; // charged before it, besides EXTRA
+	int crossings; // page crossings that may have been charged to EXTRA so far
+	int most; // cycles of the longest exit so far
+	int before; // exit before the instruction, -1 until needed
+	bool end; // after the instruction
+	bool jumped; // the instruction exits by itself
+	bool branched; // since the start of the block
+	int straight; // instructions from the start of the block until the first branch, included
+
+	struct {
+		int pc; // -1: stored already
+		int cycles;
+		uint8_t *stub;
+	} exit[4 * MAX_INSTRUCTIONS];
+	int exits;
+
+	struct {
+		uint8_t *rel; // rel32 of a jump to an exit
+		int exit;
+	} patch[5 * MAX_INSTRUCTIONS];
+	int patches;
+
+	struct {
+		uint16_t pc;
+		int cycles;
+		uint8_t *code;
+	} label[MAX_INSTRUCTIONS]; // instructions translated, loops jump back to them
+	int labels;
+
+	int32_t *most_patch[MAX_INSTRUCTIONS]; // loops need the longest pass, known at the end
+	int most_patches;
+};
+
+static void emit8(struct translation *t, uint8_t data) {
+	*t->p++ = data;
+}
+
+static void emit16(struct translation *t, uint16_t data) {
+	memcpy(t->p, &data, sizeof(data));
+	t->p += sizeof(data);
+}
+
+static void emit32(struct translation *t, uint32_t data) {
+	memcpy(t->p, &data, sizeof(data));
+	t->p += sizeof(data);
+}
+
+// opcode r, rm; r is a register or the opcode extension, opcodes above 0xFF are 0x0F-prefixed
+static void op(struct translation *t, int size, unsigned opcode, int r, operand rm) {
+	if (size & WORD)
+		emit8(t, 0x66);
+	int rex = (size & WIDE ? 8 : 0) | (r & 8 ? 4 : 0) | (rm.memory && rm.index >= 0 && (rm.index & 8) ? 2 : 0) | (rm.base & 8 ? 1 : 0);
+	// without a REX prefix, byte registers 4 to 7 are ah, ch, dh and bh rather than spl, bpl, sil and dil
+	bool low_byte = (size & BYTE) && ((r & ~3) == 4 || (!rm.memory && (rm.base & ~3) == 4));
+	if (rex || low_byte)
+		emit8(t, 0x40 | rex);
+	if (opcode > 0xFF)
+		emit8(t, opcode >> 8);
+	emit8(t, opcode);
+	if (!rm.memory) {
+		emit8(t, 0xC0 | (r & 7) << 3 | (rm.base & 7));
+		return;
+	}
+	if (rm.index < 0 && (rm.base & 7) != RSP) {
+		emit8(t, 0x80 | (r & 7) << 3 | (rm.base & 7));
+	} else {
+		emit8(t, 0x84 | (r & 7) << 3);
+		emit8(t, rm.scale << 6 | ((rm.index < 0 ? RSP : rm.index) & 7) << 3 | (rm.base & 7));
+	}
+	emit32(t, rm.disp);
+}
+
+static void alu(struct translation *t, unsigned opcode, int r, int source) {
+	op(t, 0, opcode, r, reg(source));
+}
+
+static void alu_imm(struct translation *t, int extension, int r, int32_t data) {
+	op(t, 0, 0x81, extension, reg(r));
+	emit32(t, data);
+}
+
+static void shift(struct translation *t, int extension, int r, uint8_t count) {
+	op(t, 0, 0xC1, extension, reg(r));
+	emit8(t, count);
+}
+
+static void load8(struct translation *t, int r, operand source) { // movzx
+	op(t, BYTE, 0x0FB6, r, source);
+}
+
+static void store8(struct translation *t, operand target, int r) {
+	op(t, BYTE, 0x88, r, target);
+}
+
+static void store8_imm(struct translation *t, operand target, uint8_t data) {
+	op(t, BYTE, 0xC6, 0, target);
+	emit8(t, data);
+}
+
+static void mov_imm(struct translation *t, int r, uint32_t data) {
+	if (r & 8)
+		emit8(t, 0x41);
+	emit8(t, 0xB8 | (r & 7));
+	emit32(t, data);
+}
+
+static void mov_imm64(struct translation *t, int r, uint64_t data) {
+	emit8(t, 0x48 | (r & 8 ? 1 : 0));
+	emit8(t, 0xB8 | (r & 7));
+	memcpy(t->p, &data, sizeof(data));
+	t->p += sizeof(data);
+}
+
+// a byte register holding 0 to 255 back into that range after an operation
+static void truncate8(struct translation *t, int r) {
+	load8(t, r, reg(r));
+}
+
+static void test(struct translation *t, int r) {
+	op(t, 0, 0x85, r, reg(r));
+}
+
+static void set_nz(struct translation *t, int r) {
+	alu(t, MOV, RN, r);
+	alu(t, MOV, RZ, r);
+}
+
+static void push_register(struct translation *t, int r, bool pop) {
+	if (r & 8)
+		emit8(t, 0x41);
+	emit8(t, (pop ? 0x58 : 0x50) | (r & 7));
+}
+
+static int32_t *jump(struct translation *t, int cc) { // cc < 0: always
+	if (cc < 0) {
+		emit8(t, 0xE9);
+	} else {
+		emit8(t, 0x0F);
+		emit8(t, 0x80 | cc);
+	}
+	emit32(t, 0);
+	return (int32_t *) (t->p - 4);
+}
+
+static void land(int32_t *rel, uint8_t const *target) {
+	int32_t distance = target - ((uint8_t const *) rel + 4);
+	memcpy(rel, &distance, sizeof(distance));
+}
+
+// an exit to the instruction at pc (-1: stored already) with cycles charged besides EXTRA
+static int add_exit(struct translation *t, int pc, int cycles) {
+	t->exit[t->exits].pc = pc;
+	t->exit[t->exits].cycles = cycles;
+	if (cycles + t->crossings > t->most)
+		t->most = cycles + t->crossings;
+	return t->exits++;
+}
+
+static void jump_to_exit(struct translation *t, int cc, int exit) {
+	t->patch[t->patches].rel = (uint8_t *) jump(t, cc);
+	t->patch[t->patches++].exit = exit;
+}
+
+// leaves before the instruction if the page just loaded in r is NULL, that is, I/O
+static void exit_if_null(struct translation *t, int r) {
+	op(t, WIDE, 0x85, r, reg(r));
+	if (t->before < 0)
+		t->before = add_exit(t, t->pc, t->cycles);
+	jump_to_exit(t, CC_E, t->before);
+}
+
+/*
+ * Where the instruction reads and writes its data, exiting before it when that is
+ * I/O. Absolute,Y and (indirect),Y read the address before the carry into its high
+ * byte first, for a store or a page crossing, so the page it is added to must not be
+ * I/O either. The cycle of a page crossing is charged once nothing can exit any more.
+ */
+static void locate(struct translation *t, int mode, uint16_t operand_bytes, bool reads, bool writes, bool crossing, operand *load, operand *store) {
+	switch (mode) {
+	case ZEROPAGE:
+		*load = *store = at(CPU, RAM + operand_bytes);
+		return;
+	case ZEROPAGE_X:
+		op(t, 0, 0x8D, RCX, at(RX, operand_bytes)); // lea
+		truncate8(t, RCX);
+		*load = *store = at_index(CPU, RCX, 0, RAM);
+		return;
+	case ABSOLUTE:
+		if (operand_bytes < 0x2000) { // RAM is never mapped elsewhere
+			*load = *store = at(CPU, RAM + (operand_bytes & 0x7FF));
+			return;
+		}
+		if (reads) {
+			op(t, WIDE, MOV, RAX, at(CPU, READ_PAGE + (operand_bytes >> 8) * sizeof(uint8_t *)));
+			exit_if_null(t, RAX);
+			*load = at(RAX, operand_bytes & 0xFF);
+		}
+		if (writes) {
+			op(t, WIDE, MOV, RDX, at(CPU, WRITE_PAGE + (operand_bytes >> 8) * sizeof(uint8_t *)));
+			exit_if_null(t, RDX);
+			*store = at(RDX, operand_bytes & 0xFF);
+		}
+		return;
+	}
+
+	// indexed: the address in ecx, its page in edx
+	if (mode == INDIRECT_Y) {
+		load8(t, RCX, at(CPU, RAM + operand_bytes));
+		load8(t, RDX, at(CPU, RAM + ((operand_bytes + 1) & 0xFF)));
+		op(t, WIDE, MOV, RAX, at_index(CPU, RDX, 3, READ_PAGE));
+		exit_if_null(t, RAX);
+		shift(t, EXT_SHL, RDX, 8);
+		alu(t, ALU_OR, RCX, RDX);
+		if (crossing) {
+			load8(t, CROSSING, reg(RCX));
+			alu(t, ALU_ADD, CROSSING, RY);
+			shift(t, EXT_SHR, CROSSING, 8);
+		}
+		alu(t, ALU_ADD, RCX, RY);
+	} else {
+		int index = mode == ABSOLUTE_X ? RX : RY;
+		if (mode == ABSOLUTE_Y && operand_bytes >= 0x2000) {
+			op(t, WIDE, MOV, RAX, at(CPU, READ_PAGE + (operand_bytes >> 8) * sizeof(uint8_t *)));
+			exit_if_null(t, RAX);
+		}
+		if (crossing) {
+			op(t, 0, 0x8D, CROSSING, at(index, operand_bytes & 0xFF));
+			shift(t, EXT_SHR, CROSSING, 8);
+		}
+		op(t, 0, 0x8D, RCX, at(index, operand_bytes));
+	}
+	op(t, 0, 0x0FB7, RCX, reg(RCX)); // movzx ecx, cx
+	alu(t, MOV, RDX, RCX);
+	shift(t, EXT_SHR, RDX, 8);
+	if (reads) {
+		op(t, WIDE, MOV, RAX, at_index(CPU, RDX, 3, READ_PAGE));
+		exit_if_null(t, RAX);
+	}
+	if (writes) {
+		op(t, WIDE, MOV, RDX, at_index(CPU, RDX, 3, WRITE_PAGE));
+		exit_if_null(t, RDX);
+	}
+	truncate8(t, RCX);
+	*load = at_index(RAX, RCX, 0, 0);
+	*store = at_index(RDX, RCX, 0, 0);
+	if (crossing) {
+		alu(t, ALU_ADD, EXTRA, CROSSING);
+		t->crossings++;
+	}
+}
+
+// after a store in place: code in RAM leaves when it writes into its own page
+static void check_store(struct translation *t, int mode, uint16_t operand_bytes, int next_cycles) {
+	if (!t->page->writable)
+		return;
+	if (mode == ABSOLUTE && operand_bytes < 0x2000) {
+		if (t->cpu->ram + (operand_bytes & 0x700) == t->page->memory)
+			t->end = true;
+		return;
+	}
+	if (mode == ZEROPAGE || mode == ZEROPAGE_X) // code never runs from the zero page, see translate
+		return;
+	mov_imm64(t, RAX, (uintptr_t) t->page->memory);
+	op(t, WIDE, ALU_CMP, RDX, reg(RAX));
+	jump_to_exit(t, CC_E, add_exit(t, (t->pc + lengths[mode]) & 0xFFFF, next_cycles));
+}
+
+static void add_with_carry(struct translation *t) { // data in eax
+	alu(t, MOV, RCX, RA);
+	alu(t, ALU_ADD, RCX, RAX);
+	alu(t, ALU_ADD, RCX, RC);
+	// overflow: operands of the same sign and a result of the other
+	alu(t, MOV, RDX, RA);
+	alu(t, ALU_XOR, RDX, RAX);
+	op(t, 0, 0xF7, 2, reg(RDX)); // not
+	alu(t, MOV, RV, RA);
+	alu(t, ALU_XOR, RV, RCX);
+	alu(t, ALU_AND, RV, RDX);
+	shift(t, EXT_SHR, RV, 7);
+	alu_imm(t, EXT_AND, RV, 1);
+	alu(t, MOV, RC, RCX);
+	shift(t, EXT_SHR, RC, 8);
+	load8(t, RA, reg(RCX));
+	set_nz(t, RA);
+}
+
+static void compare(struct translation *t, int r) { // data in eax
+	alu(t, ALU_CMP, r, RAX);
+	op(t, BYTE, 0x0F90 | CC_AE, 0, reg(RC)); // setae
+	alu(t, MOV, RN, r);
+	alu(t, ALU_SUB, RN, RAX);
+	truncate8(t, RN);
+	alu(t, MOV, RZ, RN);
+}
+
+// ASL, LSR, ROL and ROR of a register holding 0 to 255, flags n and z left to the caller
+static void shift_or_rotate(struct translation *t, int operation, int r) {
+	if (operation == ROL || operation == ROR) {
+		alu(t, MOV, CROSSING, RC);
+		if (operation == ROR)
+			shift(t, EXT_SHL, CROSSING, 7);
+	}
+	alu(t, MOV, RC, r);
+	if (operation == ASL || operation == ROL) {
+		shift(t, EXT_SHR, RC, 7);
+		alu(t, ALU_ADD, r, r);
+	} else {
+		alu_imm(t, EXT_AND, RC, 1);
+		shift(t, EXT_SHR, r, 1);
+	}
+	if (operation == ROL || operation == ROR)
+		alu(t, ALU_OR, r, CROSSING);
+	truncate8(t, r);
+}
+
+// the instruction translated at pc, -1 if none
+static int find_label(struct translation const *t, uint16_t pc) {
+	for (int i = 0; i < t->labels; i++)
+		if (t->label[i].pc == pc)
+			return i;
+	return -1;
+}
+
+// a jump back to an instruction translated: goes round again if the longest pass still fits in the budget
+static void loop(struct translation *t, int label, int cycles) {
+	// getting back here is a pass too
+	if (cycles + t->crossings > t->most)
+		t->most = cycles + t->crossings;
+	alu_imm(t, EXT_ADD, EXTRA, cycles - t->label[label].cycles);
+	op(t, 0, 0x8D, RAX, at(EXTRA, 0)); // lea eax, [r15 + most]
+	t->most_patch[t->most_patches++] = (int32_t *) (t->p - 4);
+	alu(t, ALU_CMP, RAX, BUDGET);
+	land(jump(t, CC_BE), t->label[label].code);
+	jump_to_exit(t, -1, add_exit(t, t->label[label].pc, t->label[label].cycles));
+}
+
+static void translate_branch(struct translation *t, int operation, uint8_t offset) {
+	uint16_t next = t->pc + 2;
+	uint16_t target = next + (int8_t) offset;
+	int taken = t->cycles + ((target ^ next) & 0xFF00 ? 4 : 3);
+	int cc;
+	switch (operation) {
+	case BEQ: case BNE:
+		test(t, RZ);
+		cc = operation == BEQ ? CC_E : CC_NE;
+		break;
+	case BMI: case BPL:
+		op(t, BYTE, 0xF6, 0, reg(RN)); // test bl, 0x80
+		emit8(t, 0x80);
+		cc = operation == BMI ? CC_NE : CC_E;
+		break;
+	case BCS: case BCC:
+		test(t, RC);
+		cc = operation == BCS ? CC_NE : CC_E;
+		break;
+	default:
+		test(t, RV);
+		cc = CC_NE;
+		break;
+	}
+
+	int label = find_label(t, target);
+	if (label < 0) {
+		jump_to_exit(t, cc, add_exit(t, target, taken));
+		return;
+	}
+	int32_t *not_taken = jump(t, cc ^ 1);
+	loop(t, label, taken);
+	land(not_taken, t->p);
+}
+
+// one instruction, false when it cannot be translated here
+static bool translate_instruction(struct translation *t, uint8_t const *code) {
+	int operation = opcodes[code[0]].operation;
+	int mode = opcodes[code[0]].mode;
+	int length = lengths[mode];
+	struct cpu const *cpu = t->cpu;
+	if (!operation)
+		return false;
+	// the microcode reads the byte after the instruction (two for RTS), which must be code of the same page
+	if ((t->pc & 0xFF) + (operation == RTS ? 2 : length) > 0xFF)
+		return false;
+	uint16_t operand_bytes = length == 3 ? code[1] | code[2] << 8 : code[1];
+
+	bool reads = true, writes = false, stores = operation == STA || operation == STX || operation == STY;
+	switch (operation) {
+	case STA: case STX: case STY:
+		reads = false; // only the dummy read of absolute,Y and (indirect),Y, which locate checks
+		writes = true;
+		break;
+	case INC: case DEC: case ASL: case LSR: case ROL: case ROR:
+		writes = mode != IMPLIED;
+		break;
+	}
+	// I/O at a fixed address would exit every time
+	if (mode == ABSOLUTE && operation != JMP && operation != JSR && operand_bytes >= 0x2000)
+		if ((reads && !cpu->read_page[operand_bytes >> 8]) || (writes && !cpu->write_page[operand_bytes >> 8])) {
+			t->straight += !t->branched;
+			return false;
+		}
+	if (mode == INDIRECT && operand_bytes >= 0x2000 && !cpu->read_page[operand_bytes >> 8])
+		return false;
+
+	t->label[t->labels].pc = t->pc;
+	t->label[t->labels].cycles = t->cycles;
+	t->label[t->labels++].code = t->p;
+	t->before = -1;
+	t->straight += !t->branched;
+	t->branched |= mode == RELATIVE || operation == JMP || operation == JSR || operation == RTS;
+	int cycles = t->cycles + opcodes[code[0]].cycles;
+	bool crossing = (mode == ABSOLUTE_X || mode == ABSOLUTE_Y || mode == INDIRECT_Y) && !writes;
+	operand load, store;
+	if (mode != IMPLIED && mode != IMMEDIATE && mode != RELATIVE && mode != INDIRECT && operation != JMP && operation != JSR)
+		locate(t, mode, operand_bytes, reads, writes, crossing, &load, &store);
+	if (reads && !stores && mode != IMPLIED && mode != RELATIVE && mode != INDIRECT && operation != JMP && operation != JSR) {
+		if (mode == IMMEDIATE)
+			mov_imm(t, RAX, operand_bytes);
+		else
+			load8(t, RAX, load);
+	}
+
+	switch (operation) {
+	case LDA: alu(t, MOV, RA, RAX); set_nz(t, RA); break;
+	case LDX: alu(t, MOV, RX, RAX); set_nz(t, RX); break;
+	case LDY: alu(t, MOV, RY, RAX); set_nz(t, RY); break;
+	case STA: case STX: case STY:
+		store8(t, store, operation == STA ? RA : operation == STX ? RX : RY);
+		check_store(t, mode, operand_bytes, cycles);
+		break;
+	case SBC:
+		alu_imm(t, EXT_XOR, RAX, 0xFF);
+		// fall through
+	case ADC: add_with_carry(t); break;
+	case AND: alu(t, ALU_AND, RA, RAX); set_nz(t, RA); break;
+	case ORA: alu(t, ALU_OR, RA, RAX); set_nz(t, RA); break;
+	case EOR: alu(t, ALU_XOR, RA, RAX); set_nz(t, RA); break;
+	case CMP: compare(t, RA); break;
+	case CPX: compare(t, RX); break;
+	case CPY: compare(t, RY); break;
+	case BIT:
+		alu(t, MOV, RN, RAX);
+		alu(t, MOV, RV, RAX);
+		shift(t, EXT_SHR, RV, 6);
+		alu_imm(t, EXT_AND, RV, 1);
+		alu(t, MOV, RZ, RA);
+		alu(t, ALU_AND, RZ, RAX);
+		break;
+	case INC: case DEC: case ASL: case LSR: case ROL: case ROR:
+		if (mode == IMPLIED) {
+			shift_or_rotate(t, operation, RA);
+			set_nz(t, RA);
+			break;
+		}
+		if (operation == INC || operation == DEC) {
+			alu_imm(t, operation == INC ? EXT_ADD : EXT_SUB, RAX, 1);
+			truncate8(t, RAX);
+		} else {
+			shift_or_rotate(t, operation, RAX);
+		}
+		store8(t, store, RAX);
+		set_nz(t, RAX);
+		check_store(t, mode, operand_bytes, cycles);
+		break;
+	case INX: case INY: case DEX: case DEY: {
+		int r = operation == INX || operation == DEX ? RX : RY;
+		alu_imm(t, operation == INX || operation == INY ? EXT_ADD : EXT_SUB, r, 1);
+		truncate8(t, r);
+		set_nz(t, r);
+		break;
+	}
+	case TAX: alu(t, MOV, RX, RA); set_nz(t, RX); break;
+	case TAY: alu(t, MOV, RY, RA); set_nz(t, RY); break;
+	case TXA: alu(t, MOV, RA, RX); set_nz(t, RA); break;
+	case TYA: alu(t, MOV, RA, RY); set_nz(t, RA); break;
+	case TXS: alu(t, MOV, RS, RX); break;
+	case SEC: mov_imm(t, RC, 1); break;
+	case CLC: mov_imm(t, RC, 0); break;
+	case SEI: store8_imm(t, at(CPU, FLAG(i)), 1); break;
+	case CLD: store8_imm(t, at(CPU, FLAG(d)), 0); break;
+	case NOP: break;
+	case PHA:
+		store8(t, at_index(CPU, RS, 0, STACK), RA);
+		op(t, BYTE, 0xFE, 1, reg(RS)); // dec
+		break;
+	case PHP: // with flag b clear, as push_status does outside interrupts
+		alu(t, MOV, RAX, RN);
+		alu_imm(t, EXT_AND, RAX, 0x80);
+		alu_imm(t, EXT_OR, RAX, 0x20);
+		alu(t, MOV, RCX, RV);
+		shift(t, EXT_SHL, RCX, 6);
+		alu(t, ALU_OR, RAX, RCX);
+		load8(t, RCX, at(CPU, FLAG(d)));
+		shift(t, EXT_SHL, RCX, 3);
+		alu(t, ALU_OR, RAX, RCX);
+		load8(t, RCX, at(CPU, FLAG(i)));
+		shift(t, EXT_SHL, RCX, 2);
+		alu(t, ALU_OR, RAX, RCX);
+		alu(t, ALU_XOR, RCX, RCX);
+		test(t, RZ);
+		op(t, BYTE, 0x0F90 | CC_E, 0, reg(RCX)); // sete
+		alu(t, ALU_ADD, RCX, RCX);
+		alu(t, ALU_OR, RAX, RCX);
+		alu(t, ALU_OR, RAX, RC);
+		store8_imm(t, at(CPU, FLAG(b)), 0);
+		store8(t, at_index(CPU, RS, 0, STACK), RAX);
+		op(t, BYTE, 0xFE, 1, reg(RS));
+		break;
+	case PLA:
+		op(t, BYTE, 0xFE, 0, reg(RS)); // inc
+		load8(t, RA, at_index(CPU, RS, 0, STACK));
+		set_nz(t, RA);
+		break;
+	case PLP: // may clear flag i: the IRQ line is looked at again right after
+		op(t, BYTE, 0xFE, 0, reg(RS));
+		load8(t, RAX, at_index(CPU, RS, 0, STACK));
+		alu(t, MOV, RN, RAX);
+		alu(t, MOV, RV, RAX);
+		shift(t, EXT_SHR, RV, 6);
+		alu_imm(t, EXT_AND, RV, 1);
+		alu(t, MOV, RCX, RAX);
+		shift(t, EXT_SHR, RCX, 3);
+		alu_imm(t, EXT_AND, RCX, 1);
+		store8(t, at(CPU, FLAG(d)), RCX);
+		alu(t, MOV, RCX, RAX);
+		shift(t, EXT_SHR, RCX, 2);
+		alu_imm(t, EXT_AND, RCX, 1);
+		store8(t, at(CPU, FLAG(i)), RCX);
+		alu(t, MOV, RZ, RAX);
+		op(t, 0, 0xF7, 2, reg(RZ)); // not
+		alu_imm(t, EXT_AND, RZ, 0x02);
+		alu(t, MOV, RC, RAX);
+		alu_imm(t, EXT_AND, RC, 1);
+		t->end = true;
+		break;
+	case JMP:
+		if (mode == ABSOLUTE && find_label(t, operand_bytes) >= 0) {
+			loop(t, find_label(t, operand_bytes), cycles);
+		} else if (mode == ABSOLUTE) {
+			jump_to_exit(t, -1, add_exit(t, operand_bytes, cycles));
+		} else { // the pointer does not cross pages
+			uint16_t hi = (operand_bytes & 0xFF00) | ((operand_bytes + 1) & 0xFF);
+			if (operand_bytes < 0x2000) {
+				load8(t, RCX, at(CPU, RAM + (operand_bytes & 0x7FF)));
+				load8(t, RDX, at(CPU, RAM + (hi & 0x7FF)));
+			} else {
+				op(t, WIDE, MOV, RAX, at(CPU, READ_PAGE + (operand_bytes >> 8) * sizeof(uint8_t *)));
+				exit_if_null(t, RAX);
+				load8(t, RCX, at(RAX, operand_bytes & 0xFF));
+				load8(t, RDX, at(RAX, hi & 0xFF));
+			}
+			shift(t, EXT_SHL, RDX, 8);
+			alu(t, ALU_OR, RCX, RDX);
+			op(t, WORD, 0x89, RCX, at(CPU, REG(pc)));
+			jump_to_exit(t, -1, add_exit(t, -1, cycles));
+		}
+		t->end = t->jumped = true;
+		break;
+	case JSR: {
+		uint16_t pushed = t->pc + 2;
+		store8_imm(t, at_index(CPU, RS, 0, STACK), pushed >> 8);
+		op(t, BYTE, 0xFE, 1, reg(RS));
+		store8_imm(t, at_index(CPU, RS, 0, STACK), pushed & 0xFF);
+		op(t, BYTE, 0xFE, 1, reg(RS));
+		jump_to_exit(t, -1, add_exit(t, operand_bytes, cycles));
+		t->end = t->jumped = true;
+		break;
+	}
+	case RTS: // the microcode reads the byte at the address pulled, which must not be I/O
+		op(t, 0, 0x8D, RCX, at(RS, 1));
+		truncate8(t, RCX);
+		load8(t, RAX, at_index(CPU, RCX, 0, STACK));
+		op(t, 0, 0x8D, RDX, at(RS, 2));
+		truncate8(t, RDX);
+		load8(t, RDX, at_index(CPU, RDX, 0, STACK));
+		shift(t, EXT_SHL, RDX, 8);
+		alu(t, ALU_OR, RAX, RDX);
+		alu(t, MOV, RDX, RAX);
+		shift(t, EXT_SHR, RDX, 8);
+		op(t, WIDE, MOV, RCX, at_index(CPU, RDX, 3, READ_PAGE));
+		exit_if_null(t, RCX);
+		alu_imm(t, EXT_ADD, RS, 2);
+		truncate8(t, RS);
+		alu_imm(t, EXT_ADD, RAX, 1);
+		op(t, WORD, 0x89, RAX, at(CPU, REG(pc)));
+		jump_to_exit(t, -1, add_exit(t, -1, cycles));
+		t->end = t->jumped = true;
+		break;
+	default:
+		translate_branch(t, operation, code[1]);
+		break;
+	}
+	t->cycles = cycles;
+	t->pc += length;
+	return true;
+}
+
+// returns the bytes of 6502 code translated, 0 if not worth it
+static int translate_block(struct translation *t, uint8_t const *memory) {
+	uint8_t *start = t->p;
+	static int const saved[] = { RBX, RBP, R12, R13, R14, R15 };
+	for (size_t i = 0; i < sizeof(saved) / sizeof(saved[0]); i++)
+		push_register(t, saved[i], false);
+	load8(t, RA, at(CPU, REG(a)));
+	load8(t, RX, at(CPU, REG(x)));
+	load8(t, RY, at(CPU, REG(y)));
+	load8(t, RS, at(CPU, REG(s)));
+	load8(t, RN, at(CPU, FLAG(n)));
+	shift(t, EXT_SHL, RN, 7);
+	load8(t, RZ, at(CPU, FLAG(z)));
+	alu_imm(t, EXT_XOR, RZ, 1);
+	load8(t, RC, at(CPU, FLAG(c)));
+	load8(t, RV, at(CPU, FLAG(v)));
+	alu(t, ALU_XOR, EXTRA, EXTRA);
+
+	uint16_t first = t->pc;
+	while (!t->end && t->labels < MAX_INSTRUCTIONS && translate_instruction(t, memory + (t->pc & 0xFF)))
+		;
+	if (t->labels < MIN_INSTRUCTIONS && !t->most_patches) {
+		t->p = start;
+		return 0;
+	}
+	if (!t->jumped)
+		jump_to_exit(t, -1, add_exit(t, t->pc, t->cycles));
+
+	uint8_t *epilogue = t->p;
+	store8(t, at(CPU, REG(a)), RA);
+	store8(t, at(CPU, REG(x)), RX);
+	store8(t, at(CPU, REG(y)), RY);
+	store8(t, at(CPU, REG(s)), RS);
+	op(t, BYTE, 0xF6, 0, reg(RN)); // test bl, 0x80
+	emit8(t, 0x80);
+	op(t, BYTE, 0x0F90 | CC_NE, 0, at(CPU, FLAG(n))); // setne
+	test(t, RZ);
+	op(t, BYTE, 0x0F90 | CC_E, 0, at(CPU, FLAG(z))); // sete
+	store8(t, at(CPU, FLAG(c)), RC);
+	store8(t, at(CPU, FLAG(v)), RV);
+	for (int i = sizeof(saved) / sizeof(saved[0]) - 1; i >= 0; i--)
+		push_register(t, saved[i], true);
+	emit8(t, 0xC3); // ret
+
+	for (int i = 0; i < t->exits; i++) {
+		t->exit[i].stub = t->p;
+		if (t->exit[i].pc >= 0) {
+			op(t, WORD, 0xC7, 0, at(CPU, REG(pc)));
+			emit16(t, t->exit[i].pc);
+		}
+		op(t, 0, 0x8D, RAX, at(EXTRA, t->exit[i].cycles)); // lea eax, [r15 + cycles]
+		land(jump(t, -1), epilogue);
+	}
+	for (int i = 0; i < t->patches; i++)
+		land((int32_t *) t->patch[i].rel, t->exit[t->patch[i].exit].stub);
+	for (int i = 0; i < t->most_patches; i++)
+		memcpy(t->most_patch[i], &t->most, sizeof(t->most));
+	return (t->pc - first) & 0xFFFF;
+}
+
+/***************************************************** Caching *****************************************************/
+
+static struct jit *jit_create(void) {
+	struct jit *jit = calloc(1, sizeof(struct jit));
+	if (!jit) {
+		puts("Error on memory allocation!");
+		return NULL;
+	}
+	// written only while translating, executable the rest of the time
+	jit->code = mmap(NULL, CODE_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (jit->code == MAP_FAILED) {
+		puts("Error on memory allocation!");
+		free(jit);
+		return NULL;
+	}
+	jit->used = BLOCK_ALIGN; // offset 0 means not translated
+	return jit;
+}
+
+static void flush(struct jit *jit) {
+	for (int i = 0; i < PAGE_SLOTS; i++) {
+		free(jit->pages[i]);
+		jit->pages[i] = NULL;
+	}
+	memset(jit->bound, 0, sizeof(jit->bound));
+	jit->page_count = 0;
+	jit->used = BLOCK_ALIGN;
+}
+
+void jit_destroy(struct jit *jit) {
+	if (!jit)
+		return;
+	flush(jit);
+	munmap(jit->code, CODE_SIZE);
+	free(jit);
+}
+
+// the translations of the host page mapped at a guest page, created if needed; NULL when out of memory
+static struct page *bind(struct jit *jit, struct cpu const *cpu, uint8_t guest_page) {
+	uint8_t const *memory = cpu->read_page[guest_page];
+	struct page *page = jit->bound[guest_page];
+	if (page && page->memory == memory)
+		return page;
+	size_t slot = ((uintptr_t) memory >> 8 ^ (uintptr_t) guest_page << 24) * 0x9E3779B1u & (PAGE_SLOTS - 1);
+	while (jit->pages[slot] && (jit->pages[slot]->memory != memory || jit->pages[slot]->guest_page != guest_page))
+		slot = (slot + 1) & (PAGE_SLOTS - 1);
+	page = jit->pages[slot];
+	if (!page) {
+		if (jit->page_count == MAX_PAGES) {
+			flush(jit);
+			return bind(jit, cpu, guest_page);
+		}
+		page = calloc(1, sizeof(struct page));
+		if (!page) {
+			puts("Error on memory allocation!");
+			return NULL;
+		}
+		// PRG ROM is never written, anything else may be
+		uintptr_t prg = (uintptr_t) cpu->console->prg;
+		page->memory = memory;
+		page->guest_page = guest_page;
+		page->writable = (uintptr_t) memory < prg || (uintptr_t) memory >= prg + cpu->console->cartridge.prg_size;
+		memcpy(page->snapshot, memory, sizeof(page->snapshot));
+		jit->pages[slot] = page;
+		jit->page_count++;
+	}
+	return jit->bound[guest_page] = page;
+}
+
+static struct block *translate(struct jit *jit, struct cpu const *cpu, uint16_t address) {
+	if (jit->used + BLOCK_ROOM > CODE_SIZE)
+		flush(jit);
+	struct page *page = bind(jit, cpu, address >> 8);
+	if (!page)
+		return NULL;
+	struct block *block = &page->block[address & 0xFF];
+	// a writable page that changed since its translations were made loses them all
+	if (page->writable && memcmp(page->memory, page->snapshot, sizeof(page->snapshot))) {
+		memset(page->block, 0, sizeof(page->block));
+		memcpy(page->snapshot, page->memory, sizeof(page->snapshot));
+	}
+	// the zero page and the stack are written without checks
+	uintptr_t ram = (uintptr_t) cpu->ram;
+	if ((uintptr_t) page->memory - ram < 0x200) {
+		block->code = NOT_TRANSLATED;
+		block->length = 0;
+		return block;
+	}
+
+	if (mprotect(jit->code, CODE_SIZE, PROT_READ | PROT_WRITE)) {
+		perror("Error on code buffer");
+		return NULL;
+	}
+	struct translation t = { .p = jit->code + jit->used, .cpu = cpu, .page = page, .pc = address };
+	int length = translate_block(&t, page->snapshot);
+	mprotect(jit->code, CODE_SIZE, PROT_READ | PROT_EXEC);
+
+	if (!length) {
+		// RAM may hold something else next time
+		if (page->writable)
+			block->heat = 0;
+		else {
+			block->code = NOT_TRANSLATED;
+			block->length = t.straight;
+		}
+		return block;
+	}
+	block->code = jit->used;
+	block->length = length;
+	block->cycles = t.most;
+	jit->used = (t.p - jit->code + BLOCK_ALIGN - 1) & ~(size_t) (BLOCK_ALIGN - 1);
+	return block;
+}
+
+/*
+ * Runs the translation of the code at the opcode just fetched, translating it when it
+ * has become hot. Returns the cycles it took, with the pc at the next instruction, or 0
+ * if there is nothing to run there within the budget. Code that cannot be translated
+ * returns minus the instructions after this one there is no use asking about either:
+ * those run in a straight line up to the I/O access or branch that stopped it.
+ */
+int jit_execute(struct cpu *cpu, unsigned long long budget) {
+	if (!cpu->jit && !(cpu->jit = jit_create())) {
+		cpu->jit_failed = true;
+		return 0;
+	}
+	struct jit *jit = cpu->jit;
+	uint16_t address = cpu->reg.pc - 1;
+	if (!cpu->read_page[address >> 8])
+		return 0;
+	struct page *page = bind(jit, cpu, address >> 8);
+	if (!page)
+		return 0;
+	struct block *block = &page->block[address & 0xFF];
+	if (block->code == NOT_TRANSLATED)
+		return block->length ? 1 - block->length : 0;
+	if (block->code && page->writable && memcmp(page->memory + (address & 0xFF), page->snapshot + (address & 0xFF), block->length)) {
+		block->code = 0;
+		block->heat = 0;
+	}
+	if (!block->code) {
+		if (++block->heat < HOT)
+			return 0;
+		block = translate(jit, cpu, address);
+		if (!block || block->code <= 0)
+			return 0;
+	}
+	if (block->cycles > budget)
+		return 0;
+	int cycles = ((block_code) (jit->code + block->code))(cpu, budget < INT_MAX ? budget : INT_MAX);
+	if (!cycles) // it left before its first instruction, whose opcode is fetched already
+		cpu->reg.pc = address + 1;
+	return cycles;
+}
+
+#else
+
+// other hosts run the fast core
+int jit_execute(struct cpu *cpu, unsigned long long budget) {
+	(void) budget;
+	cpu->jit_failed = true;
+	return 0;
+}
+
+void jit_destroy(struct jit *jit) {
+	(void) jit;
+}
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef HEADER_JIT
+#define HEADER_JIT
+
+struct cpu;
+struct jit;
+
+int jit_execute(struct cpu *cpu, unsigned long long budget);
+void jit_destroy(struct jit *jit);
+
+#endif
@@ -0,0 +1,100 @@
+#define _POSIX_C_SOURCE 200809L // clock_gettime
+
+#include <time.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "latency.h"
+
+/*
+ * Input-to-photon measurement, one key event at a time: the window timestamps the
+ * key event, the emulation thread the first $4016 latch that sees the new buttons
+ * and the publication of the frame emulated meanwhile, and the window the
+ * SDL_RenderPresent that shows it. Each stage hands over to the next thread with a
+ * release store, which also publishes the timestamps written before it.
+ */
+#define MAX_SAMPLES 4096
+
+enum { IDLE, KEY, LATCHED, PUBLISHED };
+static atomic_int stage = IDLE;
+static bool enabled = false;
+
+static int64_t key_ns;
+static int64_t latch_ns;
+
+static int32_t key_to_latch[MAX_SAMPLES]; // us
+static int32_t latch_to_present[MAX_SAMPLES];
+static int32_t key_to_present[MAX_SAMPLES];
+static int samples = 0;
+
+static int64_t now_ns(void) {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec * 1000000000LL + time.tv_nsec;
+}
+
+void latency_enable(void) {
+	enabled = true;
+}
+
+// a key that the game has not latched yet is replaced by the newer one
+void latency_key(void) {
+	if (!enabled)
+		return;
+	int current = atomic_load_explicit(&stage, memory_order_acquire);
+	if (current != IDLE && current != KEY)
+		return;
+	key_ns = now_ns();
+	atomic_store_explicit(&stage, KEY, memory_order_release);
+}
+
+void latency_latch(void) {
+	if (atomic_load_explicit(&stage, memory_order_acquire) != KEY)
+		return;
+	latch_ns = now_ns();
+	atomic_store_explicit(&stage, LATCHED, memory_order_release);
+}
+
+void latency_published(void) {
+	int latched = LATCHED;
+	atomic_compare_exchange_strong_explicit(&stage, &latched, PUBLISHED, memory_order_acq_rel, memory_order_relaxed);
+}
+
+void latency_presented(void) {
+	if (atomic_load_explicit(&stage, memory_order_acquire) != PUBLISHED)
+		return;
+	int64_t present_ns = now_ns();
+	if (samples < MAX_SAMPLES) {
+		key_to_latch[samples] = (latch_ns - key_ns) / 1000;
+		latch_to_present[samples] = (present_ns - latch_ns) / 1000;
+		key_to_present[samples] = (present_ns - key_ns) / 1000;
+		samples++;
+	}
+	atomic_store_explicit(&stage, IDLE, memory_order_release);
+}
+
+static int compare_samples(void const *a, void const *b) {
+	return *(int32_t const *) a - *(int32_t const *) b;
+}
+
+static void print_distribution(char const *name, int32_t *values) {
+	qsort(values, samples, sizeof(int32_t), compare_samples);
+	printf("  %-16s min %6.2f  median %6.2f  p90 %6.2f  p99 %6.2f  max %6.2f ms\n", name,
+		values[0] / 1000.0, values[samples / 2] / 1000.0, values[samples * 9 / 10] / 1000.0,
+		values[samples * 99 / 100] / 1000.0, values[samples - 1] / 1000.0);
+}
+
+void print_latency_report(void) {
+	if (!enabled)
+		return;
+	if (!samples) {
+		puts("Input latency: no key event reached the screen");
+		return;
+	}
+	printf("Input latency over %d key events:\n", samples);
+	print_distribution("key to latch", key_to_latch);
+	print_distribution("latch to present", latch_to_present);
+	print_distribution("key to present", key_to_present);
+}
@@ -0,0 +1,11 @@
+#ifndef HEADER_LATENCY
+#define HEADER_LATENCY
+
+void latency_enable(void);
+void latency_key(void);
+void latency_latch(void);
+void latency_published(void);
+void latency_presented(void);
+void print_latency_report(void);
+
+#endif
@@ -0,0 +1,315 @@
+#define _XOPEN_SOURCE 700 // nftw, getline, mmap
+
+#include <ftw.h>
+#include <time.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "loader.h"
+#include "hash.h"
+
+/*
+ * Scans a directory tree for iNES files and keeps an index of them, one line per file,
+ * sorted by SHA-1. The directory walk is cheap and stays on the main thread; hashing
+ * is spread over worker threads that pick the next file with an atomic counter, each
+ * writing only its own entries. Files whose path, size and modification time match the
+ * previous index are not read again. The hashes cover PRG and CHR ROM, without the
+ * header and the trainer, so that a fixed header does not change the identity of a ROM.
+ */
+
+#define INDEX_HEADER "#sha1\tcrc32\tsize\tmtime\tmapper\tsubmapper\tprg\tchr\tchr_ram\tmirroring\tbattery\tnes2\tcorrections\tpath"
+
+typedef struct {
+	char *path;
+	long long size;
+	long long mtime;
+	uint8_t sha1[20];
+	uint32_t crc32;
+	struct cartridge cartridge;
+	int corrections;
+	bool hashed; // valid hashes, from this scan or from the previous index
+} entry;
+
+static struct {
+	entry *entries;
+	int count;
+	int capacity;
+} previous, library;
+
+static atomic_int next_entry;
+static atomic_int errors;
+
+static entry *add_entry(void) {
+	if (library.count == library.capacity) {
+		library.capacity = library.capacity ? library.capacity * 2 : 1024;
+		library.entries = realloc(library.entries, library.capacity * sizeof(entry));
+		if (!library.entries) {
+			puts("Error on memory allocation!");
+			exit(EXIT_FAILURE);
+		}
+	}
+	entry *e = &library.entries[library.count++];
+	memset(e, 0, sizeof(*e));
+	return e;
+}
+
+static int compare_paths(void const *a, void const *b) {
+	return strcmp(((entry const *) a)->path, ((entry const *) b)->path);
+}
+
+static int compare_hashes(void const *a, void const *b) {
+	int order = memcmp(((entry const *) a)->sha1, ((entry const *) b)->sha1, 20);
+	return order ? order : compare_paths(a, b);
+}
+
+/******************************************************** Index *********************************************************/
+static bool parse_sha1(char const *text, uint8_t sha1[20]) {
+	if (strlen(text) != 40)
+		return false;
+	for (int i = 0; i < 20; i++) {
+		unsigned byte;
+		if (sscanf(text + i * 2, "%2x", &byte) != 1)
+			return false;
+		sha1[i] = byte;
+	}
+	return true;
+}
+
+// a missing index is an empty one; broken lines are dropped, those files are hashed again
+static void read_index(char const *file_name) {
+	FILE *file = fopen(file_name, "r");
+	if (!file)
+		return;
+
+	char *line = NULL;
+	size_t line_size = 0;
+	ssize_t length;
+	while ((length = getline(&line, &line_size, file)) > 0) {
+		if (line[0] == '#')
+			continue;
+		if (line[length - 1] == '\n')
+			line[--length] = '\0';
+
+		char *field[14];
+		int fields = 0;
+		for (char *next = line; next && fields < 14; fields++) {
+			field[fields] = next;
+			if ((next = strchr(next, '\t')))
+				*next++ = '\0';
+		}
+		if (fields != 14)
+			continue;
+
+		entry e = { 0 };
+		unsigned crc32;
+		int mirroring, chr_ram, battery, nes2;
+		if (!parse_sha1(field[0], e.sha1)
+			|| sscanf(field[1], "%x", &crc32) != 1
+			|| sscanf(field[2], "%lld", &e.size) != 1
+			|| sscanf(field[3], "%lld", &e.mtime) != 1
+			|| sscanf(field[4], "%d", &e.cartridge.mapper) != 1
+			|| sscanf(field[5], "%d", &e.cartridge.submapper) != 1
+			|| sscanf(field[6], "%zu", &e.cartridge.prg_size) != 1
+			|| sscanf(field[7], "%zu", &e.cartridge.chr_size) != 1
+			|| sscanf(field[8], "%d", &chr_ram) != 1
+			|| sscanf(field[9], "%d", &mirroring) != 1
+			|| sscanf(field[10], "%d", &battery) != 1
+			|| sscanf(field[11], "%d", &nes2) != 1
+			|| sscanf(field[12], "%x", &e.corrections) != 1)
+			continue;
+		e.crc32 = crc32;
+		e.cartridge.mirroring = mirroring;
+		e.cartridge.chr_ram = chr_ram;
+		e.cartridge.battery = battery;
+		e.cartridge.nes2 = nes2;
+		e.path = strdup(field[13]);
+		e.hashed = true;
+
+		if (previous.count == previous.capacity) {
+			previous.capacity = previous.capacity ? previous.capacity * 2 : 1024;
+			previous.entries = realloc(previous.entries, previous.capacity * sizeof(entry));
+			if (!previous.entries) {
+				puts("Error on memory allocation!");
+				exit(EXIT_FAILURE);
+			}
+		}
+		previous.entries[previous.count++] = e;
+	}
+	free(line);
+	fclose(file);
+	qsort(previous.entries, previous.count, sizeof(entry), compare_paths);
+}
+
+// written next to the index, then renamed over it, so an interrupted scan leaves the old index intact
+static bool write_index(char const *file_name) {
+	size_t name_length = strlen(file_name);
+	char temporary_name[name_length + 5];
+	snprintf(temporary_name, sizeof(temporary_name), "%s.new", file_name);
+	FILE *file = fopen(temporary_name, "w");
+	if (!file) {
+		printf("Could not write %s\n", temporary_name);
+		return false;
+	}
+
+	qsort(library.entries, library.count, sizeof(entry), compare_hashes);
+	fprintf(file, "%s\n", INDEX_HEADER);
+	for (int i = 0; i < library.count; i++) {
+		entry const *e = &library.entries[i];
+		if (!e->hashed)
+			continue;
+		for (int j = 0; j < 20; j++)
+			fprintf(file, "%02x", e->sha1[j]);
+		fprintf(file, "\t%08x\t%lld\t%lld\t%d\t%d\t%zu\t%zu\t%d\t%d\t%d\t%d\t%x\t%s\n",
+			e->crc32, e->size, e->mtime, e->cartridge.mapper, e->cartridge.submapper,
+			e->cartridge.prg_size, e->cartridge.chr_size, e->cartridge.chr_ram, e->cartridge.mirroring,
+			e->cartridge.battery, e->cartridge.nes2, e->corrections, e->path);
+	}
+	if (fclose(file) != 0 || rename(temporary_name, file_name) != 0) {
+		printf("Could not write %s\n", file_name);
+		remove(temporary_name);
+		return false;
+	}
+	return true;
+}
+
+/***************************************************** Directory walk ***************************************************/
+static bool is_rom(char const *path) {
+	size_t length = strlen(path);
+	if (length < 4 || path[length - 4] != '.')
+		return false;
+	return tolower(path[length - 3]) == 'n' && tolower(path[length - 2]) == 'e' && tolower(path[length - 1]) == 's';
+}
+
+static int visit(char const *path, struct stat const *status, int type, struct FTW *position) {
+	(void) position;
+	if (type != FTW_F || !is_rom(path) || strchr(path, '\t') || strchr(path, '\n'))
+		return 0;
+
+	entry *e = add_entry();
+	e->path = strdup(path);
+	e->size = status->st_size;
+	e->mtime = status->st_mtime;
+
+	entry key = { .path = (char *) path };
+	entry const *known = bsearch(&key, previous.entries, previous.count, sizeof(entry), compare_paths);
+	if (known && known->size == e->size && known->mtime == e->mtime) {
+		char *own_path = e->path;
+		*e = *known;
+		e->path = own_path;
+	}
+	return 0;
+}
+
+/******************************************************** Hashing *******************************************************/
+static bool hash_file(entry *e) {
+	int fd = open(e->path, O_RDONLY);
+	if (fd < 0) {
+		printf("<%s> Error opening ROM file! %s\n", e->path, strerror(errno));
+		return false;
+	}
+	if (e->size < 16) {
+		printf("<%s> File too small for an iNES header!\n", e->path);
+		close(fd);
+		return false;
+	}
+	uint8_t *image = mmap(NULL, e->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (image == MAP_FAILED) {
+		printf("<%s> Error mapping the ROM file! %s\n", e->path, strerror(errno));
+		return false;
+	}
+
+	char const *error = parse_header(image, &e->cartridge, &e->corrections);
+	if (!error) {
+		size_t offset = (image[6] & 0x04) ? 16 + 512 : 16;
+		size_t rom_length = e->cartridge.prg_size + (e->cartridge.chr_ram ? 0 : e->cartridge.chr_size);
+		if ((size_t) e->size < offset + rom_length)
+			error = "Truncated ROM";
+		else {
+			e->crc32 = calculate_crc32(image + offset, rom_length);
+			calculate_sha1(image + offset, rom_length, e->sha1);
+			e->hashed = true;
+		}
+	}
+	munmap(image, e->size);
+	if (error)
+		printf("<%s> %s!\n", e->path, error);
+	return !error;
+}
+
+static void *hash_files(void *unused) {
+	(void) unused;
+	for (int i; (i = atomic_fetch_add(&next_entry, 1)) < library.count;)
+		if (!library.entries[i].hashed && !hash_file(&library.entries[i]))
+			atomic_fetch_add(&errors, 1);
+	return NULL;
+}
+
+int main(int argc, char *argv[]) {
+	char const *directory = NULL;
+	char const *index_name = NULL;
+	long threads = sysconf(_SC_NPROCESSORS_ONLN);
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--index") && i + 1 < argc)
+			index_name = argv[++i];
+		else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+			threads = strtol(argv[++i], NULL, 10);
+		else if (argv[i][0] != '-' && !directory)
+			directory = argv[i];
+		else {
+			directory = NULL;
+			break;
+		}
+	}
+	if (!directory || threads < 1) {
+		puts("Usage: funestus-library DIRECTORY [--index FILE] [--threads N]");
+		return EXIT_FAILURE;
+	}
+	char default_index[strlen(directory) + 16];
+	if (!index_name) {
+		snprintf(default_index, sizeof(default_index), "%s/funestus.index", directory);
+		index_name = default_index;
+	}
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	read_index(index_name);
+	if (nftw(directory, visit, 64, FTW_PHYS) != 0) {
+		printf("Could not scan %s\n", directory);
+		return EXIT_FAILURE;
+	}
+	int reused = 0;
+	for (int i = 0; i < library.count; i++)
+		reused += library.entries[i].hashed;
+
+	crc32_implementation_name(); // picks the implementation before the threads share it
+	if (threads > library.count - reused)
+		threads = library.count - reused > 0 ? library.count - reused : 1;
+	pthread_t workers[threads];
+	for (long i = 1; i < threads; i++)
+		if (pthread_create(&workers[i], NULL, hash_files, NULL) != 0) {
+			puts("Could not start a worker thread!");
+			return EXIT_FAILURE;
+		}
+	hash_files(NULL);
+	for (long i = 1; i < threads; i++)
+		pthread_join(workers[i], NULL);
+
+	if (!write_index(index_name))
+		return EXIT_FAILURE;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	printf("%d ROMs: %d hashed (CRC32 %s, %ld threads), %d from the index, %d errors in %.3f s\n",
+		library.count, library.count - reused - atomic_load(&errors), crc32_implementation_name(), threads, reused, atomic_load(&errors),
+		(end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+	return EXIT_SUCCESS;
+}
@@ -1,104 +1,101 @@
+#define _POSIX_C_SOURCE 200809L // fstat, mmap
+
 #include <stdio.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
-
-uint8_t *prg;
-uint8_t *chr;
-
-// basic crc32 calculation with inverted polynomial and without lookup table
-static uint32_t calculate_crc32(uint8_t const *data, size_t length) {
-	uint32_t crc = 0xFFFFFFFF;
-
-	for (size_t i = 0; i < length; i++) {
-		crc ^= data[i];
-
-		for (int i = 0; i < 8; i++) {
-			if (crc & 1)
-				crc = ((crc >> 1) ^ 0xEDB88320);
-			else
-				crc >>= 1;
-		}
-	}
-	return ~crc;
+#include "loader.h"
+#include "mapper.h"
+#include "hash.h"
+#include "interleave.h"
+
+static bool abort_loading(char const *file_name, char const *msg, int fd) {
+	printf("<%s> %s!%s%s\n", file_name, msg, errno ? " " : "", errno ? strerror(errno) : "");
+	if (fd >= 0)
+		close(fd);
+	return false;
 }
 
-static uint8_t *read_file_chunk(char const *filename, long offset, long requested_length) {
-	FILE *file_stream;
-
-	// GCC nested function
-	uint8_t *abort_reading(char const *msg) {
-		fprintf(stdout, "<%s> %s! %s", filename, msg, errno ? strerror(errno) : "\n");
-		if (file_stream)
-			fclose(file_stream);
-		return NULL;
+// maps the file once; PRG and CHR are then views into the mapping instead of copies
+static bool map_file(char const *file_name, struct rom *rom) {
+	errno = 0;
+	int fd = open(file_name, O_RDONLY);
+	if (fd < 0)
+		return abort_loading(file_name, "Error opening ROM file", fd);
+
+	struct stat file_status;
+	if (fstat(fd, &file_status) != 0)
+		return abort_loading(file_name, "Error while obtaining the file size", fd);
+	if (file_status.st_size < 16)
+		return abort_loading(file_name, "File too small for an iNES header", fd);
+
+	rom->image_size = file_status.st_size;
+	rom->image = mmap(NULL, rom->image_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (rom->image == MAP_FAILED) {
+		rom->image = NULL;
+		return abort_loading(file_name, "Error mapping the ROM file", fd);
 	}
-
-	file_stream = fopen(filename, "rb");
-	if (file_stream == NULL)
-		return abort_reading("Error opening ROM file");
-
-	int file_seek = fseek(file_stream, 0, SEEK_END);
-	if (file_seek != 0)
-		return abort_reading("Error while seeking in file stream");
-
-	long reported_length = ftell(file_stream);
-	if (reported_length == -1L)
-		return abort_reading("Error while obtaining file position indicator");
-
-	if (reported_length < requested_length + offset)
-		return abort_reading("Unexpected file size");
-
-	file_seek = fseek(file_stream, offset, SEEK_SET);
-	if (file_seek != 0)
-		return abort_reading("Error while seeking in file stream");
-
-	uint8_t *read_data = malloc(requested_length);
-	if (read_data == NULL)
-		return abort_reading("Error on memory allocation");
-
-	size_t read_length = fread(read_data, 1, requested_length, file_stream);
-	if (read_length - requested_length != 0) {
-		free(read_data);
-		return abort_reading("Unexpected amount of data read");
-	}
-
-	fclose(file_stream);
-	return read_data;
+	close(fd);
+	return true;
 }
 
-static void unload_rom() {
-	if (prg)
-		free(prg);
-	if (chr)
-		free(chr);
-	printf("ROM unloaded\n");
+void unload_rom(struct rom *rom) {
+	if (rom->image)
+		munmap(rom->image, rom->image_size);
+	free(rom->decoded_chr);
+	memset(rom, 0, sizeof(*rom));
 }
 
-bool load_rom(char const *file_name) {
-	uint8_t *header = read_file_chunk(file_name, 0, 16);
-	if (!header)
+// on failure, whatever was already loaded is released again
+bool load_rom(char const *file_name, struct rom *rom) {
+	memset(rom, 0, sizeof(*rom));
+	if (!map_file(file_name, rom))
 		return false;
-	free(header); // for now, just discard the header
-
-	atexit(unload_rom);
-
-	prg = read_file_chunk(file_name, 16, 16384); // 16k == 0x4000
-	if (!prg)
+	struct cartridge *cartridge = &rom->cartridge;
+	char const *error = parse_header(rom->image, cartridge, NULL);
+	if (error) {
+		printf("<%s> %s!\n", file_name, error);
+		unload_rom(rom);
 		return false;
+	}
+	if (!mapper_name(cartridge->mapper)) {
+		printf("Mapper %d is not supported\n", cartridge->mapper);
+		unload_rom(rom);
+		return false;
+	}
 
-	chr = read_file_chunk(file_name, 16 + 16384, 8192); // 8k == 0x2000
-	if (!chr)
+	size_t offset = (rom->image[6] & 0x04) ? 16 + 512 : 16; // the trainer is not used
+	size_t rom_length = cartridge->prg_size + (cartridge->chr_ram ? 0 : cartridge->chr_size);
+	if (rom->image_size < offset + rom_length) {
+		printf("<%s> Truncated ROM! The header announces %zu bytes, the file holds %zu\n",
+			file_name, offset + rom_length, rom->image_size);
+		unload_rom(rom);
 		return false;
+	}
 
-	uint8_t *full_rom = read_file_chunk(file_name, 16, 24576); // 24k == 0x6000
-	if (full_rom) {
-		printf("ROM CRC32: %08X\n", calculate_crc32(full_rom, 24576));
-		free(full_rom);
+	// PRG is never mapped writable (see mapper.c), so the read-only mapping is safe to hand out
+	rom->prg = rom->image + offset;
+	if (!cartridge->chr_ram) {
+		rom->chr = rom->image + offset + cartridge->prg_size;
+		rom->decoded_chr = malloc(cartridge->chr_size / 16 * sizeof(*rom->decoded_chr));
+		if (!rom->decoded_chr) {
+			abort_loading(file_name, "Error on memory allocation", -1);
+			unload_rom(rom);
+			return false;
+		}
+		decode_tiles(rom->chr, rom->decoded_chr, cartridge->chr_size / 16);
 	}
 
+	cartridge->crc32 = calculate_crc32(rom->prg, rom_length);
+	printf("ROM CRC32: %08X\n", cartridge->crc32);
+	printf("Mapper %d (%s), %zuk PRG, %zuk CHR %s\n", cartridge->mapper, mapper_name(cartridge->mapper),
+		cartridge->prg_size >> 10, cartridge->chr_size >> 10, cartridge->chr_ram ? "RAM" : "ROM");
+
 	return true;
 }
-
@@ -1,10 +1,51 @@
 #ifndef HEADER_LOADER
 #define HEADER_LOADER
 
-extern uint8_t *prg; // program code
-extern uint8_t *chr; // pattern tables
+#define MAX_PRG_SIZE 0x80000 // 512k
+#define MAX_CHR_SIZE 0x40000 // 256k
 
-bool load_rom(char const *file_name);
+// nametable arrangement, when it is not up to the mapper
+typedef enum {
+	MIRROR_HORIZONTAL, // $2000 = $2400, $2800 = $2C00 (vertical scrolling)
+	MIRROR_VERTICAL, // $2000 = $2800, $2400 = $2C00 (horizontal scrolling)
+	MIRROR_SINGLE_LOW,
+	MIRROR_SINGLE_HIGH,
+	MIRROR_FOUR_SCREEN
+} mirroring;
 
-#endif
+// what the iNES/NES 2.0 header tells about the cartridge
+struct cartridge {
+	size_t prg_size; // bytes
+	size_t chr_size; // bytes, of ROM or of RAM
+	size_t prg_ram_size; // bytes at $6000-$7FFF
+	int mapper;
+	int submapper;
+	mirroring mirroring;
+	bool chr_ram; // pattern tables are writable
+	bool battery;
+	bool nes2;
+	uint32_t crc32; // of PRG and CHR ROM, set by load_rom
+};
+
+// header fields that were guessed rather than read, see parse_header
+enum {
+	CORRECTED_DISKDUDE = 0x01, // garbage in bytes 7-15, the high mapper nibble is dropped
+	CORRECTED_CHR_RAM = 0x02, // no CHR ROM, 8k of CHR RAM assumed
+	CORRECTED_PRG_RAM = 0x04 // iNES PRG RAM size of 0, 8k assumed
+};
+
+// a ROM file, shared read-only by every console running it
+struct rom {
+	struct cartridge cartridge;
+	uint8_t *prg; // program code
+	uint8_t *chr; // pattern tables, NULL with CHR RAM (every console has its own)
+	uint8_t (*decoded_chr)[8][8]; // CHR ROM decoded once for all consoles (see ppu.h)
+	uint8_t *image; // the whole file, mapped read-only
+	size_t image_size;
+};
 
+char const *parse_header(uint8_t const header[16], struct cartridge *cartridge, int *corrections);
+bool load_rom(char const *file_name, struct rom *rom);
+void unload_rom(struct rom *rom);
+
+#endif
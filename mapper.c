@@ -0,0 +1,307 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "loader.h"
+#include "cpu.h"
+#include "ppu.h"
+#include "mapper.h"
+#include "controller.h"
+#include "apu.h"
+#include "console.h"
+#include "state.h"
+
+/*
+ * Mappers switch banks by pointing CPU pages (cpu_map_memory) and PPU pattern table
+ * windows (ppu_map_chr) at other parts of PRG and CHR; nothing is copied, and
+ * accesses cost the same whatever the mapping. Register writes first bring the PPU
+ * up to date, so that a switch in the middle of a frame shows up at the right dot.
+ * The banks are always derived from the registers (update), so that restoring the
+ * registers of a saved state restores the mapping.
+ */
+typedef struct mapper_type {
+	int number;
+	char const *name;
+	void (*power_up)(console *nes); // registers that do not start at zero
+	void (*update)(console *nes); // maps the banks the registers select
+	write_handler write; // $8000-$FFFF
+	void (*scanline)(console *nes); // clocked by the PPU once per rendered scanline
+} mapper_type;
+
+// maps the PRG bank of the given size (8k, 16k or 32k) at first_page, counting from the last bank when negative
+static void map_prg(console *nes, uint8_t first_page, size_t size, int bank) {
+	int banks = nes->cartridge.prg_size >= size ? nes->cartridge.prg_size / size : 1;
+	bank = (bank % banks + banks) % banks;
+	cpu_map_memory(&nes->cpu, first_page, size >> 8, nes->prg + bank * size, false);
+}
+
+// maps the CHR bank of the given size (1k, 2k, 4k or 8k) at the given 1k window of the pattern tables
+static void map_chr(console *nes, int window, size_t size, int bank) {
+	int banks = nes->cartridge.chr_size >= size ? nes->cartridge.chr_size / size : 1;
+	ppu_map_chr(&nes->ppu, window, size >> 10, (size_t) (bank % banks) * size);
+}
+
+/********************************************************* NROM ************************************************************/
+// 16k of PRG mirrored or 32k, 8k of CHR
+static void nrom_update(console *nes) {
+	map_prg(nes, 0x80, 0x4000, 0);
+	map_prg(nes, 0xC0, 0x4000, -1);
+	map_chr(nes, 0, 0x2000, 0);
+}
+
+/********************************************************* UxROM ***********************************************************/
+// 16k PRG bank switched at $8000, last bank fixed at $C000
+static void uxrom_update(console *nes) {
+	map_prg(nes, 0x80, 0x4000, nes->mapper.latch);
+	map_prg(nes, 0xC0, 0x4000, -1);
+	map_chr(nes, 0, 0x2000, 0);
+}
+
+static void uxrom_write(console *nes, uint16_t address, uint8_t data) {
+	(void) address;
+	nes->mapper.latch = data;
+	map_prg(nes, 0x80, 0x4000, nes->mapper.latch);
+}
+
+/********************************************************* CNROM ***********************************************************/
+// 8k CHR bank switched
+static void cnrom_update(console *nes) {
+	map_prg(nes, 0x80, 0x4000, 0);
+	map_prg(nes, 0xC0, 0x4000, -1);
+	map_chr(nes, 0, 0x2000, nes->mapper.latch);
+}
+
+static void cnrom_write(console *nes, uint16_t address, uint8_t data) {
+	(void) address;
+	nes->mapper.latch = data;
+	map_chr(nes, 0, 0x2000, nes->mapper.latch);
+}
+
+/********************************************************* MMC1 ************************************************************/
+static void mmc1_update(console *nes) {
+	static mirroring const arrangement[4] = { MIRROR_SINGLE_LOW, MIRROR_SINGLE_HIGH, MIRROR_VERTICAL, MIRROR_HORIZONTAL };
+	ppu_set_mirroring(&nes->ppu, arrangement[nes->mapper.mmc1.control & 0x03]);
+
+	// 512k boards (SUROM) select the 256k half with bit 4 of the CHR bank
+	int outer = nes->cartridge.prg_size > 0x40000 ? nes->mapper.mmc1.chr_bank[0] & 0x10 : 0;
+	int bank = outer | (nes->mapper.mmc1.prg_bank & 0x0F);
+	switch (nes->mapper.mmc1.control >> 2 & 0x03) {
+	case 0:
+	case 1: // 32k
+		map_prg(nes, 0x80, 0x4000, bank & ~1);
+		map_prg(nes, 0xC0, 0x4000, bank | 1);
+		break;
+	case 2: // first bank fixed at $8000
+		map_prg(nes, 0x80, 0x4000, outer);
+		map_prg(nes, 0xC0, 0x4000, bank);
+		break;
+	case 3: // last bank fixed at $C000
+		map_prg(nes, 0x80, 0x4000, bank);
+		map_prg(nes, 0xC0, 0x4000, outer | 0x0F);
+		break;
+	}
+
+	if (nes->mapper.mmc1.control & 0x10) { // two 4k banks
+		map_chr(nes, 0, 0x1000, nes->mapper.mmc1.chr_bank[0]);
+		map_chr(nes, 4, 0x1000, nes->mapper.mmc1.chr_bank[1]);
+	} else { // one 8k bank
+		map_chr(nes, 0, 0x1000, nes->mapper.mmc1.chr_bank[0] & ~1);
+		map_chr(nes, 4, 0x1000, nes->mapper.mmc1.chr_bank[0] | 1);
+	}
+}
+
+static void mmc1_power_up(console *nes) {
+	nes->mapper.mmc1.control = 0x0C;
+}
+
+// registers are loaded serially; writes in consecutive cycles (read-modify-write instructions) only count once
+static void mmc1_write(console *nes, uint16_t address, uint8_t data) {
+	unsigned long long cycle = cpu_cycles(&nes->cpu);
+	bool consecutive = cycle == nes->mapper.mmc1.last_write + 1;
+	nes->mapper.mmc1.last_write = cycle;
+
+	if (data & 0x80) {
+		nes->mapper.mmc1.shift = nes->mapper.mmc1.shift_count = 0;
+		nes->mapper.mmc1.control |= 0x0C;
+		mmc1_update(nes);
+		return;
+	}
+	if (consecutive)
+		return;
+	nes->mapper.mmc1.shift |= (data & 0x01) << nes->mapper.mmc1.shift_count;
+	if (++nes->mapper.mmc1.shift_count < 5)
+		return;
+
+	switch (address >> 13 & 0x03) {
+	case 0: nes->mapper.mmc1.control = nes->mapper.mmc1.shift; break;
+	case 1: nes->mapper.mmc1.chr_bank[0] = nes->mapper.mmc1.shift; break;
+	case 2: nes->mapper.mmc1.chr_bank[1] = nes->mapper.mmc1.shift; break;
+	case 3: nes->mapper.mmc1.prg_bank = nes->mapper.mmc1.shift; break;
+	}
+	nes->mapper.mmc1.shift = nes->mapper.mmc1.shift_count = 0;
+	mmc1_update(nes);
+}
+
+/********************************************************* MMC3 ************************************************************/
+static void mmc3_update(console *nes) {
+	// R6 goes either to $8000 or to $C000, where the second to last bank is otherwise
+	bool prg_swap = nes->mapper.mmc3.bank_select & 0x40;
+	map_prg(nes, prg_swap ? 0xC0 : 0x80, 0x2000, nes->mapper.mmc3.bank[6]);
+	map_prg(nes, 0xA0, 0x2000, nes->mapper.mmc3.bank[7]);
+	map_prg(nes, prg_swap ? 0x80 : 0xC0, 0x2000, -2);
+	map_prg(nes, 0xE0, 0x2000, -1);
+
+	// two 2k banks and four 1k banks, the 2k ones either in the first or in the second pattern table
+	int inversion = (nes->mapper.mmc3.bank_select & 0x80) ? 4 : 0;
+	map_chr(nes, 0 ^ inversion, 0x0800, nes->mapper.mmc3.bank[0] >> 1);
+	map_chr(nes, 2 ^ inversion, 0x0800, nes->mapper.mmc3.bank[1] >> 1);
+	for (int i = 0; i < 4; i++)
+		map_chr(nes, (4 + i) ^ inversion, 0x0400, nes->mapper.mmc3.bank[2 + i]);
+}
+
+static void mmc3_power_up(console *nes) {
+	nes->mapper.mmc3.bank[1] = 2; // a sensible layout until the game sets its own
+	nes->mapper.mmc3.bank[3] = 1;
+	nes->mapper.mmc3.bank[4] = 2;
+	nes->mapper.mmc3.bank[5] = 3;
+	nes->mapper.mmc3.bank[7] = 1;
+}
+
+static void mmc3_write(console *nes, uint16_t address, uint8_t data) {
+	switch (address & 0xE001) {
+	case 0x8000:
+		nes->mapper.mmc3.bank_select = data;
+		mmc3_update(nes);
+		break;
+	case 0x8001:
+		nes->mapper.mmc3.bank[nes->mapper.mmc3.bank_select & 0x07] = data;
+		mmc3_update(nes);
+		break;
+	case 0xA000:
+		if (nes->cartridge.mirroring != MIRROR_FOUR_SCREEN)
+			ppu_set_mirroring(&nes->ppu, (data & 0x01) ? MIRROR_HORIZONTAL : MIRROR_VERTICAL);
+		break;
+	case 0xA001: // PRG RAM protection, not emulated
+		break;
+	case 0xC000:
+		nes->mapper.mmc3.irq_latch = data;
+		break;
+	case 0xC001:
+		nes->mapper.mmc3.irq_counter = 0;
+		nes->mapper.mmc3.irq_reload = true;
+		break;
+	case 0xE000:
+		nes->mapper.mmc3.irq_enabled = false;
+		cpu_irq(&nes->cpu, IRQ_MAPPER, false);
+		break;
+	case 0xE001:
+		nes->mapper.mmc3.irq_enabled = true;
+		break;
+	}
+}
+
+// the counter is clocked by the rise of PPU A12, once per scanline while rendering
+static void mmc3_scanline(console *nes) {
+	if (!nes->mapper.mmc3.irq_counter || nes->mapper.mmc3.irq_reload) {
+		nes->mapper.mmc3.irq_counter = nes->mapper.mmc3.irq_latch;
+		nes->mapper.mmc3.irq_reload = false;
+	} else {
+		nes->mapper.mmc3.irq_counter--;
+	}
+	if (!nes->mapper.mmc3.irq_counter && nes->mapper.mmc3.irq_enabled)
+		cpu_irq(&nes->cpu, IRQ_MAPPER, true);
+}
+
+/***************************************************************************************************************************/
+static mapper_type const mappers[] = {
+	{ 0, "NROM", NULL, nrom_update, NULL, NULL },
+	{ 1, "MMC1", mmc1_power_up, mmc1_update, mmc1_write, NULL },
+	{ 2, "UxROM", NULL, uxrom_update, uxrom_write, NULL },
+	{ 3, "CNROM", NULL, cnrom_update, cnrom_write, NULL },
+	{ 4, "MMC3", mmc3_power_up, mmc3_update, mmc3_write, mmc3_scanline }
+};
+
+static mapper_type const *find_mapper(int number) {
+	for (size_t i = 0; i < sizeof(mappers) / sizeof(mappers[0]); i++)
+		if (mappers[i].number == number)
+			return &mappers[i];
+	return NULL;
+}
+
+char const *mapper_name(int number) {
+	mapper_type const *found = find_mapper(number);
+	return found ? found->name : NULL;
+}
+
+static void write_register(console *nes, uint16_t address, uint8_t data) {
+	cpu_sync_ppu(&nes->cpu);
+	nes->mapper.type->write(nes, address, data);
+}
+
+static void map_cartridge(console *nes) {
+	if (nes->cartridge.prg_ram_size)
+		cpu_map_memory(&nes->cpu, 0x60, 0x20, nes->mapper.prg_ram, true);
+	nes->mapper.type->update(nes);
+	if (nes->mapper.type->write)
+		cpu_map_io(&nes->cpu, 0x80, 0x80, NULL, write_register);
+}
+
+// maps the loaded cartridge into the CPU and PPU address spaces, after both have been powered up
+void mapper_power_up(console *nes) {
+	nes->mapper.type = find_mapper(nes->cartridge.mapper);
+	if (!nes->mapper.type)
+		nes->mapper.type = &mappers[0];
+
+	ppu_set_mirroring(&nes->ppu, nes->cartridge.mirroring);
+	memset(nes->mapper.prg_ram, 0, sizeof(nes->mapper.prg_ram));
+	nes->mapper.latch = 0;
+	memset(&nes->mapper.mmc1, 0, sizeof(nes->mapper.mmc1));
+	memset(&nes->mapper.mmc3, 0, sizeof(nes->mapper.mmc3));
+	if (nes->mapper.type->power_up)
+		nes->mapper.type->power_up(nes);
+	map_cartridge(nes);
+}
+
+void mapper_save_state(console const *nes, struct mapper_state *state) {
+	memcpy(state->prg_ram, nes->mapper.prg_ram, sizeof(nes->mapper.prg_ram));
+	state->mmc1_last_write = nes->mapper.mmc1.last_write;
+	state->latch = nes->mapper.latch;
+	state->mmc1_shift = nes->mapper.mmc1.shift;
+	state->mmc1_shift_count = nes->mapper.mmc1.shift_count;
+	state->mmc1_control = nes->mapper.mmc1.control;
+	memcpy(state->mmc1_chr_bank, nes->mapper.mmc1.chr_bank, sizeof(nes->mapper.mmc1.chr_bank));
+	state->mmc1_prg_bank = nes->mapper.mmc1.prg_bank;
+	state->mmc3_bank_select = nes->mapper.mmc3.bank_select;
+	memcpy(state->mmc3_bank, nes->mapper.mmc3.bank, sizeof(nes->mapper.mmc3.bank));
+	state->mmc3_irq_latch = nes->mapper.mmc3.irq_latch;
+	state->mmc3_irq_counter = nes->mapper.mmc3.irq_counter;
+	state->mmc3_irq_reload = nes->mapper.mmc3.irq_reload;
+	state->mmc3_irq_enabled = nes->mapper.mmc3.irq_enabled;
+}
+
+// after the CPU state, whose memory map only covers the console
+void mapper_load_state(console *nes, struct mapper_state const *state) {
+	memcpy(nes->mapper.prg_ram, state->prg_ram, sizeof(nes->mapper.prg_ram));
+	nes->mapper.mmc1.last_write = state->mmc1_last_write;
+	nes->mapper.latch = state->latch;
+	nes->mapper.mmc1.shift = state->mmc1_shift;
+	nes->mapper.mmc1.shift_count = state->mmc1_shift_count;
+	nes->mapper.mmc1.control = state->mmc1_control;
+	memcpy(nes->mapper.mmc1.chr_bank, state->mmc1_chr_bank, sizeof(nes->mapper.mmc1.chr_bank));
+	nes->mapper.mmc1.prg_bank = state->mmc1_prg_bank;
+	nes->mapper.mmc3.bank_select = state->mmc3_bank_select;
+	memcpy(nes->mapper.mmc3.bank, state->mmc3_bank, sizeof(nes->mapper.mmc3.bank));
+	nes->mapper.mmc3.irq_latch = state->mmc3_irq_latch;
+	nes->mapper.mmc3.irq_counter = state->mmc3_irq_counter;
+	nes->mapper.mmc3.irq_reload = state->mmc3_irq_reload;
+	nes->mapper.mmc3.irq_enabled = state->mmc3_irq_enabled;
+	map_cartridge(nes);
+}
+
+bool mapper_counts_scanlines(console const *nes) {
+	return nes->mapper.type && nes->mapper.type->scanline;
+}
+
+void mapper_clock_scanline(console *nes) {
+	nes->mapper.type->scanline(nes);
+}
@@ -0,0 +1,35 @@
+#ifndef HEADER_MAPPER
+#define HEADER_MAPPER
+
+struct console;
+
+struct mapper {
+	struct mapper_type const *type;
+	uint8_t prg_ram[0x2000]; // 8k at $6000-$7FFF
+	uint8_t latch; // the only register of discrete logic boards
+
+	struct {
+		uint8_t shift; // 5 bits, written one at a time
+		int shift_count;
+		uint8_t control;
+		uint8_t chr_bank[2];
+		uint8_t prg_bank;
+		unsigned long long last_write; // CPU cycle
+	} mmc1;
+
+	struct {
+		uint8_t bank_select;
+		uint8_t bank[8]; // R0-R7
+		uint8_t irq_latch;
+		uint8_t irq_counter;
+		bool irq_reload;
+		bool irq_enabled;
+	} mmc3;
+};
+
+char const *mapper_name(int number);
+void mapper_power_up(struct console *nes);
+bool mapper_counts_scanlines(struct console const *nes);
+void mapper_clock_scanline(struct console *nes);
+
+#endif
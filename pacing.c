@@ -0,0 +1,116 @@
+#define _POSIX_C_SOURCE 200809L // clock_nanosleep
+
+#include <time.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "pacing.h"
+
+/*
+ * Frame pacing for the emulation thread. Every frame has an absolute deadline,
+ * computed from the moment pacing (re)started and the frame index, so sleeping
+ * late once does not shift the following frames. The thread sleeps until shortly
+ * before the deadline and spins the rest of the way. The speed can be changed at
+ * any time from another thread: real time, N times faster, or uncapped.
+ */
+#define NTSC_FRAME_RATE 60.0988 // 21.477272 MHz / 4 / 341 / 262 (minus the skipped dot of odd frames)
+#define SPIN_NS 200000 // sleep until 0.2 ms before the deadline, the scheduler may wake us up late
+#define MAX_LATENESS_NS 100000000 // after falling 0.1 s behind, stop trying to catch up
+#define LATENESS_SAMPLES 8192
+
+static atomic_int fast_forward_speed = 10;
+static atomic_bool fast_forward = false;
+static atomic_bool uncapped = false;
+
+static int64_t start_ns; // when the current pace was set
+static int64_t paced_frames; // frames completed since start_ns
+static int current_speed; // 0: uncapped
+
+static int64_t lateness[LATENESS_SAMPLES]; // ns past the deadline of the last frames (ring)
+static long lateness_count = 0;
+
+void set_fast_forward_speed(int speed) {
+	atomic_store(&fast_forward_speed, speed > 1 ? speed : 2);
+}
+
+void set_fast_forward(bool enabled) {
+	atomic_store(&fast_forward, enabled);
+}
+
+void set_uncapped(bool enabled) {
+	atomic_store(&uncapped, enabled);
+}
+
+void toggle_uncapped(void) {
+	atomic_store(&uncapped, !atomic_load(&uncapped));
+}
+
+static int64_t now_ns(void) {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec * 1000000000LL + time.tv_nsec;
+}
+
+static void sleep_until(int64_t deadline_ns) {
+	int64_t wake_up_ns = deadline_ns - SPIN_NS;
+	struct timespec wake_up = { .tv_sec = wake_up_ns / 1000000000, .tv_nsec = wake_up_ns % 1000000000 };
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake_up, NULL) == EINTR)
+		; // interrupted by a signal, anything else leaves it to the spin
+	while (now_ns() < deadline_ns)
+		;
+}
+
+// called by the emulation thread whenever a frame is completed
+void pace_frame(void) {
+	int speed = atomic_load(&uncapped) ? 0 : atomic_load(&fast_forward) ? atomic_load(&fast_forward_speed) : 1;
+	int64_t now = now_ns();
+
+	if (speed != current_speed) {
+		current_speed = speed;
+		start_ns = now;
+		paced_frames = 0;
+	}
+	if (!speed)
+		return;
+
+	paced_frames++;
+	int64_t deadline = start_ns + (int64_t) (paced_frames * 1e9 / (NTSC_FRAME_RATE * speed));
+	if (now < deadline)
+		sleep_until(deadline);
+
+	int64_t late = now_ns() - deadline;
+	lateness[lateness_count++ % LATENESS_SAMPLES] = late;
+	if (late > MAX_LATENESS_NS) {
+		start_ns = now_ns();
+		paced_frames = 0;
+	}
+}
+
+// the last frame went at the speed of a real console
+bool paced_in_real_time(void) {
+	return current_speed == 1;
+}
+
+static int compare_lateness(void const *a, void const *b) {
+	int64_t x = *(int64_t const *) a, y = *(int64_t const *) b;
+	return (x > y) - (x < y);
+}
+
+void print_pacing_report(void) {
+	int count = lateness_count < LATENESS_SAMPLES ? lateness_count : LATENESS_SAMPLES;
+	if (!count)
+		return;
+	static int64_t sorted[LATENESS_SAMPLES];
+	int late_frames = 0;
+	for (int i = 0; i < count; i++) {
+		sorted[i] = lateness[i];
+		if (lateness[i] > 1000000)
+			late_frames++;
+	}
+	qsort(sorted, count, sizeof(sorted[0]), compare_lateness);
+	printf("Frame lateness over the last %d paced frames: min %.3f ms, median %.3f ms, p99 %.3f ms, max %.3f ms, %d more than 1 ms late\n",
+		count, sorted[0] / 1e6, sorted[count / 2] / 1e6, sorted[(count * 99 + 99) / 100 - 1] / 1e6, sorted[count - 1] / 1e6, late_frames);
+}
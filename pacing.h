@@ -0,0 +1,13 @@
+#ifndef HEADER_PACING
+#define HEADER_PACING
+
+void set_fast_forward_speed(int speed);
+void set_fast_forward(bool enabled);
+void set_uncapped(bool enabled);
+void toggle_uncapped(void);
+
+void pace_frame(void);
+bool paced_in_real_time(void);
+void print_pacing_report(void);
+
+#endif
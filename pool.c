@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "pool.h"
+
+/*
+ * Worker pool: a fixed set of threads that stay alive between runs, so that stepping
+ * many consoles one frame at a time does not pay a thread creation per frame. A run
+ * hands out the indices from 0 to count - 1; every thread, the caller included,
+ * claims the next one with a compare-and-swap until none is left. The counter holds
+ * the run it counts for, so that a worker late for a run never claims the indices of
+ * the next one, whose job it has not seen. Which thread runs which index changes
+ * from run to run, so a job must only touch what its index owns.
+ */
+struct pool {
+	int threads; // the caller included
+	pthread_t *workers;
+	pthread_mutex_t lock;
+	pthread_cond_t start; // a new run, or the end of the pool
+	pthread_cond_t done; // the last job of the run is over
+	unsigned long run; // incremented by every run
+	bool closing;
+
+	pool_job job;
+	void *context;
+	int count;
+	atomic_ullong next; // the run in the high 32 bits, the next index to claim in the low ones
+	int busy; // workers claiming or running jobs
+};
+
+// claims and runs jobs until the run has none left, or is over; the run is what was read under the lock
+static void work(pool *workers, unsigned long run, int count, pool_job job, void *context) {
+	unsigned long long claim = atomic_load_explicit(&workers->next, memory_order_relaxed);
+	while (claim >> 32 == (uint32_t) run && (int) (uint32_t) claim < count)
+		if (atomic_compare_exchange_weak_explicit(&workers->next, &claim, claim + 1, memory_order_relaxed, memory_order_relaxed))
+			job(context, (uint32_t) claim++);
+}
+
+static void *worker(void *arg) {
+	pool *workers = arg;
+	unsigned long seen = 0;
+
+	pthread_mutex_lock(&workers->lock);
+	for (;;) {
+		while (workers->run == seen && !workers->closing)
+			pthread_cond_wait(&workers->start, &workers->lock);
+		if (workers->closing)
+			break;
+		seen = workers->run;
+		workers->busy++;
+		int count = workers->count;
+		pool_job job = workers->job;
+		void *context = workers->context;
+		pthread_mutex_unlock(&workers->lock);
+
+		work(workers, seen, count, job, context);
+
+		pthread_mutex_lock(&workers->lock);
+		if (--workers->busy == 0)
+			pthread_cond_signal(&workers->done);
+	}
+	pthread_mutex_unlock(&workers->lock);
+	return NULL;
+}
+
+// a pool of the given amount of threads, the one calling pool_run included (at least 1)
+pool *pool_create(int threads) {
+	pool *workers = calloc(1, sizeof(pool));
+	if (!workers) {
+		puts("Error on memory allocation!");
+		return NULL;
+	}
+	workers->threads = threads < 1 ? 1 : threads;
+	workers->workers = calloc(workers->threads, sizeof(pthread_t));
+	if (!workers->workers) {
+		puts("Error on memory allocation!");
+		free(workers);
+		return NULL;
+	}
+	pthread_mutex_init(&workers->lock, NULL);
+	pthread_cond_init(&workers->start, NULL);
+	pthread_cond_init(&workers->done, NULL);
+	for (int i = 1; i < workers->threads; i++) {
+		if (pthread_create(&workers->workers[i], NULL, worker, workers) != 0) {
+			printf("Could only start %d threads\n", i);
+			workers->threads = i;
+			break;
+		}
+	}
+	return workers;
+}
+
+void pool_destroy(pool *workers) {
+	if (!workers)
+		return;
+	pthread_mutex_lock(&workers->lock);
+	workers->closing = true;
+	pthread_cond_broadcast(&workers->start);
+	pthread_mutex_unlock(&workers->lock);
+	for (int i = 1; i < workers->threads; i++)
+		pthread_join(workers->workers[i], NULL);
+	pthread_cond_destroy(&workers->done);
+	pthread_cond_destroy(&workers->start);
+	pthread_mutex_destroy(&workers->lock);
+	free(workers->workers);
+	free(workers);
+}
+
+// calls job(context, index) once for every index below count and returns when all of them are over
+void pool_run(pool *workers, int count, pool_job job, void *context) {
+	if (count <= 0)
+		return;
+	pthread_mutex_lock(&workers->lock);
+	workers->job = job;
+	workers->context = context;
+	workers->count = count;
+	workers->run++;
+	atomic_store_explicit(&workers->next, (unsigned long long) (uint32_t) workers->run << 32, memory_order_relaxed);
+	pthread_cond_broadcast(&workers->start);
+	pthread_mutex_unlock(&workers->lock);
+
+	work(workers, workers->run, count, job, context);
+
+	// every index is claimed: the jobs are over once no worker is busy anymore (the lock orders their writes before ours)
+	pthread_mutex_lock(&workers->lock);
+	while (workers->busy)
+		pthread_cond_wait(&workers->done, &workers->lock);
+	pthread_mutex_unlock(&workers->lock);
+}
+
+int pool_threads(pool const *workers) {
+	return workers->threads;
+}
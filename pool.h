@@ -0,0 +1,12 @@
+#ifndef HEADER_POOL
+#define HEADER_POOL
+
+typedef struct pool pool;
+typedef void (*pool_job)(void *context, int index);
+
+pool *pool_create(int threads);
+void pool_destroy(pool *workers);
+void pool_run(pool *workers, int count, pool_job job, void *context);
+int pool_threads(pool const *workers);
+
+#endif
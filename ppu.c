@@ -1,170 +1,469 @@
 #include <stdio.h>
+#include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include "loader.h"
 #include "core.h"
 #include "cpu.h"
+#include "ppu.h"
+#include "mapper.h"
+#include "controller.h"
+#include "apu.h"
+#include "console.h"
+#include "interleave.h"
+#include "sprites.h"
+#include "state.h"
 
-static int pixel = 0;
-static int scanline = 0;
-
-static uint8_t vram[2048]; // 0x800
-static uint8_t frame_buffer[256 * 240];
-
-static enum { FIRST, SECOND } write_order;
-static uint16_t ppu_address;
-
-/* https://www.nesdev.org/wiki/PPU_pattern_tables
-DCBA98 76543210
----------------
-0HRRRR CCCCPTTT
-|||||| |||||+++- T: Fine Y offset, the row number within a tile
-|||||| ||||+---- P: Bit plane (0: "lower"; 1: "upper")
-|||||| ++++----- C: Tile column
-||++++---------- R: Tile row
-|+-------------- H: Half of pattern table (0: "left"; 1: "right")
-+--------------- 0: Pattern table is at $0000-$1FFF */
-
-static struct {
-	union {
-		struct {
-			uint16_t fine_y_offset: 3;
-			uint16_t bit_plane: 1;
-			uint16_t column: 4;
-			uint16_t row: 4;
-			uint16_t half_of_chr: 1;
-			uint16_t zero: 3;
-		};
-		uint16_t full;
-	};
-} tile;
+#ifndef DEBUG
+#define printf(...) ((void) 0)
+#endif
 
-static struct {
-	bool nmi_enabled; // Generate an NMI at the start of the vblank interval
-	enum { HORIZONTAL = 1, VERTICAL = 32 } address_increment;
-} ctrl;
+#define DOTS_PER_SCANLINE 341
+#define DOTS_PER_FRAME (DOTS_PER_SCANLINE * 262)
 
-static struct {
-	bool vblank; // Vertical blank has started - Set at dot 1 of line 241 / Cleared after reading $2002 and at dot 1 of the pre-render scanline.
-} status;
+#define SPRITE_BEHIND 0x20 // in sprite_line: behind the background
+#define SPRITE_ZERO 0x40 // in sprite_line: a pixel of sprite 0
 
-uint8_t ppu_read(int ppu_register) {
+static void render_up_to_current_dot(struct ppu *ppu);
+
+uint8_t ppu_read(struct ppu *ppu, int ppu_register) {
 	// PPUSTATUS
 	if (ppu_register == 2) {
-		uint8_t vblank = status.vblank;
-		printf("PPU read:  %04X -> %02X\n", ppu_register, vblank);
-		status.vblank = false;
-		write_order = FIRST;
-		if (vblank)
-			return 0x80;
+		if (!ppu->status.sprite_zero_hit) // the pixels drawn until now may hit it
+			render_up_to_current_dot(ppu);
+		uint8_t status = ppu->status.vblank << 7 | ppu->status.sprite_zero_hit << 6 | ppu->status.sprite_overflow << 5;
+		printf("PPU read:  %04X -> %02X\n", ppu_register, status);
+		ppu->status.vblank = false;
+		ppu->write_order = FIRST;
+		return status;
 	}
+	// OAMDATA
+	if (ppu_register == 4)
+		return ppu->oam[ppu->oam_address];
 	return 0x00;
 }
 
-void ppu_write(int ppu_register, uint8_t data) {
+void ppu_write(struct ppu *ppu, int ppu_register, uint8_t data) {
 	printf("PPU write: %04X -> %02X\n", ppu_register, data);
+	render_up_to_current_dot(ppu);
 	// PPUCTRL
 	if (ppu_register == 0) {
-		ctrl.nmi_enabled = (data & 0x80);
-		tile.half_of_chr = (data & 0x10) >> 4;
-		//sprite_pattern_table_address = (data & 0x08) >> 3;
-		ctrl.address_increment = (data & 0x04) ? VERTICAL : HORIZONTAL;
+		ppu->ctrl.nmi_enabled = (data & 0x80);
+		ppu->ctrl.sprite_height = (data & 0x20) ? 16 : 8;
+		ppu->tile.half_of_chr = (data & 0x10) >> 4;
+		ppu->ctrl.sprite_table = (data & 0x08) >> 3;
+		ppu->ctrl.address_increment = (data & 0x04) ? VERTICAL : HORIZONTAL;
 		//base_nametable_address = (data & 0x03);
 		return;
 	}
+	// PPUMASK
+	if (ppu_register == 1) {
+		ppu->mask.greyscale = data & 0x01;
+		ppu->mask.show_left_background = data & 0x02;
+		ppu->mask.show_left_sprites = data & 0x04;
+		ppu->mask.show_background = data & 0x08;
+		ppu->mask.show_sprites = data & 0x10;
+		ppu->mask.rendering = data & 0x18;
+		ppu->mask.emphasis = data >> 5;
+		return;
+	}
+	// OAMADDR
+	if (ppu_register == 3) {
+		ppu->oam_address = data;
+		return;
+	}
+	// OAMDATA
+	if (ppu_register == 4) {
+		ppu->oam[ppu->oam_address++] = data;
+		return;
+	}
 	// PPUADDR
 	if (ppu_register == 6) {
-		if (write_order == FIRST)
-			ppu_address = data << 8;
+		if (ppu->write_order == FIRST)
+			ppu->ppu_address = data << 8;
 		else // write_order == SECOND
-			ppu_address |= data;
-		write_order = !write_order;
+			ppu->ppu_address |= data;
+		ppu->write_order = !ppu->write_order;
 		return;
 	}
 	// PPUDATA
 	if (ppu_register == 7) {
-		vram[ppu_address & 0x07FF] = data; // vram has size 2k == 0x800
-		ppu_address += ctrl.address_increment;
+		uint16_t address = ppu->ppu_address & 0x3FFF;
+		if (address < 0x2000) {
+			if (ppu->console->cartridge.chr_ram) { // pattern tables, read-only unless the cartridge has RAM there
+				size_t offset = ppu->chr_window[address >> 10] + (address & 0x03FF);
+				ppu->console->chr[offset] = data;
+				ppu_invalidate_chr(ppu, offset, 1);
+			}
+		} else if (address < 0x3F00) {
+			ppu->nametable[address >> 10 & 0x03][address & 0x03FF] = data;
+		} else {
+			// $3F10, $3F14, $3F18 and $3F1C are mirrors of $3F00, $3F04, $3F08 and $3F0C
+			address &= (address & 0x13) == 0x10 ? 0x0F : 0x1F;
+			ppu->palette[address] = data & 0x3F;
+		}
+		ppu->ppu_address += ppu->ctrl.address_increment;
 		return;
 	}
 }
 
-static void draw_pixel(void) {
-	// this calculation finds the tile index inside the nametable, based on the scanline and the current pixel
-	int tile_index = scanline / 8 * 32 + (pixel % 256 / 8);
-	int tile_pos = vram[tile_index]; // position in the pattern table (chr)
+void ppu_power_up(struct ppu *ppu) {
+	ppu->pixel = ppu->scanline = ppu->rendered_pixels = 0;
+	ppu->dot_counter = 0;
+	memset(ppu->vram, 0, sizeof(ppu->vram));
+	memset(ppu->palette, 0, sizeof(ppu->palette));
+	memset(ppu->frame_buffer, 0, sizeof(ppu->frame_buffer));
+	memset(ppu->line_emphasis, 0, sizeof(ppu->line_emphasis));
+	memset(ppu->oam, 0xFF, sizeof(ppu->oam)); // below the screen until the game fills it
+	ppu->oam_address = 0;
+	ppu->line_has_sprites = false;
+	ppu->write_order = FIRST;
+	ppu->ppu_address = 0;
+	ppu->tile.full = 0;
+	memset(&ppu->ctrl, 0, sizeof(ppu->ctrl));
+	ppu->ctrl.sprite_height = 8;
+	memset(&ppu->mask, 0, sizeof(ppu->mask));
+	memset(&ppu->status, 0, sizeof(ppu->status));
+	if (ppu->decoded)
+		memset(ppu->decoded, 0, ppu->console->cartridge.chr_size / 16);
+	ppu_set_mirroring(ppu, ppu->console->cartridge.mirroring);
+	ppu_map_chr(ppu, 0, 8, 0x0000);
+}
+
+// points the given 1k windows of the pattern tables at CHR, from offset on
+void ppu_map_chr(struct ppu *ppu, int window, int count, size_t offset) {
+	render_up_to_current_dot(ppu);
+	for (int i = window; i < window + count; i++)
+		ppu->chr_window[i] = offset + ((size_t) (i - window) << 10);
+}
+
+void ppu_set_mirroring(struct ppu *ppu, int mirroring) {
+	static uint8_t const layout[5][4] = {
+		[MIRROR_HORIZONTAL] = { 0, 0, 1, 1 },
+		[MIRROR_VERTICAL] = { 0, 1, 0, 1 },
+		[MIRROR_SINGLE_LOW] = { 0, 0, 0, 0 },
+		[MIRROR_SINGLE_HIGH] = { 1, 1, 1, 1 },
+		[MIRROR_FOUR_SCREEN] = { 0, 1, 2, 3 }
+	};
+	render_up_to_current_dot(ppu);
+	for (int i = 0; i < 4; i++)
+		ppu->nametable[i] = ppu->vram + layout[mirroring][i] * 0x400;
+}
+
+static void decode_tile(struct ppu *ppu, int index) {
+	decode_tiles(ppu->console->chr + index * 16, &ppu->decoded_tiles[index], 1);
+	ppu->decoded[index] = true;
+}
+
+// the decoded pixels of the tile row whose low bit plane is at the given pattern table address
+static uint8_t const *decoded_row(struct ppu *ppu, uint16_t address) {
+	int index = (ppu->chr_window[address >> 10 & 0x07] + (address & 0x03FF)) >> 4;
+	if (ppu->decoded && !ppu->decoded[index])
+		decode_tile(ppu, index);
+	return ppu->decoded_tiles[index][address & 0x07];
+}
 
-	tile.row = (tile_pos & 0xF0) >> 4; // upper nibble of tile_pos
-	tile.column = tile_pos & 0x0F; // lower nibble of tile_pos
+// OAM DMA: 256 bytes written through OAMDATA, from the current OAM address on
+void ppu_oam_dma(struct ppu *ppu, uint8_t const data[256]) {
+	memcpy(ppu->oam + ppu->oam_address, data, 256 - ppu->oam_address);
+	memcpy(ppu->oam, data + 256 - ppu->oam_address, ppu->oam_address);
+}
 
-	tile.fine_y_offset = scanline % 8;
+// pattern data in the given range of CHR has changed (CHR-RAM writes)
+void ppu_invalidate_chr(struct ppu *ppu, size_t offset, int length) {
+	size_t tiles = ppu->console->cartridge.chr_size / 16;
+	if (!ppu->decoded)
+		return;
+	for (size_t index = offset >> 4; index <= (offset + length - 1) >> 4 && index < tiles; index++)
+		ppu->decoded[index] = false;
+}
 
-	tile.bit_plane = 0;
-	int a = chr[tile.full] & (0x80 >> pixel % 8);
+/*
+ * The background of a scanline is drawn one tile row (8 pixels) per fetch, normally
+ * all at once when the last visible dot is reached. Register writes that change what
+ * the remaining dots would show (see ppu_write) first draw the pixels up to the
+ * current dot, so the result is the same as drawing one pixel per dot.
+ */
+static void render_background(struct ppu *ppu, int end) {
+	uint8_t *line = ppu->frame_buffer + ppu->scanline * 256;
+	uint8_t const color_mask = ppu->mask.greyscale ? 0x30 : 0x3F;
+	int x = ppu->rendered_pixels;
 
-	tile.bit_plane = 1;
-	int b = chr[tile.full] & (0x80 >> pixel % 8);
+	ppu->line_emphasis[ppu->scanline] = ppu->mask.emphasis;
+	ppu->tile.fine_y_offset = ppu->scanline % 8;
+	ppu->tile.bit_plane = 0;
+	while (x < end) {
+		// this calculation finds the tile index inside the nametable, based on the scanline and the current pixel
+		int tile_pos = ppu->nametable[0][ppu->scanline / 8 * 32 + x / 8]; // position in the pattern table (chr)
+		ppu->tile.row = (tile_pos & 0xF0) >> 4; // upper nibble of tile_pos
+		ppu->tile.column = tile_pos & 0x0F; // lower nibble of tile_pos
 
-	frame_buffer[scanline * 256 + pixel] = (a ? 1 : 0) + (b ? 2 : 0);
+		// each 32x32 area of the attribute table holds the palettes of its four 16x16 quadrants
+		int attribute = ppu->nametable[0][0x3C0 + ppu->scanline / 32 * 8 + x / 32] >> ((ppu->scanline & 16) >> 2 | (x & 16) >> 3) & 0x03;
+		uint8_t const colors[4] = {
+			ppu->palette[0] & color_mask, // backdrop
+			ppu->palette[attribute * 4 + 1] & color_mask,
+			ppu->palette[attribute * 4 + 2] & color_mask,
+			ppu->palette[attribute * 4 + 3] & color_mask
+		};
+
+		uint8_t const *row = decoded_row(ppu, ppu->tile.full);
+		memcpy(ppu->background + (x & ~7), row, 8);
+		int tile_end = (x | 7) + 1 < end ? (x | 7) + 1 : end;
+		for (; x < tile_end; x++)
+			line[x] = colors[row[x % 8]];
+	}
+	ppu->rendered_pixels = end;
 }
 
-void generate_buffer(uint8_t scanline) {
-	if (scanline > 127) return;
-	int buffer_entry = scanline * 256;
-	int pattern_table_tile = (scanline / 8) * 512;
-	int pixel_line = scanline % 8;
-	for (int tile = 0; tile < 32; tile++) {
-		int pattern_table_entry = pattern_table_tile + pixel_line;
-		for (int pixel = 0; pixel < 8; pixel++) {
-			int a = chr[pattern_table_entry] & (0x80 >> pixel);
-			int b = chr[pattern_table_entry + 8] & (0x80 >> pixel);
-			frame_buffer[buffer_entry++] = (a ? 1 : 0) + (b ? 2 : 0);
-		}
-		pattern_table_tile += 16;
+// composes sprite_line over the background pixels from start to end, and finds out whether sprite 0 hits
+static void render_sprites(struct ppu *ppu, int start, int end) {
+	uint8_t *line = ppu->frame_buffer + ppu->scanline * 256;
+	uint8_t const color_mask = ppu->mask.greyscale ? 0x30 : 0x3F;
+
+	if (!ppu->mask.show_sprites)
+		return;
+	if (start < 8 && !ppu->mask.show_left_sprites)
+		start = 8;
+	for (int x = start; x < end; x++) {
+		uint8_t sprite = ppu->sprite_line[x];
+		if (!sprite)
+			continue;
+		bool background = ppu->background[x];
+		// never at x = 255, and not where the background is hidden
+		if ((sprite & SPRITE_ZERO) && background && ppu->mask.show_background && x != 255 && (x >= 8 || ppu->mask.show_left_background))
+			ppu->status.sprite_zero_hit = true;
+		if (!background || !(sprite & SPRITE_BEHIND))
+			line[x] = ppu->palette[sprite & 0x1F] & color_mask;
 	}
 }
 
-static void run_visible_scanline(void) {
-	//if (pixel == 255)
-	//	generate_buffer(scanline);
-	if (pixel < 256)
-		draw_pixel();
-	if (pixel++ == 340)
-		scanline++, pixel = 0;
+static void render(struct ppu *ppu, int end) {
+	int start = ppu->rendered_pixels;
+	render_background(ppu, end);
+	if (ppu->line_has_sprites)
+		render_sprites(ppu, start, end);
 }
 
-static void run_post_render_scanline(void) {
-	if (pixel == 0)
-		display_frame_buffer(frame_buffer);
-	if (pixel++ == 340)
-		scanline++, pixel = 0;
+// brings the current scanline up to date before the CPU changes the PPU state
+static void render_up_to_current_dot(struct ppu *ppu) {
+	if (ppu->scanline < 240 && ppu->pixel > ppu->rendered_pixels)
+		render(ppu, ppu->pixel < 256 ? ppu->pixel : 256);
 }
 
-static void run_vblank(void) {
-	if (scanline == 241 && pixel == 1) { // send a signal to CPU
-		if (ctrl.nmi_enabled)
-			cpu_interrupt();
-		status.vblank = true;
+static void draw_sprite(struct ppu *ppu, int index, int height) {
+	uint8_t const *sprite = ppu->oam + index * 4;
+	uint8_t const attributes = sprite[2];
+	int row = ppu->scanline - sprite[0];
+	if (attributes & 0x80) // flipped vertically
+		row = height - 1 - row;
+	uint16_t address = height == 8
+		? ppu->ctrl.sprite_table << 12 | sprite[1] << 4 | row
+		: (sprite[1] & 0x01) << 12 | ((sprite[1] & 0xFE) + row / 8) << 4 | row % 8;
+	uint8_t const *pixels = decoded_row(ppu, address);
+	uint8_t const color = 0x10 | (attributes & 0x03) << 2 | (attributes & 0x20 ? SPRITE_BEHIND : 0) | (index ? 0 : SPRITE_ZERO);
+
+	uint8_t *target = ppu->sprite_line + sprite[3];
+	int width = 256 - sprite[3] < 8 ? 256 - sprite[3] : 8;
+	for (int x = 0; x < width; x++) {
+		uint8_t pixel = pixels[attributes & 0x40 ? 7 - x : x]; // bit 6: flipped horizontally
+		if (pixel)
+			target[x] = color | pixel;
 	}
-	if (pixel++ == 340)
-		scanline++, pixel = 0;
 }
 
-static void run_pre_render_scanline(void) {
-	if (pixel == 1)
-		status.vblank = false;
-	if (pixel++ == 340)
-		scanline = pixel = 0;
+// at the end of a visible scanline: the first 8 sprites of the next one in OAM order, drawn into sprite_line
+static void evaluate_sprites(struct ppu *ppu) {
+	int const height = ppu->ctrl.sprite_height;
+	uint64_t found = ppu->mask.rendering && ppu->scanline < 239 ? find_sprites(ppu->oam, ppu->scanline, height) : 0;
+	int first[8], count = 0;
+
+	ppu->line_has_sprites = found;
+	if (!found)
+		return;
+	for (; found && count < 8; found &= found - 1)
+		first[count++] = __builtin_ctzll(found);
+	if (found)
+		ppu->status.sprite_overflow = true;
+	memset(ppu->sprite_line, 0, sizeof(ppu->sprite_line));
+	while (count--)
+		draw_sprite(ppu, first[count], height);
+}
+
+// MMC3 counts scanlines by the rise of A12 when the sprite patterns are fetched from $1000, at dot 260
+static void clock_mapper_scanline(struct ppu *ppu) {
+	if (ppu->pixel == 260 && ppu->mask.rendering && mapper_counts_scanlines(ppu->console))
+		mapper_clock_scanline(ppu->console);
+}
+
+static void run_visible_scanline(struct ppu *ppu) {
+	if (ppu->pixel == 255) {
+		render(ppu, 256);
+		evaluate_sprites(ppu);
+	}
+	clock_mapper_scanline(ppu);
+	if (ppu->pixel++ == 340)
+		ppu->scanline++, ppu->pixel = ppu->rendered_pixels = 0;
+}
+
+static void run_post_render_scanline(struct ppu *ppu) {
+	if (ppu->pixel == 0) {
+		ppu->console->frames++;
+		display_frame_buffer(ppu->console, ppu->frame_buffer, ppu->line_emphasis);
+	}
+	if (ppu->pixel++ == 340)
+		ppu->scanline++, ppu->pixel = 0;
+}
+
+static void run_vblank(struct ppu *ppu) {
+	if (ppu->scanline == 241 && ppu->pixel == 1) { // send a signal to CPU
+		if (ppu->ctrl.nmi_enabled)
+			cpu_interrupt(&ppu->console->cpu);
+		ppu->status.vblank = true;
+	}
+	if (ppu->pixel++ == 340)
+		ppu->scanline++, ppu->pixel = 0;
+}
+
+static void run_pre_render_scanline(struct ppu *ppu) {
+	if (ppu->pixel == 1)
+		ppu->status.vblank = ppu->status.sprite_zero_hit = ppu->status.sprite_overflow = false;
+	clock_mapper_scanline(ppu);
+	if (ppu->pixel++ == 340)
+		ppu->scanline = ppu->pixel = 0;
 }
 
-void ppu_exec(void) {
-	if (scanline < 240)
-		run_visible_scanline();
-	else if (scanline == 240)
-		run_post_render_scanline();
-	else if (scanline < 261)
-		run_vblank();
+void ppu_exec(struct ppu *ppu) {
+	ppu->dot_counter++;
+	if (ppu->scanline < 240)
+		run_visible_scanline(ppu);
+	else if (ppu->scanline == 240)
+		run_post_render_scanline(ppu);
+	else if (ppu->scanline < 261)
+		run_vblank(ppu);
 	else // scanline == 261
-		run_pre_render_scanline();
+		run_pre_render_scanline(ppu);
 }
 
+
+// the next dot of the current scanline in which ppu_exec does more than moving on to the next dot
+static int next_busy_pixel(struct ppu const *ppu) {
+	bool counter = mapper_counts_scanlines(ppu->console);
+	if (ppu->scanline < 240)
+		return ppu->pixel <= 255 ? 255 : counter && ppu->pixel <= 260 ? 260 : 340;
+	if (ppu->scanline == 240)
+		return ppu->pixel == 0 ? 0 : 340;
+	if (ppu->scanline == 241)
+		return ppu->pixel <= 1 ? 1 : 340;
+	if (ppu->scanline == 261)
+		return ppu->pixel <= 1 ? 1 : counter && ppu->pixel <= 260 ? 260 : 340;
+	return 340;
+}
+
+// lazy catch-up: runs the PPU until it has executed the given amount of dots, skipping over idle ones
+void ppu_sync(struct ppu *ppu, unsigned long long dot) {
+	while (ppu->dot_counter < dot) {
+		unsigned long long idle = next_busy_pixel(ppu) - ppu->pixel;
+		if (idle > dot - ppu->dot_counter)
+			idle = dot - ppu->dot_counter;
+		ppu->pixel += idle;
+		ppu->dot_counter += idle;
+		if (ppu->dot_counter < dot)
+			ppu_exec(ppu);
+	}
+}
+
+static int dots_until(struct ppu const *ppu, int target_scanline, int target_pixel) {
+	int distance = (target_scanline - ppu->scanline) * DOTS_PER_SCANLINE + target_pixel - ppu->pixel;
+	return distance < 0 ? distance + DOTS_PER_FRAME : distance;
+}
+
+/*
+ * The next dot in which the PPU affects the rest of the console: a frame is completed,
+ * vblank (NMI) starts or, with a mapper counting scanlines, the counter is clocked and
+ * may raise an IRQ.
+ */
+unsigned long long ppu_next_event(struct ppu *ppu) {
+	int frame = dots_until(ppu, 240, 0);
+	int vblank = dots_until(ppu, 241, 1);
+	int next = frame < vblank ? frame : vblank;
+	if (mapper_counts_scanlines(ppu->console)) {
+		int line = ppu->scanline;
+		if (ppu->scanline >= 240 && ppu->scanline < 261)
+			line = 261;
+		else if (ppu->pixel > 260)
+			line = ppu->scanline == 239 ? 261 : ppu->scanline == 261 ? 0 : ppu->scanline + 1;
+		int counter = dots_until(ppu, line, 260);
+		if (counter < next)
+			next = counter;
+	}
+	return ppu->dot_counter + next;
+}
+
+void ppu_save_state(struct ppu const *ppu, struct ppu_state *state) {
+	memcpy(state->vram, ppu->vram, sizeof(ppu->vram));
+	memcpy(state->palette, ppu->palette, sizeof(ppu->palette));
+	memcpy(state->oam, ppu->oam, sizeof(ppu->oam));
+	memcpy(state->sprite_line, ppu->sprite_line, sizeof(ppu->sprite_line));
+	state->dot_counter = ppu->dot_counter;
+	for (int i = 0; i < 8; i++)
+		state->chr_window[i] = ppu->chr_window[i];
+	state->pixel = ppu->pixel;
+	state->scanline = ppu->scanline;
+	state->rendered_pixels = ppu->rendered_pixels;
+	state->ppu_address = ppu->ppu_address;
+	state->tile = ppu->tile.full;
+	for (int i = 0; i < 4; i++)
+		state->nametable[i] = (ppu->nametable[i] - ppu->vram) >> 10;
+	state->write_order = ppu->write_order;
+	state->nmi_enabled = ppu->ctrl.nmi_enabled;
+	state->address_increment = ppu->ctrl.address_increment;
+	state->greyscale = ppu->mask.greyscale;
+	state->rendering = ppu->mask.rendering;
+	state->emphasis = ppu->mask.emphasis;
+	state->vblank = ppu->status.vblank;
+	state->oam_address = ppu->oam_address;
+	state->sprite_table = ppu->ctrl.sprite_table;
+	state->sprite_height = ppu->ctrl.sprite_height;
+	state->show = ppu->mask.show_background | ppu->mask.show_sprites << 1 | ppu->mask.show_left_background << 2 | ppu->mask.show_left_sprites << 3;
+	state->sprite_zero_hit = ppu->status.sprite_zero_hit;
+	state->sprite_overflow = ppu->status.sprite_overflow;
+	state->line_has_sprites = ppu->line_has_sprites;
+}
+
+// CHR RAM comes back along with the state, so its decoded tiles cannot be trusted anymore
+void ppu_load_state(struct ppu *ppu, struct ppu_state const *state) {
+	memcpy(ppu->vram, state->vram, sizeof(ppu->vram));
+	memcpy(ppu->palette, state->palette, sizeof(ppu->palette));
+	memcpy(ppu->oam, state->oam, sizeof(ppu->oam));
+	memcpy(ppu->sprite_line, state->sprite_line, sizeof(ppu->sprite_line));
+	ppu->dot_counter = state->dot_counter;
+	for (int i = 0; i < 8; i++)
+		ppu->chr_window[i] = state->chr_window[i];
+	ppu->pixel = state->pixel;
+	ppu->scanline = state->scanline;
+	ppu->rendered_pixels = state->rendered_pixels;
+	ppu->ppu_address = state->ppu_address;
+	ppu->tile.full = state->tile;
+	for (int i = 0; i < 4; i++)
+		ppu->nametable[i] = ppu->vram + state->nametable[i] * 0x400;
+	ppu->write_order = state->write_order ? SECOND : FIRST;
+	ppu->ctrl.nmi_enabled = state->nmi_enabled;
+	ppu->ctrl.address_increment = state->address_increment;
+	ppu->mask.greyscale = state->greyscale;
+	ppu->mask.rendering = state->rendering;
+	ppu->mask.emphasis = state->emphasis;
+	ppu->status.vblank = state->vblank;
+	ppu->oam_address = state->oam_address;
+	ppu->ctrl.sprite_table = state->sprite_table;
+	ppu->ctrl.sprite_height = state->sprite_height;
+	ppu->mask.show_background = state->show & 0x01;
+	ppu->mask.show_sprites = state->show & 0x02;
+	ppu->mask.show_left_background = state->show & 0x04;
+	ppu->mask.show_left_sprites = state->show & 0x08;
+	ppu->status.sprite_zero_hit = state->sprite_zero_hit;
+	ppu->status.sprite_overflow = state->sprite_overflow;
+	ppu->line_has_sprites = state->line_has_sprites;
+	if (ppu->decoded)
+		memset(ppu->decoded, 0, ppu->console->cartridge.chr_size / 16);
+}
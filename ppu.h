@@ -1,9 +1,108 @@
 #ifndef HEADER_PPU
 #define HEADER_PPU
 
-void ppu_exec(void);
-void ppu_write(int ppu_register, uint8_t data);
-uint8_t ppu_read(int ppu_register);
+struct console;
 
-#endif
+struct ppu {
+	int pixel;
+	int scanline;
+	unsigned long long dot_counter; // dots run since power-up
+
+	uint8_t vram[4096]; // 2k in the console, 4k with the cartridge's own for four-screen mirroring
+	uint8_t *nametable[4]; // $2000, $2400, $2800, $2C00 according to the mirroring
+	size_t chr_window[8]; // offset in chr of every 1k of the pattern tables, set by the mapper
+	uint8_t palette[32]; // $3F00-$3F1F
+	uint8_t frame_buffer[256 * 240]; // NES color of every pixel
+	uint8_t line_emphasis[240]; // PPUMASK color emphasis of every scanline
+	int rendered_pixels; // pixels of the current scanline already in frame_buffer
+	uint8_t background[256 + 8]; // 2-bit background pixel of the current scanline, for the sprites in front or behind
+
+	uint8_t oam[256]; // 64 sprites: Y (top line - 1), tile, attributes, X
+	uint8_t oam_address;
+
+	/*
+	 * The sprites of a scanline are found at the end of the previous one, from the OAM of
+	 * that moment, and drawn into sprite_line in one go: palette entry ($10-$1F) of every
+	 * pixel, 0 where all of them are transparent. They are drawn from the last one found
+	 * to the first, so that the lower OAM index wins whatever its priority, as on the
+	 * console. The renderer then only composes sprite_line over the background.
+	 */
+	uint8_t sprite_line[256];
+	bool line_has_sprites;
+
+	/*
+	 * Pattern tables decoded ahead of time: every tile row holds its 8 pixels as 2-bit
+	 * values in 8 bytes, so both renderers get a whole row from one load instead of
+	 * combining the bit planes pixel by pixel. CHR ROM is decoded once when the ROM is
+	 * loaded and shared by every console. CHR RAM is decoded per console, a tile the
+	 * first time it is used and again after its pattern data changes. Tiles are cached
+	 * by their place in the whole CHR, so bank switches keep what was already decoded.
+	 */
+	uint8_t (*decoded_tiles)[8][8]; // [tile][row][pixel]
+	bool *decoded; // NULL: every tile is decoded (CHR ROM)
+
+	enum { FIRST, SECOND } write_order;
+	uint16_t ppu_address;
+
+	/* https://www.nesdev.org/wiki/PPU_pattern_tables
+	DCBA98 76543210
+	---------------
+	0HRRRR CCCCPTTT
+	|||||| |||||+++- T: Fine Y offset, the row number within a tile
+	|||||| ||||+---- P: Bit plane (0: "lower"; 1: "upper")
+	|||||| ++++----- C: Tile column
+	||++++---------- R: Tile row
+	|+-------------- H: Half of pattern table (0: "left"; 1: "right")
+	+--------------- 0: Pattern table is at $0000-$1FFF */
+	struct {
+		union {
+			struct {
+				uint16_t fine_y_offset: 3;
+				uint16_t bit_plane: 1;
+				uint16_t column: 4;
+				uint16_t row: 4;
+				uint16_t half_of_chr: 1;
+				uint16_t zero: 3;
+			};
+			uint16_t full;
+		};
+	} tile;
 
+	struct {
+		bool nmi_enabled; // Generate an NMI at the start of the vblank interval
+		enum { HORIZONTAL = 1, VERTICAL = 32 } address_increment;
+		uint8_t sprite_table; // Pattern table of 8x8 sprites (0: $0000; 1: $1000)
+		uint8_t sprite_height; // 8 or 16, the pattern table then comes from bit 0 of the tile index
+	} ctrl;
+
+	struct {
+		bool greyscale; // Produce a greyscale display
+		bool rendering; // Show background or sprites
+		bool show_background;
+		bool show_sprites;
+		bool show_left_background; // in the leftmost 8 pixels
+		bool show_left_sprites;
+		uint8_t emphasis; // Emphasize red (bit 0), green (bit 1) and blue (bit 2)
+	} mask;
+
+	struct {
+		bool vblank; // Vertical blank has started - Set at dot 1 of line 241 / Cleared after reading $2002 and at dot 1 of the pre-render scanline.
+		bool sprite_zero_hit; // An opaque pixel of sprite 0 was drawn over an opaque background pixel - Cleared at dot 1 of the pre-render scanline.
+		bool sprite_overflow; // More than 8 sprites were found on a scanline - Cleared at dot 1 of the pre-render scanline.
+	} status;
+
+	struct console *console; // CHR, the mapper and the CPU interrupt line
+};
+
+void ppu_exec(struct ppu *ppu);
+void ppu_power_up(struct ppu *ppu);
+void ppu_sync(struct ppu *ppu, unsigned long long dot);
+unsigned long long ppu_next_event(struct ppu *ppu);
+void ppu_write(struct ppu *ppu, int ppu_register, uint8_t data);
+uint8_t ppu_read(struct ppu *ppu, int ppu_register);
+void ppu_invalidate_chr(struct ppu *ppu, size_t offset, int length);
+void ppu_map_chr(struct ppu *ppu, int window, int count, size_t offset);
+void ppu_set_mirroring(struct ppu *ppu, int mirroring);
+void ppu_oam_dma(struct ppu *ppu, uint8_t const data[256]);
+
+#endif
@@ -0,0 +1,460 @@
+#define _XOPEN_SOURCE 700 // nftw, getline
+
+#include <ftw.h>
+#include <time.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+#include "loader.h"
+#include "cpu.h"
+#include "ppu.h"
+#include "mapper.h"
+#include "controller.h"
+#include "apu.h"
+#include "console.h"
+#include "interleave.h"
+#include "sprites.h"
+#include "hash.h"
+#include "pool.h"
+
+/*
+ * Regression harness: runs every ROM of a directory tree for a number of frames and
+ * compares the CRC32 of the frame buffer, CPU RAM and VRAM at checkpoint frames with a
+ * golden manifest written by an earlier run (--update). A ROM is one job of the worker
+ * pool, with its own console, and stops at its first checkpoint that does not match.
+ * A ROM may come with an input script next to it, ROM.input, one line per change of
+ * the buttons held: the frame it happens at (0 is the first one emulated), the port
+ * (1 or 2) and the buttons, joined by '+' (A+RIGHT) or '-' for none.
+ */
+#define MANIFEST_HEADER "#path\tframe\tframe_buffer\tram\tvram"
+#define MAX_INPUTS 4096
+
+typedef struct {
+	long frame; // completed since power-up
+	uint32_t frame_buffer;
+	uint32_t ram;
+	uint32_t vram;
+} checkpoint;
+
+typedef struct {
+	long frame;
+	int port;
+	uint8_t buttons;
+} input;
+
+typedef struct {
+	char *path; // relative to the directory
+	checkpoint *expected; // from the manifest
+	int expected_count;
+	checkpoint *actual;
+	int actual_count;
+	int mismatch; // index in expected of the first checkpoint that differs, -1: none
+	bool found; // in the directory
+	bool failed; // the ROM or its input script could not be loaded, or the CPU failed (checkpoints are not recorded)
+} test;
+
+static struct {
+	char const *directory;
+	char const *manifest;
+	long frames;
+	long every;
+	int threads;
+	bool update;
+} options = { .frames = 600, .every = 60 };
+
+static struct {
+	test *tests;
+	int count;
+	int capacity;
+	int sorted; // the tests of the manifest come first, in order
+} corpus;
+
+// the PPU calls back here; only the hashes of the pictures are looked at
+void display_frame_buffer(console *source, uint8_t const *internal_frame_buffer, uint8_t const *line_emphasis) {
+	(void) source, (void) internal_frame_buffer, (void) line_emphasis;
+}
+
+static test *add_test(char const *path) {
+	if (corpus.count == corpus.capacity) {
+		corpus.capacity = corpus.capacity ? corpus.capacity * 2 : 256;
+		corpus.tests = realloc(corpus.tests, corpus.capacity * sizeof(test));
+		if (!corpus.tests) {
+			puts("Error on memory allocation!");
+			exit(EXIT_FAILURE);
+		}
+	}
+	test *t = &corpus.tests[corpus.count++];
+	memset(t, 0, sizeof(*t));
+	t->path = strdup(path);
+	t->mismatch = -1;
+	return t;
+}
+
+static int compare_paths(void const *a, void const *b) {
+	return strcmp(((test const *) a)->path, ((test const *) b)->path);
+}
+
+static test *find_test(char const *path) {
+	test key = { .path = (char *) path };
+	return bsearch(&key, corpus.tests, corpus.sorted, sizeof(test), compare_paths);
+}
+
+static void add_checkpoint(checkpoint **list, int *count, checkpoint c) {
+	// grows by powers of 2
+	if (!(*count & (*count - 1))) {
+		*list = realloc(*list, (*count ? *count * 2 : 1) * sizeof(checkpoint));
+		if (!*list) {
+			puts("Error on memory allocation!");
+			exit(EXIT_FAILURE);
+		}
+	}
+	(*list)[(*count)++] = c;
+}
+
+/******************************************************* Manifest *******************************************************/
+// checkpoints of ROMs that are not in the directory anymore are kept, and reported as missing
+static bool read_manifest(char const *file_name) {
+	FILE *file = fopen(file_name, "r");
+	if (!file)
+		return false;
+
+	char *line = NULL;
+	size_t line_size = 0;
+	ssize_t length;
+	while ((length = getline(&line, &line_size, file)) > 0) {
+		if (line[0] == '#')
+			continue;
+		if (line[length - 1] == '\n')
+			line[--length] = '\0';
+		char *tab = strchr(line, '\t');
+		checkpoint c;
+		unsigned frame_buffer, ram, vram;
+		if (!tab || sscanf(tab + 1, "%ld\t%x\t%x\t%x", &c.frame, &frame_buffer, &ram, &vram) != 4)
+			continue;
+		*tab = '\0';
+		c.frame_buffer = frame_buffer;
+		c.ram = ram;
+		c.vram = vram;
+
+		test *t = corpus.count && !strcmp(corpus.tests[corpus.count - 1].path, line) ? &corpus.tests[corpus.count - 1] : add_test(line);
+		add_checkpoint(&t->expected, &t->expected_count, c);
+	}
+	free(line);
+	fclose(file);
+	qsort(corpus.tests, corpus.count, sizeof(test), compare_paths);
+	corpus.sorted = corpus.count;
+	return true;
+}
+
+// written next to the manifest, then renamed over it, so an interrupted run leaves the old manifest intact
+static bool write_manifest(char const *file_name) {
+	size_t name_length = strlen(file_name);
+	char temporary_name[name_length + 5];
+	snprintf(temporary_name, sizeof(temporary_name), "%s.new", file_name);
+	FILE *file = fopen(temporary_name, "w");
+	if (!file) {
+		printf("Could not write %s\n", temporary_name);
+		return false;
+	}
+
+	fprintf(file, "%s\n", MANIFEST_HEADER);
+	for (int i = 0; i < corpus.count; i++) {
+		test const *t = &corpus.tests[i];
+		for (int j = 0; j < t->actual_count; j++)
+			fprintf(file, "%s\t%ld\t%08x\t%08x\t%08x\n", t->path, t->actual[j].frame,
+				t->actual[j].frame_buffer, t->actual[j].ram, t->actual[j].vram);
+	}
+	if (fclose(file) != 0 || rename(temporary_name, file_name) != 0) {
+		printf("Could not write %s\n", file_name);
+		remove(temporary_name);
+		return false;
+	}
+	return true;
+}
+
+/***************************************************** Directory walk ***************************************************/
+static bool is_rom(char const *path) {
+	size_t length = strlen(path);
+	if (length < 4 || path[length - 4] != '.')
+		return false;
+	return tolower(path[length - 3]) == 'n' && tolower(path[length - 2]) == 'e' && tolower(path[length - 1]) == 's';
+}
+
+static int visit(char const *path, struct stat const *status, int type, struct FTW *position) {
+	(void) status, (void) position;
+	if (type != FTW_F || !is_rom(path) || strchr(path, '\t') || strchr(path, '\n'))
+		return 0;
+	char const *relative = path + strlen(options.directory);
+	while (*relative == '/')
+		relative++;
+
+	test *known = find_test(relative);
+	if (!known)
+		known = add_test(relative);
+	known->found = true;
+	return 0;
+}
+
+/********************************************************* Runs *********************************************************/
+static uint8_t parse_buttons(char const *text, bool *valid) {
+	static struct {
+		char const *name;
+		uint8_t button;
+	} const names[] = {
+		{ "A", BUTTON_A }, { "B", BUTTON_B }, { "SELECT", BUTTON_SELECT }, { "START", BUTTON_START },
+		{ "UP", BUTTON_UP }, { "DOWN", BUTTON_DOWN }, { "LEFT", BUTTON_LEFT }, { "RIGHT", BUTTON_RIGHT }
+	};
+	uint8_t buttons = 0;
+	*valid = true;
+	if (!strcmp(text, "-"))
+		return 0;
+	for (char const *name = text; *valid; name++) {
+		size_t length = strcspn(name, "+");
+		*valid = false;
+		for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+			if (strlen(names[i].name) == length && !strncmp(names[i].name, name, length)) {
+				buttons |= names[i].button;
+				*valid = true;
+			}
+		name += length;
+		if (!*name)
+			break;
+	}
+	return buttons;
+}
+
+// the input script of the ROM, if it has one, sorted by frame; -1 when it is broken
+static int read_inputs(char const *rom_path, input inputs[MAX_INPUTS]) {
+	char file_name[strlen(rom_path) + 7];
+	snprintf(file_name, sizeof(file_name), "%s.input", rom_path);
+	FILE *file = fopen(file_name, "r");
+	if (!file)
+		return 0;
+
+	int count = 0;
+	char line[256], buttons[128];
+	for (int number = 1; fgets(line, sizeof(line), file); number++) {
+		input in;
+		bool valid = true;
+		if (line[0] == '#' || strspn(line, " \t\r\n") == strlen(line))
+			continue;
+		if (count == MAX_INPUTS || sscanf(line, "%ld %d %127s", &in.frame, &in.port, buttons) != 3
+			|| in.frame < 0 || in.port < 1 || in.port > 2 || (count && in.frame < inputs[count - 1].frame)) {
+			valid = false;
+		} else {
+			in.buttons = parse_buttons(buttons, &valid);
+		}
+		if (!valid) {
+			printf("<%s> Line %d is not valid input!\n", file_name, number);
+			fclose(file);
+			return -1;
+		}
+		inputs[count++] = in;
+	}
+	fclose(file);
+	return count;
+}
+
+static checkpoint take_checkpoint(console const *nes) {
+	return (checkpoint) {
+		.frame = nes->frames,
+		.frame_buffer = calculate_crc32(nes->ppu.frame_buffer, sizeof(nes->ppu.frame_buffer)),
+		.ram = calculate_crc32(nes->cpu.ram, sizeof(nes->cpu.ram)),
+		.vram = calculate_crc32(nes->ppu.vram, sizeof(nes->ppu.vram))
+	};
+}
+
+static bool same(checkpoint const *a, checkpoint const *b) {
+	return a->frame_buffer == b->frame_buffer && a->ram == b->ram && a->vram == b->vram;
+}
+
+// the checkpoints are the ones of the manifest, or every options.every frames and the last one with --update
+static void run_test(void *context, int index) {
+	(void) context;
+	test *t = &corpus.tests[index];
+	if (!t->found || (!options.update && !t->expected_count))
+		return;
+
+	char path[strlen(options.directory) + strlen(t->path) + 2];
+	snprintf(path, sizeof(path), "%s/%s", options.directory, t->path);
+	input inputs[MAX_INPUTS];
+	int input_count = read_inputs(path, inputs);
+	struct rom rom;
+	if (input_count < 0 || !load_rom(path, &rom)) {
+		t->failed = true;
+		return;
+	}
+	console *nes = console_create(&rom);
+	if (!nes) {
+		t->failed = true;
+		unload_rom(&rom);
+		return;
+	}
+	console_power_up(nes);
+
+	long last_frame = options.update ? options.frames : t->expected[t->expected_count - 1].frame;
+	int next_input = 0, next_expected = 0;
+	while ((long) nes->frames < last_frame) {
+		for (; next_input < input_count && inputs[next_input].frame <= (long) nes->frames; next_input++)
+			controller_set_buttons(&nes->controller, inputs[next_input].port - 1, inputs[next_input].buttons);
+		unsigned long frame = nes->frames;
+		while (nes->frames == frame && !nes->cpu.failed)
+			console_run(nes);
+		if (nes->cpu.failed) {
+			cpu_print_failure(&nes->cpu);
+			t->failed = true;
+			t->actual_count = 0;
+			break;
+		}
+
+		long done = nes->frames;
+		if (options.update) {
+			if (done % options.every == 0 || done == last_frame)
+				add_checkpoint(&t->actual, &t->actual_count, take_checkpoint(nes));
+		} else if (t->expected[next_expected].frame == done) {
+			checkpoint c = take_checkpoint(nes);
+			add_checkpoint(&t->actual, &t->actual_count, c);
+			if (!same(&c, &t->expected[next_expected])) {
+				t->mismatch = next_expected;
+				break;
+			}
+			next_expected++;
+		}
+	}
+	console_destroy(nes);
+	unload_rom(&rom);
+}
+
+/******************************************************* Report *********************************************************/
+static void print_mismatch(test const *t) {
+	checkpoint const *expected = &t->expected[t->mismatch];
+	checkpoint const *actual = &t->actual[t->actual_count - 1];
+	printf("DIVERGED %s at frame %ld:%s%s%s", t->path, expected->frame,
+		expected->frame_buffer != actual->frame_buffer ? " frame buffer" : "",
+		expected->ram != actual->ram ? " ram" : "",
+		expected->vram != actual->vram ? " vram" : "");
+	if (t->mismatch)
+		printf(" (last match at frame %ld)", t->expected[t->mismatch - 1].frame);
+	printf("\n");
+}
+
+// one line for every ROM that did not pass, and the totals; false when one did not
+static bool report(double seconds) {
+	int passed = 0, diverged = 0, failed = 0, added = 0, missing = 0;
+	for (int i = 0; i < corpus.count; i++) {
+		test const *t = &corpus.tests[i];
+		if (!t->found) {
+			printf("MISSING  %s\n", t->path);
+			missing++;
+		} else if (t->failed) {
+			printf("ERROR    %s\n", t->path);
+			failed++;
+		} else if (options.update || t->expected_count) {
+			if (t->mismatch >= 0) {
+				print_mismatch(t);
+				diverged++;
+			} else {
+				passed++;
+			}
+		} else {
+			printf("NEW      %s (not in the manifest, see --update)\n", t->path);
+			added++;
+		}
+	}
+	printf("%d ROMs: %d %s, %d diverged, %d errors, %d new, %d missing in %.3f s on %d threads\n",
+		corpus.count, passed, options.update ? "recorded" : "passed", diverged, failed, added, missing, seconds, options.threads);
+	return !diverged && !failed;
+}
+
+static bool parse_arguments(int argc, char *argv[]) {
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--manifest") && i + 1 < argc) {
+			options.manifest = argv[++i];
+		} else if (!strcmp(argv[i], "--frames") && i + 1 < argc) {
+			options.frames = strtol(argv[++i], NULL, 10);
+		} else if (!strcmp(argv[i], "--every") && i + 1 < argc) {
+			options.every = strtol(argv[++i], NULL, 10);
+		} else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+			options.threads = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--update")) {
+			options.update = true;
+		} else if (!strcmp(argv[i], "--core") && i + 1 < argc) {
+			i++;
+			if (!strcmp(argv[i], "fast")) {
+				fast_core = true;
+			} else if (!strcmp(argv[i], "jit")) {
+				fast_core = jit_core = true;
+			} else if (strcmp(argv[i], "microcode")) {
+				printf("Unknown CPU core: %s\n", argv[i]);
+				return false;
+			}
+		} else if (!strcmp(argv[i], "--lockstep")) {
+			lockstep = true;
+		} else if (argv[i][0] != '-' && !options.directory) {
+			options.directory = argv[i];
+		} else {
+			printf("Unknown argument: %s\n", argv[i]);
+			return false;
+		}
+	}
+	if (options.frames < 1 || options.every < 1) {
+		puts("Frames and checkpoint interval must be at least 1!");
+		return false;
+	}
+	if (options.threads < 1)
+		options.threads = sysconf(_SC_NPROCESSORS_ONLN) > 0 ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+	if (!options.directory)
+		puts("Directory is missing!");
+	return options.directory;
+}
+
+int main(int argc, char *argv[]) {
+	if (!parse_arguments(argc, argv)) {
+		puts("Usage: funestus-regress [--manifest FILE] [--update [--frames N] [--every N]] [--threads N] [--core microcode|fast|jit] [--lockstep] DIRECTORY");
+		return EXIT_FAILURE;
+	}
+	char default_manifest[strlen(options.directory) + 17];
+	if (!options.manifest) {
+		snprintf(default_manifest, sizeof(default_manifest), "%s/funestus.golden", options.directory);
+		options.manifest = default_manifest;
+	}
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (!read_manifest(options.manifest) && !options.update) {
+		printf("No manifest at %s, record one with --update\n", options.manifest);
+		return EXIT_FAILURE;
+	}
+	if (nftw(options.directory, visit, 64, FTW_PHYS) != 0) {
+		printf("Could not scan %s\n", options.directory);
+		return EXIT_FAILURE;
+	}
+	qsort(corpus.tests, corpus.count, sizeof(test), compare_paths);
+
+	// the implementations are picked before the threads share them
+	crc32_implementation_name();
+	tile_decoder_name();
+	sprite_finder_name();
+	pool *workers = pool_create(options.threads);
+	if (!workers)
+		return EXIT_FAILURE;
+	pool_run(workers, corpus.count, run_test, NULL);
+	pool_destroy(workers);
+
+	if (options.update) {
+		int kept = 0;
+		for (int i = 0; i < corpus.count; i++)
+			if (corpus.tests[i].found)
+				corpus.tests[kept++] = corpus.tests[i];
+		corpus.count = kept; // the manifest follows the directory
+		if (!write_manifest(options.manifest))
+			return EXIT_FAILURE;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return report((end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
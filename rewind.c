@@ -0,0 +1,244 @@
+#define _POSIX_C_SOURCE 200809L // clock_gettime
+
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "state.h"
+#include "rewind.h"
+
+/*
+ * Rewind history: one snapshot per frame in an arena of fixed size. Every
+ * KEYFRAME_INTERVAL frames a keyframe is stored whole, the frames in between as the
+ * XOR against their keyframe. Both are run-length encoded by 64-bit words, and since
+ * only a few bytes of RAM change from frame to frame, a delta is mostly one long run
+ * of zeros. The arena is filled like a ring: when the next record does not fit, the
+ * oldest keyframe goes along with its deltas.
+ */
+#define KEYFRAME_INTERVAL 60
+#define MAX_RECORDS (60 * 60 * 30) // half an hour at 60 frames/s, whatever the arena holds
+#define MAX_RUN 0xFFFF // words
+
+typedef struct {
+	size_t offset; // in the arena
+	uint32_t length; // bytes
+	bool keyframe;
+} record;
+
+static struct console *history_of; // the one console whose history is held
+static uint8_t *arena;
+static size_t capacity;
+static size_t head; // where the next record goes
+
+static record records[MAX_RECORDS]; // ring, from the oldest to the newest
+static int first;
+static int count;
+
+static size_t state_words; // snapshot size in 64-bit words
+static uint64_t *current; // the snapshot being captured or restored
+static uint64_t *keyframe; // the last keyframe, what deltas are taken against
+static uint8_t *encoded; // the record being built, big enough for the worst case
+static int frames_since_keyframe;
+static bool keyframe_lost; // rewinding or a full arena dropped the keyframe of the next delta
+static bool replaying; // the frame after a step ends in the newest state of the history, already held
+
+static unsigned long captures;
+static double capture_ns;
+
+static record *nth(int index) {
+	return &records[(first + index) % MAX_RECORDS];
+}
+
+static void drop_oldest_group(void) {
+	do {
+		first = (first + 1) % MAX_RECORDS;
+		count--;
+	} while (count && !nth(0)->keyframe);
+}
+
+// every snapshot size is a multiple of 8 (asserted in state.h), there is no trailing byte to care about
+static size_t encode(uint64_t const *state, uint64_t const *base) {
+	uint8_t *out = encoded;
+	size_t i = 0;
+	while (i < state_words) {
+		uint16_t zeros = 0, literals = 0;
+		while (i < state_words && zeros < MAX_RUN && !(state[i] ^ (base ? base[i] : 0)))
+			i++, zeros++;
+		uint8_t *token = out;
+		out += 4;
+		while (i < state_words && literals < MAX_RUN && (state[i] ^ (base ? base[i] : 0))) {
+			uint64_t word = state[i] ^ (base ? base[i] : 0);
+			memcpy(out, &word, 8);
+			out += 8;
+			i++, literals++;
+		}
+		memcpy(token, &zeros, 2);
+		memcpy(token + 2, &literals, 2);
+	}
+	return out - encoded;
+}
+
+// XORs the record into state, which holds zeros for a keyframe and the keyframe for a delta
+static void decode(record const *r, uint64_t *state) {
+	uint8_t const *in = arena + r->offset;
+	uint8_t const *end = in + r->length;
+	size_t i = 0;
+	while (in < end) {
+		uint16_t zeros, literals;
+		memcpy(&zeros, in, 2);
+		memcpy(&literals, in + 2, 2);
+		in += 4;
+		i += zeros;
+		for (; literals; literals--, i++, in += 8) {
+			uint64_t word;
+			memcpy(&word, in, 8);
+			state[i] ^= word;
+		}
+	}
+}
+
+// the records left at the end of the arena when it wraps around are the oldest ones
+static record *reserve(size_t length) {
+	if (count == MAX_RECORDS)
+		drop_oldest_group();
+	if (head + length > capacity) {
+		while (count && nth(0)->offset >= head)
+			drop_oldest_group();
+		head = 0;
+	}
+	while (count && nth(0)->offset >= head && nth(0)->offset < head + length)
+		drop_oldest_group();
+
+	record *r = nth(count++);
+	r->offset = head;
+	r->length = length;
+	head += length;
+	return r;
+}
+
+static double now_ns(void) {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+// the arena must hold a few seconds at least, deltas are only usable along with their keyframe
+bool rewind_open(struct console *nes, int megabytes) {
+	history_of = nes;
+	state_words = state_size(nes) / 8;
+	capacity = (size_t) megabytes << 20;
+	size_t worst_case = state_words * 8 + (state_words + 1) * 4;
+	if (capacity < 4 * KEYFRAME_INTERVAL * worst_case) {
+		printf("Rewind needs at least %zu MB for this cartridge\n", ((4 * KEYFRAME_INTERVAL * worst_case) >> 20) + 1);
+		return false;
+	}
+	arena = malloc(capacity);
+	current = calloc(state_words, 8);
+	keyframe = calloc(state_words, 8);
+	encoded = malloc(worst_case);
+	if (!arena || !current || !keyframe || !encoded) {
+		puts("Error on memory allocation!");
+		rewind_close();
+		return false;
+	}
+	rewind_reset();
+	return true;
+}
+
+void rewind_close(void) {
+	free(arena);
+	free(current);
+	free(keyframe);
+	free(encoded);
+	arena = encoded = NULL;
+	current = keyframe = NULL;
+	count = 0;
+}
+
+// forgets the history, after loading a state or powering up
+void rewind_reset(void) {
+	first = count = 0;
+	head = 0;
+	keyframe_lost = true;
+	replaying = false;
+}
+
+// stores the state of the console as the newest frame of the history
+void rewind_capture(void) {
+	if (!arena)
+		return;
+	if (replaying) {
+		replaying = false;
+		return;
+	}
+	double start = now_ns();
+	state_save(history_of, (snapshot *) current);
+
+	bool is_keyframe = keyframe_lost || frames_since_keyframe == KEYFRAME_INTERVAL;
+	size_t length = encode(current, is_keyframe ? NULL : keyframe);
+	record *r = reserve(length);
+	// making room may have dropped the group of this delta, its keyframe included: store the frame whole then
+	if (!is_keyframe && count == 1) {
+		count--;
+		head = r->offset;
+		is_keyframe = true;
+		r = reserve(length = encode(current, NULL));
+	}
+	memcpy(arena + r->offset, encoded, length);
+	r->keyframe = is_keyframe;
+	if (is_keyframe) {
+		memcpy(keyframe, current, state_words * 8);
+		frames_since_keyframe = 0;
+		keyframe_lost = false;
+	}
+	frames_since_keyframe++;
+
+	captures++;
+	capture_ns += now_ns() - start;
+}
+
+// rebuilds the snapshot of the given record: its keyframe, then the delta over it
+static bool restore(int index) {
+	int key = index;
+	while (key > 0 && !nth(key)->keyframe)
+		key--;
+	if (!nth(key)->keyframe)
+		return false;
+	memset(current, 0, state_words * 8);
+	decode(nth(key), current);
+	if (key != index)
+		decode(nth(index), current);
+	return state_load(history_of, (snapshot const *) current);
+}
+
+/*
+ * Goes one frame back. The frame buffer is not part of a snapshot, so the state
+ * loaded is the one before the frame to show, and the next frame emulated shows it
+ * and ends in the state that is then the newest of the history, so it is not
+ * captured again. At the oldest frame of the history, that frame is shown again and
+ * again.
+ */
+bool rewind_step(void) {
+	if (!arena || !count)
+		return false;
+	keyframe_lost = true;
+	replaying = count >= 2;
+	if (count < 3)
+		return restore(0);
+	count--;
+	head = nth(count)->offset;
+	return restore(count - 2);
+}
+
+void print_rewind_report(void) {
+	if (!arena)
+		return;
+	size_t used = 0;
+	for (int i = 0; i < count; i++)
+		used += nth(i)->length;
+	printf("Rewind: %d frames held in %.1f of %zu MB, %.0f bytes per frame, capture %.1f us on average\n",
+		count, used / 1048576.0, capacity >> 20, count ? (double) used / count : 0.0,
+		captures ? capture_ns / captures / 1000 : 0.0);
+}
@@ -0,0 +1,13 @@
+#ifndef HEADER_REWIND
+#define HEADER_REWIND
+
+struct console;
+
+bool rewind_open(struct console *nes, int megabytes);
+void rewind_close(void);
+void rewind_reset(void);
+void rewind_capture(void);
+bool rewind_step(void);
+void print_rewind_report(void);
+
+#endif
@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <immintrin.h>
+#include "sprites.h"
+
+/*
+ * The PPU looks at the 64 Y coordinates of OAM one after the other on every scanline.
+ * The kernels below gather them into one or two vectors and compare all of them at
+ * once: Y is in range when Y - first, with first the lowest Y in range, is at most
+ * scanline - first as unsigned bytes. As with the tile decoders, the fastest kernel
+ * supported by the host is picked on the first call and sprite_finder_self_test()
+ * checks all of them against the plain comparison.
+ */
+
+typedef uint64_t (*sprite_finder)(uint8_t const oam[256], int scanline, int height);
+
+/*************************************************** Scalar *******************************************************/
+static uint64_t find_sprites_scalar(uint8_t const oam[256], int scanline, int height) {
+	uint64_t found = 0;
+	for (int sprite = 0; sprite < 64; sprite++)
+		if (oam[sprite * 4] <= scanline && scanline - oam[sprite * 4] < height)
+			found |= 1ULL << sprite;
+	return found;
+}
+
+/**************************************************** SSE2 ********************************************************/
+// the Y bytes of 16 sprites, in order: the low byte of every 32-bit word, narrowed twice
+__attribute__((target("sse2")))
+static inline __m128i gather_y_sse2(uint8_t const *oam) {
+	__m128i const low_byte = _mm_set1_epi32(0xFF);
+	__m128i a = _mm_and_si128(_mm_loadu_si128((__m128i const *) oam), low_byte);
+	__m128i b = _mm_and_si128(_mm_loadu_si128((__m128i const *) (oam + 16)), low_byte);
+	__m128i c = _mm_and_si128(_mm_loadu_si128((__m128i const *) (oam + 32)), low_byte);
+	__m128i d = _mm_and_si128(_mm_loadu_si128((__m128i const *) (oam + 48)), low_byte);
+	return _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+}
+
+__attribute__((target("sse2")))
+static uint64_t find_sprites_sse2(uint8_t const oam[256], int scanline, int height) {
+	int first = scanline - height + 1 > 0 ? scanline - height + 1 : 0;
+	__m128i const base = _mm_set1_epi8(first);
+	__m128i const span = _mm_set1_epi8(scanline - first);
+	uint64_t found = 0;
+	for (int group = 0; group < 4; group++) {
+		__m128i offset = _mm_sub_epi8(gather_y_sse2(oam + group * 64), base);
+		__m128i in_range = _mm_cmpeq_epi8(_mm_min_epu8(offset, span), offset);
+		found |= (uint64_t) (uint16_t) _mm_movemask_epi8(in_range) << group * 16;
+	}
+	return found;
+}
+
+/**************************************************** AVX2 ********************************************************/
+// the Y bytes of 32 sprites; packing works within 128-bit lanes, so the 4-sprite groups come out as 0 2 4 6 1 3 5 7
+__attribute__((target("avx2")))
+static inline __m256i gather_y_avx2(uint8_t const *oam) {
+	__m256i const low_byte = _mm256_set1_epi32(0xFF);
+	__m256i const order = _mm256_set_epi32(7, 3, 6, 2, 5, 1, 4, 0);
+	__m256i a = _mm256_and_si256(_mm256_loadu_si256((__m256i const *) oam), low_byte);
+	__m256i b = _mm256_and_si256(_mm256_loadu_si256((__m256i const *) (oam + 32)), low_byte);
+	__m256i c = _mm256_and_si256(_mm256_loadu_si256((__m256i const *) (oam + 64)), low_byte);
+	__m256i d = _mm256_and_si256(_mm256_loadu_si256((__m256i const *) (oam + 96)), low_byte);
+	__m256i y = _mm256_packus_epi16(_mm256_packs_epi32(a, b), _mm256_packs_epi32(c, d));
+	return _mm256_permutevar8x32_epi32(y, order);
+}
+
+__attribute__((target("avx2")))
+static uint64_t find_sprites_avx2(uint8_t const oam[256], int scanline, int height) {
+	int first = scanline - height + 1 > 0 ? scanline - height + 1 : 0;
+	__m256i const base = _mm256_set1_epi8(first);
+	__m256i const span = _mm256_set1_epi8(scanline - first);
+	__m256i low = _mm256_sub_epi8(gather_y_avx2(oam), base);
+	__m256i high = _mm256_sub_epi8(gather_y_avx2(oam + 128), base);
+	low = _mm256_cmpeq_epi8(_mm256_min_epu8(low, span), low);
+	high = _mm256_cmpeq_epi8(_mm256_min_epu8(high, span), high);
+	return (uint64_t) (uint32_t) _mm256_movemask_epi8(high) << 32 | (uint32_t) _mm256_movemask_epi8(low);
+}
+
+/************************************************** Selection *****************************************************/
+static struct {
+	char const *name;
+	char const *feature; // as known by __builtin_cpu_supports, NULL if always available
+	sprite_finder find;
+} const finders[] = { // from the fastest to the slowest
+	{ "avx2", "avx2", find_sprites_avx2 },
+	{ "sse2", "sse2", find_sprites_sse2 },
+	{ "scalar", NULL, find_sprites_scalar }
+};
+
+#define FINDERS (int) (sizeof(finders) / sizeof(finders[0]))
+
+static bool supported(int finder) {
+	char const *feature = finders[finder].feature;
+	if (!feature)
+		return true;
+	// __builtin_cpu_supports only accepts string literals
+	if (!strcmp(feature, "avx2"))
+		return __builtin_cpu_supports("avx2");
+	if (!strcmp(feature, "sse2"))
+		return __builtin_cpu_supports("sse2");
+	return false;
+}
+
+static uint64_t select_and_find(uint8_t const oam[256], int scanline, int height);
+static sprite_finder selected_finder = select_and_find;
+static int selected = FINDERS - 1;
+
+static void select_finder(void) {
+	__builtin_cpu_init();
+	for (selected = 0; !supported(selected); selected++)
+		;
+	selected_finder = finders[selected].find;
+}
+
+static uint64_t select_and_find(uint8_t const oam[256], int scanline, int height) {
+	select_finder();
+	return selected_finder(oam, scanline, height);
+}
+
+uint64_t find_sprites(uint8_t const oam[256], int scanline, int height) {
+	return selected_finder(oam, scanline, height);
+}
+
+char const *sprite_finder_name(void) {
+	if (selected_finder == select_and_find)
+		select_finder();
+	return finders[selected].name;
+}
+
+/************************************************** Self-test *****************************************************/
+// random OAM contents and every Y coordinate next to the scanline, for both sprite heights
+#define TEST_ROUNDS 64
+
+bool sprite_finder_self_test(void) {
+	static uint8_t oam[TEST_ROUNDS + 1][256];
+	uint32_t seed = 0x2C02;
+	for (int round = 0; round < TEST_ROUNDS; round++) {
+		for (int i = 0; i < 256; i++) {
+			seed = seed * 1103515245 + 12345;
+			oam[round][i] = seed >> 16;
+		}
+	}
+	for (int sprite = 0; sprite < 64; sprite++) // Y from 239 down to 176
+		oam[TEST_ROUNDS][sprite * 4] = 239 - sprite;
+
+	bool passed = true;
+	for (int finder = 0; finder < FINDERS; finder++) {
+		if (!supported(finder)) {
+			printf("Sprite finder %-6s: not supported by this CPU\n", finders[finder].name);
+			continue;
+		}
+		int errors = 0;
+		for (int round = 0; round <= TEST_ROUNDS; round++) {
+			for (int scanline = 0; scanline < 240; scanline++) {
+				for (int height = 8; height <= 16; height += 8) {
+					uint64_t found = finders[finder].find(oam[round], scanline, height);
+					for (int sprite = 0; sprite < 64; sprite++) {
+						int row = scanline - oam[round][sprite * 4];
+						if ((found >> sprite & 1) != (row >= 0 && row < height))
+							errors++;
+					}
+				}
+			}
+		}
+		printf("Sprite finder %-6s: %s\n", finders[finder].name, errors ? "FAILED" : "ok");
+		if (errors)
+			passed = false;
+	}
+	return passed;
+}
@@ -0,0 +1,12 @@
+#ifndef HEADER_SPRITES
+#define HEADER_SPRITES
+
+/* Sprite evaluation: the sprites of OAM (4 bytes each, Y first) whose Y coordinate puts
+the given scanline among their rows (scanline - Y from 0 to height - 1), as a mask with
+bit i set for sprite i. */
+uint64_t find_sprites(uint8_t const oam[256], int scanline, int height);
+
+char const *sprite_finder_name(void);
+bool sprite_finder_self_test(void);
+
+#endif
@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "loader.h"
+#include "cpu.h"
+#include "ppu.h"
+#include "mapper.h"
+#include "controller.h"
+#include "apu.h"
+#include "console.h"
+#include "state.h"
+
+// the snapshot of the loaded cartridge: the fixed part and its CHR RAM, if any
+size_t state_size(console const *nes) {
+	return sizeof(snapshot) + (nes->cartridge.chr_ram ? nes->cartridge.chr_size : 0);
+}
+
+void state_save(console const *nes, snapshot *state) {
+	memcpy(state->magic, STATE_MAGIC, sizeof(state->magic));
+	state->version = STATE_VERSION;
+	state->size = state_size(nes);
+	state->rom_crc32 = nes->cartridge.crc32;
+	state->chr_ram_size = nes->cartridge.chr_ram ? nes->cartridge.chr_size : 0;
+	cpu_save_state(&nes->cpu, &state->cpu);
+	ppu_save_state(&nes->ppu, &state->ppu);
+	mapper_save_state(nes, &state->mapper);
+	controller_save_state(&nes->controller, &state->controller);
+	apu_save_state(&nes->apu, &state->apu);
+	if (state->chr_ram_size)
+		memcpy(state->chr_ram, nes->chr, state->chr_ram_size);
+}
+
+// what a damaged or foreign snapshot could hold that would point outside of the console's memory
+static char const *check_state(console const *nes, snapshot const *state) {
+	if (memcmp(state->magic, STATE_MAGIC, sizeof(state->magic)))
+		return "Not a funestus state";
+	if (state->version != STATE_VERSION)
+		return "Unsupported state version";
+	if (state->size != state_size(nes) || state->chr_ram_size != (nes->cartridge.chr_ram ? nes->cartridge.chr_size : 0))
+		return "State size does not match the cartridge";
+	if (state->rom_crc32 != nes->cartridge.crc32)
+		return "State of another ROM";
+	if (state->cpu.interrupt_vector && (state->cpu.interrupt_vector & 0xFFF9) != 0xFFF8)
+		return "Invalid interrupt vector";
+	if (state->cpu.step >= 7)
+		return "Invalid CPU step";
+	for (int i = 0; i < 4; i++)
+		if (state->ppu.nametable[i] >= 4)
+			return "Invalid nametable";
+	for (int i = 0; i < 8; i++)
+		if (state->ppu.chr_window[i] + 0x400 > nes->cartridge.chr_size)
+			return "Invalid pattern table window";
+	if (state->ppu.sprite_height != 8 && state->ppu.sprite_height != 16)
+		return "Invalid sprite height";
+	if (state->ppu.pixel > 340 || state->ppu.scanline > 261 || state->ppu.rendered_pixels > 256)
+		return "Invalid PPU position";
+	for (int i = 0; i < 5; i++)
+		if (state->apu.countdown[i] < 1)
+			return "Invalid APU timer";
+	if (state->apu.dmc_bits < 1 || state->apu.dmc_bits > 8)
+		return "Invalid DMC bit counter";
+	if (state->apu.frame_step >= (state->apu.five_step ? 5 : 4) || state->apu.frame_start > state->apu.cycle + 4
+		|| state->apu.frame_start + 37282 < state->apu.cycle)
+		return "Invalid frame counter";
+	if (state->apu.phase >= APU_CLOCK)
+		return "Invalid sample phase";
+	return NULL;
+}
+
+// the CPU first, it resets the memory map that the mapper completes; the PPU last, mapping banks draws pending pixels
+bool state_load(console *nes, snapshot const *state) {
+	char const *error = check_state(nes, state);
+	if (error) {
+		printf("%s!\n", error);
+		return false;
+	}
+	if (state->chr_ram_size)
+		memcpy(nes->chr, state->chr_ram, state->chr_ram_size);
+	cpu_load_state(&nes->cpu, &state->cpu);
+	mapper_load_state(nes, &state->mapper);
+	ppu_load_state(&nes->ppu, &state->ppu);
+	controller_load_state(&nes->controller, &state->controller);
+	apu_load_state(&nes->apu, &state->apu);
+	return true;
+}
+
+bool state_save_file(console const *nes, char const *file_name) {
+	size_t size = state_size(nes);
+	snapshot *state = calloc(1, size); // padding included, identical states give identical files
+	if (!state) {
+		puts("Error on memory allocation!");
+		return false;
+	}
+	state_save(nes, state);
+	FILE *file = fopen(file_name, "wb");
+	bool saved = file && fwrite(state, size, 1, file) == 1;
+	if (file && fclose(file) != 0)
+		saved = false;
+	free(state);
+	printf(saved ? "State saved to %s\n" : "Could not write %s\n", file_name);
+	return saved;
+}
+
+bool state_load_file(console *nes, char const *file_name) {
+	size_t size = state_size(nes);
+	snapshot *state = malloc(size + 1);
+	if (!state) {
+		puts("Error on memory allocation!");
+		return false;
+	}
+	FILE *file = fopen(file_name, "rb");
+	if (!file) {
+		printf("Could not open %s\n", file_name);
+		free(state);
+		return false;
+	}
+	size_t read = fread(state, 1, size + 1, file); // one byte more tells a longer file
+	fclose(file);
+	bool loaded = false;
+	if (read != size)
+		printf("<%s> State size does not match the cartridge!\n", file_name);
+	else if ((loaded = state_load(nes, state)))
+		printf("State loaded from %s\n", file_name);
+	free(state);
+	return loaded;
+}
@@ -0,0 +1,169 @@
+#ifndef HEADER_STATE
+#define HEADER_STATE
+
+#define STATE_MAGIC "FUNSTATE"
+#define STATE_VERSION 4
+
+/*
+ * A snapshot is one contiguous block with fixed-size fields in host byte order:
+ * saving and loading are a handful of memcpy and no parsing. Pointers are stored
+ * as what they point at (opcode and step of the microcode, 1k of VRAM of every
+ * nametable, offsets in CHR). The frame buffer is not part of it, every frame
+ * draws all of it again.
+ */
+struct cpu_state {
+	uint8_t ram[0x800];
+	uint64_t step_counter;
+	uint16_t pc;
+	uint16_t address; // transient
+	uint16_t interrupt_vector;
+	uint8_t a;
+	uint8_t x;
+	uint8_t y;
+	uint8_t s;
+	uint8_t p; // with flag b
+	uint8_t data; // transient
+	uint8_t irq_lines;
+	uint8_t opcode;
+	uint8_t step; // current_step in set[opcode]
+};
+
+struct ppu_state {
+	uint8_t vram[4096];
+	uint8_t palette[32];
+	uint8_t oam[256];
+	uint8_t sprite_line[256]; // of the current scanline, found at the end of the previous one
+	uint64_t dot_counter;
+	uint32_t chr_window[8];
+	uint16_t pixel;
+	uint16_t scanline;
+	uint16_t rendered_pixels;
+	uint16_t ppu_address;
+	uint16_t tile;
+	uint8_t nametable[4]; // 1k of VRAM
+	uint8_t write_order;
+	uint8_t nmi_enabled;
+	uint8_t address_increment;
+	uint8_t greyscale;
+	uint8_t rendering;
+	uint8_t emphasis;
+	uint8_t vblank;
+	uint8_t oam_address;
+	uint8_t sprite_table;
+	uint8_t sprite_height;
+	uint8_t show; // background, sprites, left background, left sprites from bit 0 on
+	uint8_t sprite_zero_hit;
+	uint8_t sprite_overflow;
+	uint8_t line_has_sprites;
+};
+
+struct mapper_state {
+	uint8_t prg_ram[0x2000];
+	uint64_t mmc1_last_write;
+	uint8_t latch; // UxROM PRG bank, CNROM CHR bank
+	uint8_t mmc1_shift;
+	uint8_t mmc1_shift_count;
+	uint8_t mmc1_control;
+	uint8_t mmc1_chr_bank[2];
+	uint8_t mmc1_prg_bank;
+	uint8_t mmc3_bank_select;
+	uint8_t mmc3_bank[8];
+	uint8_t mmc3_irq_latch;
+	uint8_t mmc3_irq_counter;
+	uint8_t mmc3_irq_reload;
+	uint8_t mmc3_irq_enabled;
+};
+
+struct apu_state {
+	uint64_t cycle;
+	uint64_t frame_start;
+	int32_t countdown[5]; // pulse 1, pulse 2, triangle, noise, DMC
+	uint32_t phase;
+	float output;
+	float level;
+	float filter;
+	float pending[64];
+	uint16_t pulse_timer[2];
+	uint16_t triangle_timer;
+	uint16_t noise_shift;
+	uint16_t dmc_sample_address;
+	uint16_t dmc_sample_length;
+	uint16_t dmc_address;
+	uint16_t dmc_remaining;
+	uint8_t envelope[3][6]; // pulse 1, pulse 2, noise: start, loop, constant, parameter, divider, decay
+	uint8_t sweep[2][6]; // enabled, negate, reload, period, shift, divider
+	uint8_t pulse_duty[2];
+	uint8_t pulse_step[2];
+	uint8_t length[4]; // pulse 1, pulse 2, triangle, noise
+	uint8_t triangle_step;
+	uint8_t triangle_control;
+	uint8_t triangle_reload;
+	uint8_t linear_reload;
+	uint8_t linear_counter;
+	uint8_t noise_mode;
+	uint8_t noise_period;
+	uint8_t dmc_irq_enabled;
+	uint8_t dmc_loop;
+	uint8_t dmc_irq;
+	uint8_t dmc_rate;
+	uint8_t dmc_level;
+	uint8_t dmc_shift;
+	uint8_t dmc_bits;
+	uint8_t dmc_silence;
+	uint8_t dmc_buffer;
+	uint8_t dmc_buffer_full;
+	uint8_t enabled;
+	uint8_t five_step;
+	uint8_t irq_inhibit;
+	uint8_t frame_irq;
+	uint8_t frame_step;
+};
+
+struct controller_state {
+	uint8_t shift[2];
+	uint8_t strobe;
+	uint8_t padding[5];
+};
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t size; // bytes, CHR RAM included
+	uint32_t rom_crc32; // a snapshot only fits the cartridge it was taken from
+	uint32_t chr_ram_size;
+	struct cpu_state cpu;
+	struct ppu_state ppu;
+	struct mapper_state mapper;
+	struct controller_state controller;
+	struct apu_state apu;
+	uint8_t chr_ram[];
+} snapshot;
+
+// with CHR RAM in multiples of 8k (see ines.c), every snapshot is a whole number of 64-bit words (see rewind.c)
+_Static_assert(sizeof(snapshot) % 8 == 0, "snapshots are compared and compressed in 64-bit words");
+
+struct cpu;
+struct ppu;
+struct controller;
+struct apu;
+struct console;
+
+// filled in and restored by every part of the console
+void cpu_save_state(struct cpu const *cpu, struct cpu_state *state);
+void cpu_load_state(struct cpu *cpu, struct cpu_state const *state);
+void ppu_save_state(struct ppu const *ppu, struct ppu_state *state);
+void ppu_load_state(struct ppu *ppu, struct ppu_state const *state);
+void mapper_save_state(struct console const *nes, struct mapper_state *state);
+void mapper_load_state(struct console *nes, struct mapper_state const *state);
+void controller_save_state(struct controller const *controller, struct controller_state *state);
+void controller_load_state(struct controller *controller, struct controller_state const *state);
+void apu_save_state(struct apu const *apu, struct apu_state *state);
+void apu_load_state(struct apu *apu, struct apu_state const *state);
+
+size_t state_size(struct console const *nes);
+void state_save(struct console const *nes, snapshot *state);
+bool state_load(struct console *nes, snapshot const *state);
+bool state_save_file(struct console const *nes, char const *file_name);
+bool state_load_file(struct console *nes, char const *file_name);
+
+#endif
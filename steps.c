@@ -1,536 +1,545 @@
 /********************************************************** Fetch **********************************************************/
-static void fetch_opcode(void) {
+static void fetch_opcode(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	uint8_t next = read_memory(reg.pc);
-	if (interrupt_vector) {
+	TRACE_INSTRUCTION(cpu->reg.pc, cpu->step_counter - 1, cpu->reg.a, cpu->reg.x, cpu->reg.y, cpu->reg.s, group_status_flags(cpu));
+	uint8_t next = read_memory(cpu, cpu->reg.pc);
+	if (!cpu->interrupt_vector && cpu->irq_lines && !cpu->flag.i)
+		cpu->interrupt_vector = IRQ;
+	if (cpu->interrupt_vector) {
 		next = 0x00;
-		fprintf(stdout, "\n\033[1;42m CPU interrupt \033[0m\n");
+		printf("\n\033[1;42m CPU interrupt \033[0m\n");
 	} else {
-		reg.pc++;
+		cpu->reg.pc++;
 	}
-	current_step = set[next];
+	cpu->opcode = next;
+	cpu->current_step = set[next];
+	// what is left of the last instruction is dead, cleared so that states do not depend on the core that ran it
+	cpu->transient.address = 0;
+	cpu->transient.data = 0;
+	TRACE_OPCODE(next, cpu->interrupt_vector != NONE);
 	printf("\nFETCH %02X \033[1;33m %s \033[0m %s\n", next, mnemonic[next], addressing[next]);
 }
 
-static void fetch_param_address_zp(void) {
+static void fetch_param_address_zp(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	transient.address = read_memory(reg.pc++);
+	cpu->transient.address = read_memory(cpu, cpu->reg.pc++);
 }
 
-static void fetch_param_address_lo(void) {
+static void fetch_param_address_lo(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	transient.address_lo = read_memory(reg.pc++);
+	cpu->transient.address_lo = read_memory(cpu, cpu->reg.pc++);
 }
 
-static void fetch_param_address_hi(void) {
+static void fetch_param_address_hi(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	transient.address_hi = read_memory(reg.pc++);
+	cpu->transient.address_hi = read_memory(cpu, cpu->reg.pc++);
 }
 
-static void fetch_param_data(void) {
+static void fetch_param_data(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	transient.data = read_memory(reg.pc++);
+	cpu->transient.data = read_memory(cpu, cpu->reg.pc++);
 }
 
-static void fetch_and_waste(void) {
+static void fetch_and_waste(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	read_memory(reg.pc);
+	read_memory(cpu, cpu->reg.pc);
 }
 
-static void fetch_param_address_hi_add_reg_x(void) {
+static void fetch_param_address_hi_add_reg_x(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	transient.address_hi = read_memory(reg.pc++);
-	if (transient.address_lo + reg.x < 0x0100) { // add X if the sum results in an address in the same page
-		transient.address_lo += reg.x;
-		current_step++;
+	cpu->transient.address_hi = read_memory(cpu, cpu->reg.pc++);
+	if (cpu->transient.address_lo + cpu->reg.x < 0x0100) { // add X if the sum results in an address in the same page
+		cpu->transient.address_lo += cpu->reg.x;
+		cpu->current_step++;
 	}
 }
 
-static void fetch_param_address_hi_add_reg_y(void) {
+static void fetch_param_address_hi_add_reg_y(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	transient.address_hi = read_memory(reg.pc++);
-	if (transient.address_lo + reg.y < 0x0100) { // add Y if the sum results in an address in the same page
-		transient.address_lo += reg.y;
-		current_step++;
+	cpu->transient.address_hi = read_memory(cpu, cpu->reg.pc++);
+	if (cpu->transient.address_lo + cpu->reg.y < 0x0100) { // add Y if the sum results in an address in the same page
+		cpu->transient.address_lo += cpu->reg.y;
+		cpu->current_step++;
 	}
 }
 
 /***************************************************************************************************************************/
-static void add_reg_x_to_address(void) {
+static void add_reg_x_to_address(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	transient.address += reg.x;
-	read_memory(reg.pc);
+	cpu->transient.address += cpu->reg.x;
+	read_memory(cpu, cpu->reg.pc);
 }
 
-static void add_reg_x_to_address_lo(void) {
+static void add_reg_x_to_address_lo(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	transient.address_lo += reg.x;
-	read_memory(reg.pc);
+	cpu->transient.address_lo += cpu->reg.x;
+	read_memory(cpu, cpu->reg.pc);
 }
 
 /***************************************************** Status setting ******************************************************/
-static void set_flag_c(void) {
+static void set_flag_c(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	flag.c = true;
-	fetch_opcode();
+	cpu->flag.c = true;
+	fetch_opcode(cpu);
 }
 
-static void set_flag_i(void) {
+static void set_flag_i(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	flag.i = true;
-	fetch_opcode();
+	cpu->flag.i = true;
+	fetch_opcode(cpu);
 }
 
-static void clear_flag_c(void) {
+static void clear_flag_c(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	flag.c = false;
-	fetch_opcode();
+	cpu->flag.c = false;
+	fetch_opcode(cpu);
 }
 
-static void clear_flag_d(void) {
+static void clear_flag_d(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	flag.d = false;
-	fetch_opcode();
+	cpu->flag.d = false;
+	fetch_opcode(cpu);
 }
 
 /******************************************************* Arithmetic ********************************************************/
-static void add_with_carry(void) {
+static void add_with_carry(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	uint16_t sum = reg.a + transient.data + flag.c;
-	flag.c = (sum & 0x0100);
+	uint16_t sum = cpu->reg.a + cpu->transient.data + cpu->flag.c;
+	cpu->flag.c = (sum & 0x0100);
 	// overflow: if both operands are positive, the result must be positive (same if both are negative)
-	flag.v = ~(reg.a ^ transient.data) & (reg.a ^ sum) & 0x80;
-	reg.a = sum;
-	update_flags_nz(reg.a);
-	fetch_opcode();
+	cpu->flag.v = ~(cpu->reg.a ^ cpu->transient.data) & (cpu->reg.a ^ sum) & 0x80;
+	cpu->reg.a = sum;
+	update_flags_nz(cpu, cpu->reg.a);
+	fetch_opcode(cpu);
 }
 
-static void subtract_with_carry(void) {
+static void subtract_with_carry(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	transient.data ^= 0xFF;
-	add_with_carry();
+	cpu->transient.data ^= 0xFF;
+	add_with_carry(cpu);
 }
 
-static void increment_reg_x(void) {
+static void increment_reg_x(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	reg.x++;
-	update_flags_nz(reg.x);
-	fetch_opcode();
+	cpu->reg.x++;
+	update_flags_nz(cpu, cpu->reg.x);
+	fetch_opcode(cpu);
 }
 
-static void increment_reg_y(void) {
+static void increment_reg_y(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	reg.y++;
-	update_flags_nz(reg.y);
-	fetch_opcode();
+	cpu->reg.y++;
+	update_flags_nz(cpu, cpu->reg.y);
+	fetch_opcode(cpu);
 }
 
-static void increment_data(void) {
+static void increment_data(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	write_memory(transient.address, transient.data);
-	transient.data++;
+	write_memory(cpu, cpu->transient.address, cpu->transient.data);
+	cpu->transient.data++;
 }
 
-static void decrement_reg_x(void) {
+static void decrement_reg_x(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	reg.x--;
-	update_flags_nz(reg.x);
-	fetch_opcode();
+	cpu->reg.x--;
+	update_flags_nz(cpu, cpu->reg.x);
+	fetch_opcode(cpu);
 }
 
-static void decrement_reg_y(void) {
+static void decrement_reg_y(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	reg.y--;
-	update_flags_nz(reg.y);
-	fetch_opcode();
+	cpu->reg.y--;
+	update_flags_nz(cpu, cpu->reg.y);
+	fetch_opcode(cpu);
 }
 
-static void decrement_data(void) {
+static void decrement_data(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	write_memory(transient.address, transient.data);
-	transient.data--;
+	write_memory(cpu, cpu->transient.address, cpu->transient.data);
+	cpu->transient.data--;
 }
 
 /********************************************************* Logical *********************************************************/
-static void bitwise_and(void) {
+static void bitwise_and(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	reg.a &= transient.data;
-	update_flags_nz(reg.a);
-	fetch_opcode();
+	cpu->reg.a &= cpu->transient.data;
+	update_flags_nz(cpu, cpu->reg.a);
+	fetch_opcode(cpu);
 }
 
-static void bitwise_or(void) {
+static void bitwise_or(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	reg.a |= transient.data;
-	update_flags_nz(reg.a);
-	fetch_opcode();
+	cpu->reg.a |= cpu->transient.data;
+	update_flags_nz(cpu, cpu->reg.a);
+	fetch_opcode(cpu);
 }
 
-static void bitwise_xor(void) {
+static void bitwise_xor(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	reg.a ^= transient.data;
-	update_flags_nz(reg.a);
-	fetch_opcode();
+	cpu->reg.a ^= cpu->transient.data;
+	update_flags_nz(cpu, cpu->reg.a);
+	fetch_opcode(cpu);
 }
 
 /***************************************************************************************************************************/
-static void bit_test(void) {
+static void bit_test(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	flag.n = (transient.data & 0x80);
-	flag.v = (transient.data & 0x40);
-	flag.z = !(transient.data & reg.a);
-	fetch_opcode();
+	cpu->flag.n = (cpu->transient.data & 0x80);
+	cpu->flag.v = (cpu->transient.data & 0x40);
+	cpu->flag.z = !(cpu->transient.data & cpu->reg.a);
+	fetch_opcode(cpu);
 }
 
 /******************************************************* Comparison ********************************************************/
-static void compare_reg_a(void) {
+static void compare_reg_a(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	flag.c = (reg.a >= transient.data);
-	update_flags_nz(reg.a - transient.data);
-	fetch_opcode();
+	cpu->flag.c = (cpu->reg.a >= cpu->transient.data);
+	update_flags_nz(cpu, cpu->reg.a - cpu->transient.data);
+	fetch_opcode(cpu);
 }
 
-static void compare_reg_x(void) {
+static void compare_reg_x(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	flag.c = (reg.x >= transient.data);
-	update_flags_nz(reg.x - transient.data);
-	fetch_opcode();
+	cpu->flag.c = (cpu->reg.x >= cpu->transient.data);
+	update_flags_nz(cpu, cpu->reg.x - cpu->transient.data);
+	fetch_opcode(cpu);
 }
 
-static void compare_reg_y(void) {
+static void compare_reg_y(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	flag.c = (reg.y >= transient.data);
-	update_flags_nz(reg.y - transient.data);
-	fetch_opcode();
+	cpu->flag.c = (cpu->reg.y >= cpu->transient.data);
+	update_flags_nz(cpu, cpu->reg.y - cpu->transient.data);
+	fetch_opcode(cpu);
 }
 
 /**************************************************** Register transfer ****************************************************/
-static void transfer_reg_a_to_reg_x(void) {
+static void transfer_reg_a_to_reg_x(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	reg.x = reg.a;
-	update_flags_nz(reg.x);
-	fetch_opcode();
+	cpu->reg.x = cpu->reg.a;
+	update_flags_nz(cpu, cpu->reg.x);
+	fetch_opcode(cpu);
 }
 
-static void transfer_reg_a_to_reg_y(void) {
+static void transfer_reg_a_to_reg_y(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	reg.y = reg.a;
-	update_flags_nz(reg.y);
-	fetch_opcode();
+	cpu->reg.y = cpu->reg.a;
+	update_flags_nz(cpu, cpu->reg.y);
+	fetch_opcode(cpu);
 }
 
-static void transfer_reg_x_to_reg_a(void) {
+static void transfer_reg_x_to_reg_a(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	reg.a = reg.x;
-	update_flags_nz(reg.a);
-	fetch_opcode();
+	cpu->reg.a = cpu->reg.x;
+	update_flags_nz(cpu, cpu->reg.a);
+	fetch_opcode(cpu);
 }
 
-static void transfer_reg_x_to_reg_s(void) {
+static void transfer_reg_x_to_reg_s(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	reg.s = reg.x;
-	fetch_opcode();
+	cpu->reg.s = cpu->reg.x;
+	fetch_opcode(cpu);
 }
 
-static void transfer_reg_y_to_reg_a(void) {
+static void transfer_reg_y_to_reg_a(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	reg.a = reg.y;
-	update_flags_nz(reg.a);
-	fetch_opcode();
+	cpu->reg.a = cpu->reg.y;
+	update_flags_nz(cpu, cpu->reg.a);
+	fetch_opcode(cpu);
 }
 
 /**************************************************** Bit manipulation *****************************************************/
-static void shift_left_reg_a(void) {
+static void shift_left_reg_a(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	flag.c = (reg.a & 0x80);
-	reg.a <<= 1;
-	update_flags_nz(reg.a);
-	fetch_opcode();
+	cpu->flag.c = (cpu->reg.a & 0x80);
+	cpu->reg.a <<= 1;
+	update_flags_nz(cpu, cpu->reg.a);
+	fetch_opcode(cpu);
 }
 
-static void shift_left_data(void) {
+static void shift_left_data(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	flag.c = (transient.data & 0x80);
-	transient.data <<= 1;
-	read_memory(reg.pc);
+	cpu->flag.c = (cpu->transient.data & 0x80);
+	cpu->transient.data <<= 1;
+	read_memory(cpu, cpu->reg.pc);
 }
 
-static void shift_right_reg_a(void) {
+static void shift_right_reg_a(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	flag.c = (reg.a & 0x01);
-	reg.a >>= 1;
-	update_flags_nz(reg.a);
-	fetch_opcode();
+	cpu->flag.c = (cpu->reg.a & 0x01);
+	cpu->reg.a >>= 1;
+	update_flags_nz(cpu, cpu->reg.a);
+	fetch_opcode(cpu);
 }
 
-static void shift_right_data(void) {
+static void shift_right_data(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	flag.c = (transient.data & 0x01);
-	transient.data >>= 1;
-	read_memory(reg.pc);
+	cpu->flag.c = (cpu->transient.data & 0x01);
+	cpu->transient.data >>= 1;
+	read_memory(cpu, cpu->reg.pc);
 }
 
-static void rotate_right_reg_a(void) {
+static void rotate_right_reg_a(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	bool carry = flag.c;
-	flag.c = (reg.a & 0x01);
-	reg.a >>= 1;
+	bool carry = cpu->flag.c;
+	cpu->flag.c = (cpu->reg.a & 0x01);
+	cpu->reg.a >>= 1;
 	if (carry)
-		reg.a |= 0x80;
-	update_flags_nz(reg.a);
-	fetch_opcode();
+		cpu->reg.a |= 0x80;
+	update_flags_nz(cpu, cpu->reg.a);
+	fetch_opcode(cpu);
 }
 
-static void rotate_right_data(void) {
+static void rotate_right_data(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	bool carry = flag.c;
-	flag.c = (transient.data & 0x01);
-	transient.data >>= 1;
+	bool carry = cpu->flag.c;
+	cpu->flag.c = (cpu->transient.data & 0x01);
+	cpu->transient.data >>= 1;
 	if (carry)
-		transient.data |= 0x80;
-	read_memory(reg.pc);
+		cpu->transient.data |= 0x80;
+	read_memory(cpu, cpu->reg.pc);
 }
 
-static void rotate_left_reg_a(void) {
+static void rotate_left_reg_a(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	bool carry = flag.c;
-	flag.c = (reg.a & 0x80);
-	reg.a <<= 1;
+	bool carry = cpu->flag.c;
+	cpu->flag.c = (cpu->reg.a & 0x80);
+	cpu->reg.a <<= 1;
 	if (carry)
-		reg.a |= 0x01;
-	update_flags_nz(reg.a);
-	fetch_opcode();
+		cpu->reg.a |= 0x01;
+	update_flags_nz(cpu, cpu->reg.a);
+	fetch_opcode(cpu);
 }
 
-static void rotate_left_data(void) {
+static void rotate_left_data(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	bool carry = flag.c;
-	flag.c = (transient.data & 0x80);
-	transient.data <<= 1;
+	bool carry = cpu->flag.c;
+	cpu->flag.c = (cpu->transient.data & 0x80);
+	cpu->transient.data <<= 1;
 	if (carry)
-		transient.data |= 0x01;
-	read_memory(reg.pc);
+		cpu->transient.data |= 0x01;
+	read_memory(cpu, cpu->reg.pc);
 }
 
 /******************************************************** Branching ********************************************************/
-static void skip_on_flag_z_clear(void) {
+static void skip_on_flag_z_clear(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	if (!flag.z)
-		fetch_opcode();
+	if (!cpu->flag.z)
+		fetch_opcode(cpu);
 	else
-		read_memory(reg.pc);
+		read_memory(cpu, cpu->reg.pc);
 }
 
-static void skip_on_flag_n_clear(void) {
+static void skip_on_flag_n_clear(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	if (!flag.n)
-		fetch_opcode();
+	if (!cpu->flag.n)
+		fetch_opcode(cpu);
 	else
-		read_memory(reg.pc);
+		read_memory(cpu, cpu->reg.pc);
 }
 
-static void skip_on_flag_c_clear(void) {
+static void skip_on_flag_c_clear(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	if (!flag.c)
-		fetch_opcode();
+	if (!cpu->flag.c)
+		fetch_opcode(cpu);
 	else
-		read_memory(reg.pc);
+		read_memory(cpu, cpu->reg.pc);
 }
 
-static void skip_on_flag_v_clear(void) {
+static void skip_on_flag_v_clear(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	if (!flag.v)
-		fetch_opcode();
+	if (!cpu->flag.v)
+		fetch_opcode(cpu);
 	else
-		read_memory(reg.pc);
+		read_memory(cpu, cpu->reg.pc);
 }
 
-static void skip_on_flag_z_set(void) {
+static void skip_on_flag_z_set(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	if (flag.z)
-		fetch_opcode();
+	if (cpu->flag.z)
+		fetch_opcode(cpu);
 	else
-		read_memory(reg.pc);
+		read_memory(cpu, cpu->reg.pc);
 }
 
-static void skip_on_flag_n_set(void) {
+static void skip_on_flag_n_set(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	if (flag.n)
-		fetch_opcode();
+	if (cpu->flag.n)
+		fetch_opcode(cpu);
 	else
-		read_memory(reg.pc);
+		read_memory(cpu, cpu->reg.pc);
 }
 
-static void skip_on_flag_c_set(void) {
+static void skip_on_flag_c_set(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	if (flag.c)
-		fetch_opcode();
+	if (cpu->flag.c)
+		fetch_opcode(cpu);
 	else
-		read_memory(reg.pc);
+		read_memory(cpu, cpu->reg.pc);
 }
 
-static void branch_same_page(void) {
+static void branch_same_page(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	transient.address = reg.pc + (int8_t) transient.data;
-	if (reg.pch == transient.address_hi) {
-		reg.pc = transient.address;
-		fetch_opcode();
+	cpu->transient.address = cpu->reg.pc + (int8_t) cpu->transient.data;
+	if (cpu->reg.pch == cpu->transient.address_hi) {
+		cpu->reg.pc = cpu->transient.address;
+		fetch_opcode(cpu);
 	} else {
-		reg.pcl = transient.address_lo;
+		cpu->reg.pcl = cpu->transient.address_lo;
 	}
 }
 
-static void branch_any_page(void) {
+static void branch_any_page(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	reg.pc = transient.address;
-	fetch_opcode();
+	cpu->reg.pc = cpu->transient.address;
+	fetch_opcode(cpu);
 }
 
 /******************************************************* Store/Load ********************************************************/
-static void put_data_into_reg_a(void) {
+static void put_data_into_reg_a(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	reg.a = transient.data;
-	update_flags_nz(reg.a);
-	fetch_opcode();
+	cpu->reg.a = cpu->transient.data;
+	update_flags_nz(cpu, cpu->reg.a);
+	fetch_opcode(cpu);
 }
 
-static void put_data_into_reg_x(void) {
+static void put_data_into_reg_x(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	reg.x = transient.data;
-	update_flags_nz(reg.x);
-	fetch_opcode();
+	cpu->reg.x = cpu->transient.data;
+	update_flags_nz(cpu, cpu->reg.x);
+	fetch_opcode(cpu);
 }
 
-static void put_data_into_reg_y(void) {
+static void put_data_into_reg_y(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	reg.y = transient.data;
-	update_flags_nz(reg.y);
-	fetch_opcode();
+	cpu->reg.y = cpu->transient.data;
+	update_flags_nz(cpu, cpu->reg.y);
+	fetch_opcode(cpu);
 }
 
-static void put_data_into_status(void) {
+static void put_data_into_status(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	ungroup_status_flags(transient.data);
-	fetch_opcode();
+	ungroup_status_flags(cpu, cpu->transient.data);
+	fetch_opcode(cpu);
 }
 
-static void store_reg_a(void) {
+static void store_reg_a(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	write_memory(transient.address, reg.a);
+	write_memory(cpu, cpu->transient.address, cpu->reg.a);
 }
 
-static void store_reg_x(void) {
+static void store_reg_x(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	write_memory(transient.address, reg.x);
+	write_memory(cpu, cpu->transient.address, cpu->reg.x);
 }
 
-static void store_reg_y(void) {
+static void store_reg_y(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	write_memory(transient.address, reg.y);
+	write_memory(cpu, cpu->transient.address, cpu->reg.y);
 }
 
-static void store_data(void) {
+static void store_data(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	write_memory(transient.address, transient.data);
-	update_flags_nz(transient.data);
+	write_memory(cpu, cpu->transient.address, cpu->transient.data);
+	update_flags_nz(cpu, cpu->transient.data);
 }
 
-static void load_data(void) {
+static void load_data(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	transient.data = read_memory(transient.address);
+	cpu->transient.data = read_memory(cpu, cpu->transient.address);
 }
 
-static void load_address_lo(void) {
+static void load_address_lo(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	transient.data = read_memory(transient.address);
+	cpu->transient.data = read_memory(cpu, cpu->transient.address);
 }
 
-static void load_address_hi(void) {
+static void load_address_hi(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	transient.address_lo += 1; // JMP_ind and STA_indY do not cross page boundaries here
-	transient.address_hi = read_memory(transient.address);
-	transient.address_lo = transient.data;
+	cpu->transient.address_lo += 1; // JMP_ind and STA_indY do not cross page boundaries here
+	cpu->transient.address_hi = read_memory(cpu, cpu->transient.address);
+	cpu->transient.address_lo = cpu->transient.data;
 }
 
-static void load_address_hi_add_reg_y(void) { // add only if the sum of address and reg.y remains in same memory page
+static void load_address_hi_add_reg_y(struct cpu *cpu) { // add only if the sum of address and cpu->reg.y remains in same memory page
 	puts(__FUNCTION__);
-	load_address_hi();
-	if (transient.address_lo + reg.y < 0x0100) {
-		transient.address_lo += reg.y;
-		current_step++;
+	load_address_hi(cpu);
+	if (cpu->transient.address_lo + cpu->reg.y < 0x0100) {
+		cpu->transient.address_lo += cpu->reg.y;
+		cpu->current_step++;
 	}
 }
 
 /***************************************************************************************************************************/
-static void add_reg_y_to_address(void) {
+static void add_reg_y_to_address(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	transient.address += reg.y;
-	read_memory(transient.address);
+	// the read happens before the carry into the high byte
+	read_memory(cpu, cpu->transient.address_hi << 8 | (uint8_t) (cpu->transient.address_lo + cpu->reg.y));
+	cpu->transient.address += cpu->reg.y;
 }
 
 /********************************************************* Stack ***********************************************************/
-static void push_reg_a(void) {
+static void push_reg_a(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	write_memory(0x100 | reg.s--, reg.a);
+	write_memory(cpu, 0x100 | cpu->reg.s--, cpu->reg.a);
 }
 
-static void push_pch(void) {
+static void push_pch(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	if (interrupt_vector == RESET)
-		read_memory(0x100 | reg.s--);
+	if (cpu->interrupt_vector == RESET)
+		read_memory(cpu, 0x100 | cpu->reg.s--);
 	else
-		write_memory(0x100 | reg.s--, reg.pch);
+		write_memory(cpu, 0x100 | cpu->reg.s--, cpu->reg.pch);
 }
 
-static void push_pcl(void) {
+static void push_pcl(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	if (interrupt_vector == RESET)
-		read_memory(0x100 | reg.s--);
+	if (cpu->interrupt_vector == RESET)
+		read_memory(cpu, 0x100 | cpu->reg.s--);
 	else
-		write_memory(0x100 | reg.s--, reg.pcl);
+		write_memory(cpu, 0x100 | cpu->reg.s--, cpu->reg.pcl);
 }
 
-static void pull_pch(void) {
+static void pull_pch(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	transient.address_hi = read_memory(0x100 | ++reg.s);
-	reg.pc = transient.address;
+	cpu->transient.address_hi = read_memory(cpu, 0x100 | ++cpu->reg.s);
+	cpu->reg.pc = cpu->transient.address;
 }
 
-static void pull_pcl(void) {
+static void pull_pcl(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	transient.address_lo= read_memory(++reg.s | 0x100);
+	cpu->transient.address_lo= read_memory(cpu, ++cpu->reg.s | 0x100);
 }
 
-static void pull_data(void) {
+static void pull_data(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	transient.data = read_memory(0x100 | ++reg.s);
+	cpu->transient.data = read_memory(cpu, 0x100 | ++cpu->reg.s);
 }
 
-static void push_status(void) {
+static void push_status(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	flag.b = interrupt_vector ? true : false;
-	if (interrupt_vector == RESET)
-		read_memory(0x100 | reg.s--);
+	cpu->flag.b = cpu->interrupt_vector ? true : false;
+	if (cpu->interrupt_vector == RESET)
+		read_memory(cpu, 0x100 | cpu->reg.s--);
 	else
-		write_memory(0x100 | reg.s--, group_status_flags());
-	if (interrupt_vector) // when BRK it should be true as well -> unimplemented
-		flag.i = true;
+		write_memory(cpu, 0x100 | cpu->reg.s--, group_status_flags(cpu));
+	if (cpu->interrupt_vector) // when BRK it should be true as well -> unimplemented
+		cpu->flag.i = true;
 }
 
-static void pull_status(void) {
+static void pull_status(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	ungroup_status_flags(read_memory(++reg.s | 0x100));
+	ungroup_status_flags(cpu, read_memory(cpu, ++cpu->reg.s | 0x100));
 }
 
-static void load_interrupt_vector_lo(void) {
+static void load_interrupt_vector_lo(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	transient.address_lo = read_memory(interrupt_vector);
+	cpu->transient.address_lo = read_memory(cpu, cpu->interrupt_vector);
 }
 
-static void load_interrupt_vector_hi(void) {
+static void load_interrupt_vector_hi(struct cpu *cpu) {
 	puts(__FUNCTION__);
-	transient.address_hi = read_memory(interrupt_vector + 1);
-	reg.pc = transient.address;
-	interrupt_vector = NONE;
+	cpu->transient.address_hi = read_memory(cpu, cpu->interrupt_vector + 1);
+	cpu->reg.pc = cpu->transient.address;
+	cpu->interrupt_vector = NONE;
 }
 
@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "trace.h"
+
+/*
+ * Binary instruction trace. The emulation thread fills one fixed-size record per
+ * instruction and appends it to a single-producer/single-consumer ring without
+ * locks; the frontend drains the ring into the trace file from its own thread.
+ * When the ring is full, new records are dropped and counted rather than making
+ * the emulator wait. Capture starts when the CPU reaches a given PC or when a
+ * given frame begins, whichever is set, and can stop after a number of records.
+ * funestus-trace turns the file back into text.
+ */
+#define RING_SIZE (1 << 16) // records, must be a power of 2
+
+_Static_assert(sizeof(trace_record) == 56, "trace records have a fixed layout");
+
+static trace_record ring[RING_SIZE];
+static atomic_size_t head = 0; // written by the producer
+static atomic_size_t tail = 0; // written by the consumer
+
+static FILE *trace_file;
+static struct {
+	long pc; // -1: no trigger
+	long frame; // -1: no trigger
+	long limit; // 0: no limit
+} trigger;
+
+static bool capturing = false;
+static uint32_t frame = 0;
+static unsigned long dropped = 0;
+
+bool trace_open(char const *file_name, long trigger_pc, long trigger_frame, long limit) {
+#ifndef TRACE
+	(void) file_name, (void) trigger_pc, (void) trigger_frame, (void) limit;
+	puts("Tracing is not compiled in this build (make TRACE=1)");
+	return false;
+#else
+	trace_file = fopen(file_name, "wb");
+	if (!trace_file) {
+		printf("Could not create trace file %s\n", file_name);
+		return false;
+	}
+	uint32_t const header[2] = { TRACE_VERSION, sizeof(trace_record) };
+	fwrite(TRACE_MAGIC, 1, 8, trace_file);
+	fwrite(header, sizeof(header), 1, trace_file);
+
+	trigger.pc = trigger_pc;
+	trigger.frame = trigger_frame;
+	trigger.limit = limit;
+	capturing = trigger_pc < 0 && trigger_frame < 0;
+	return true;
+#endif
+}
+
+void trace_frame(long frame_number) {
+	frame = frame_number;
+	if (trace_file && !capturing && trigger.frame >= 0 && frame_number >= trigger.frame)
+		capturing = true;
+}
+
+#ifdef TRACE
+static bool pending = false; // current holds an instruction not yet in the ring
+static trace_record current;
+static long captured = 0;
+
+static void commit(void) {
+	size_t h = atomic_load_explicit(&head, memory_order_relaxed);
+	if (h - atomic_load_explicit(&tail, memory_order_acquire) == RING_SIZE) {
+		dropped++;
+	} else {
+		ring[h & (RING_SIZE - 1)] = current;
+		atomic_store_explicit(&head, h + 1, memory_order_release);
+	}
+	pending = false;
+	if (trigger.limit && ++captured >= trigger.limit)
+		capturing = false, trigger.pc = trigger.frame = -1; // done for good
+}
+
+void trace_instruction(uint16_t pc, uint64_t cycle, uint8_t a, uint8_t x, uint8_t y, uint8_t s, uint8_t p) {
+	if (pending)
+		commit();
+	if (!capturing) {
+		if (!trace_file || trigger.pc < 0 || pc != trigger.pc)
+			return;
+		capturing = true;
+	}
+	current = (trace_record) { .cycle = cycle, .frame = frame, .pc = pc, .a = a, .x = x, .y = y, .s = s, .p = p };
+	pending = true;
+}
+
+void trace_opcode(uint8_t opcode, bool interrupt) {
+	if (pending) {
+		current.opcode = opcode;
+		current.interrupt = interrupt;
+	}
+}
+
+void trace_access(uint16_t address, uint8_t data, bool write) {
+	if (pending && current.access_count < TRACE_ACCESSES) {
+		current.access[current.access_count].address = address;
+		current.access[current.access_count].data = data;
+		current.access[current.access_count].write = write;
+		current.access_count++;
+	}
+}
+#endif
+
+// consumer side: writes the records produced so far to the trace file
+void trace_drain(void) {
+	if (!trace_file)
+		return;
+	size_t t = atomic_load_explicit(&tail, memory_order_relaxed);
+	size_t h = atomic_load_explicit(&head, memory_order_acquire);
+	while (t != h) {
+		size_t index = t & (RING_SIZE - 1);
+		size_t count = h - t < RING_SIZE - index ? h - t : RING_SIZE - index;
+		fwrite(ring + index, sizeof(trace_record), count, trace_file);
+		t += count;
+	}
+	atomic_store_explicit(&tail, t, memory_order_release);
+}
+
+// once the emulation is over, so the instruction it ran last is complete
+void trace_close(void) {
+	if (!trace_file)
+		return;
+#ifdef TRACE
+	if (pending)
+		commit();
+#endif
+	trace_drain();
+	fclose(trace_file);
+	trace_file = NULL;
+	if (dropped)
+		printf("Trace: %lu records dropped, the ring was full\n", dropped);
+}
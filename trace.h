@@ -0,0 +1,45 @@
+#ifndef HEADER_TRACE
+#define HEADER_TRACE
+
+#define TRACE_ACCESSES 8
+
+// one record per instruction, with the memory accesses made during its cycles
+typedef struct {
+	uint64_t cycle; // CPU cycle in which the opcode was fetched
+	uint32_t frame;
+	uint16_t pc;
+	uint8_t opcode;
+	uint8_t interrupt; // the fetched opcode was replaced by the interrupt sequence
+	uint8_t a, x, y, s, p;
+	uint8_t access_count;
+	uint8_t padding[2];
+	struct {
+		uint16_t address;
+		uint8_t data;
+		uint8_t write;
+	} access[TRACE_ACCESSES];
+} trace_record;
+
+#define TRACE_MAGIC "FUNTRACE"
+#define TRACE_VERSION 1
+
+// the CPU side only exists in builds made with TRACE defined (make TRACE=1)
+#ifdef TRACE
+void trace_instruction(uint16_t pc, uint64_t cycle, uint8_t a, uint8_t x, uint8_t y, uint8_t s, uint8_t p);
+void trace_opcode(uint8_t opcode, bool interrupt);
+void trace_access(uint16_t address, uint8_t data, bool write);
+#define TRACE_INSTRUCTION(...) trace_instruction(__VA_ARGS__)
+#define TRACE_OPCODE(...) trace_opcode(__VA_ARGS__)
+#define TRACE_ACCESS(...) trace_access(__VA_ARGS__)
+#else
+#define TRACE_INSTRUCTION(...) ((void) 0)
+#define TRACE_OPCODE(...) ((void) 0)
+#define TRACE_ACCESS(...) ((void) 0)
+#endif
+
+bool trace_open(char const *file_name, long trigger_pc, long trigger_frame, long limit);
+void trace_frame(long frame);
+void trace_drain(void);
+void trace_close(void);
+
+#endif
@@ -0,0 +1,49 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include "opcodes.h"
+#include "trace.h"
+
+// prints a binary trace written by funestus --trace as text, one instruction per line
+int main(int argc, char *argv[]) {
+	if (argc < 2) {
+		puts("Usage: funestus-trace TRACE_FILE");
+		return EXIT_FAILURE;
+	}
+	FILE *file = fopen(argv[1], "rb");
+	if (!file) {
+		printf("Could not open %s\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	char magic[8];
+	uint32_t header[2];
+	if (fread(magic, 1, 8, file) != 8 || memcmp(magic, TRACE_MAGIC, 8) || fread(header, sizeof(header), 1, file) != 1) {
+		printf("%s is not a funestus trace\n", argv[1]);
+		fclose(file);
+		return EXIT_FAILURE;
+	}
+	if (header[0] != TRACE_VERSION || header[1] != sizeof(trace_record)) {
+		printf("%s has trace version %u with %u-byte records, expected version %d with %zu\n",
+			argv[1], header[0], header[1], TRACE_VERSION, sizeof(trace_record));
+		fclose(file);
+		return EXIT_FAILURE;
+	}
+
+	trace_record record;
+	while (fread(&record, sizeof(record), 1, file) == 1) {
+		printf("#%09llu F%05u %04X  %02X %s %s  A %02X X %02X Y %02X S %02X P %02X %c%c.%c%c%c%c%c ",
+			(unsigned long long) record.cycle, record.frame, record.pc, record.opcode,
+			record.interrupt ? "INT" : mnemonic[record.opcode], record.interrupt ? "---" : addressing[record.opcode],
+			record.a, record.x, record.y, record.s, record.p,
+			record.p & 0x80 ? 'n' : '.', record.p & 0x40 ? 'v' : '.', record.p & 0x10 ? 'b' : '.',
+			record.p & 0x08 ? 'd' : '.', record.p & 0x04 ? 'i' : '.', record.p & 0x02 ? 'z' : '.', record.p & 0x01 ? 'c' : '.');
+		for (int i = 0; i < record.access_count && i < TRACE_ACCESSES; i++)
+			printf(" %c %04X=%02X", record.access[i].write ? 'W' : 'R', record.access[i].address, record.access[i].data);
+		putchar('\n');
+	}
+	fclose(file);
+	return EXIT_SUCCESS;
+}
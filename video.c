@@ -0,0 +1,129 @@
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <immintrin.h>
+#include "video.h"
+
+// http://drag.wootest.net/misc/palgen.html
+uint8_t const palette_rgb[64][3] = {
+	{ 0x46, 0x46, 0x46 }, { 0x00, 0x06, 0x5A }, { 0x00, 0x06, 0x78 }, { 0x02, 0x06, 0x73 },
+	{ 0x35, 0x03, 0x4C }, { 0x57, 0x00, 0x0E }, { 0x5A, 0x00, 0x00 }, { 0x41, 0x00, 0x00 },
+	{ 0x12, 0x02, 0x00 }, { 0x00, 0x14, 0x00 }, { 0x00, 0x1E, 0x00 }, { 0x00, 0x1E, 0x00 },
+	{ 0x00, 0x15, 0x21 }, { 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0x00 },
+	{ 0x9D, 0x9D, 0x9D }, { 0x00, 0x4A, 0xB9 }, { 0x05, 0x30, 0xE1 }, { 0x57, 0x18, 0xDA },
+	{ 0x9F, 0x07, 0xA7 }, { 0xCC, 0x02, 0x55 }, { 0xCF, 0x0B, 0x00 }, { 0xA4, 0x23, 0x00 },
+	{ 0x5C, 0x3F, 0x00 }, { 0x0B, 0x58, 0x00 }, { 0x00, 0x66, 0x00 }, { 0x00, 0x67, 0x13 },
+	{ 0x00, 0x5E, 0x6E }, { 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0x00 },
+	{ 0xFE, 0xFF, 0xFF }, { 0x1F, 0x9E, 0xFF }, { 0x53, 0x76, 0xFF }, { 0x98, 0x65, 0xFF },
+	{ 0xFC, 0x67, 0xFF }, { 0xFF, 0x6C, 0xB3 }, { 0xFF, 0x74, 0x66 }, { 0xFF, 0x80, 0x14 },
+	{ 0xC4, 0x9A, 0x00 }, { 0x71, 0xB3, 0x00 }, { 0x28, 0xC4, 0x21 }, { 0x00, 0xC8, 0x74 },
+	{ 0x00, 0xBF, 0xD0 }, { 0x2B, 0x2B, 0x2B }, { 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0x00 },
+	{ 0xFE, 0xFF, 0xFF }, { 0x9E, 0xD5, 0xFF }, { 0xAF, 0xC0, 0xFF }, { 0xD0, 0xB8, 0xFF },
+	{ 0xFE, 0xBF, 0xFF }, { 0xFF, 0xC0, 0xE0 }, { 0xFF, 0xC3, 0xBD }, { 0xFF, 0xCA, 0x9C },
+	{ 0xE7, 0xD5, 0x8B }, { 0xC5, 0xDF, 0x8E }, { 0xA6, 0xE6, 0xA3 }, { 0x94, 0xE8, 0xC5 },
+	{ 0x92, 0xE4, 0xEB }, { 0xA7, 0xA7, 0xA7 }, { 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0x00 }
+};
+
+/*
+ * Host pixels for the 64 NES colors under each of the 8 combinations of the PPUMASK
+ * emphasis bits, so that converting a pixel is a single table lookup. Emphasis is
+ * approximated by dimming the channels that are not emphasized.
+ */
+static uint32_t nes_color[8][64];
+
+// the host pixel format is only known by the frontend, so it provides the mapping
+void build_color_table(map_rgb_function map_rgb, void *pixel_format) {
+	for (int emphasis = 0; emphasis < 8; emphasis++) {
+		for (int i = 0; i < 64; i++) {
+			uint8_t rgb[3];
+			for (int channel = 0; channel < 3; channel++) {
+				bool dimmed = emphasis && !(emphasis & (1 << channel));
+				rgb[channel] = dimmed ? palette_rgb[i][channel] * 3 / 4 : palette_rgb[i][channel];
+			}
+			nes_color[emphasis][i] = map_rgb(pixel_format, rgb[0], rgb[1], rgb[2]);
+		}
+	}
+}
+
+static void convert_lines_scalar(uint32_t *frame_buffer, uint8_t const *internal_frame_buffer, uint8_t const *line_emphasis) {
+	for (int line = 0; line < 240; line++) {
+		uint32_t const *colors = nes_color[line_emphasis[line] & 0x07];
+		for (int i = 0; i < 256; i++)
+			frame_buffer[i] = colors[internal_frame_buffer[i] & 0x3F];
+		frame_buffer += 256;
+		internal_frame_buffer += 256;
+	}
+}
+
+// eight pixels per gather, straight from the table of the line
+__attribute__((target("avx2")))
+static void convert_lines_avx2(uint32_t *frame_buffer, uint8_t const *internal_frame_buffer, uint8_t const *line_emphasis) {
+	__m256i const color_mask = _mm256_set1_epi32(0x3F);
+
+	for (int line = 0; line < 240; line++) {
+		int const *colors = (int const *) nes_color[line_emphasis[line] & 0x07];
+		for (int i = 0; i < 256; i += 8) {
+			__m128i pixels = _mm_loadl_epi64((__m128i const *) (internal_frame_buffer + i));
+			__m256i index = _mm256_and_si256(_mm256_cvtepu8_epi32(pixels), color_mask);
+			_mm256_storeu_si256((__m256i *) (frame_buffer + i), _mm256_i32gather_epi32(colors, index, 4));
+		}
+		frame_buffer += 256;
+		internal_frame_buffer += 256;
+	}
+}
+
+static void select_and_convert(uint32_t *frame_buffer, uint8_t const *internal_frame_buffer, uint8_t const *line_emphasis);
+static void (*convert_lines)(uint32_t *, uint8_t const *, uint8_t const *) = select_and_convert;
+
+static void select_and_convert(uint32_t *frame_buffer, uint8_t const *internal_frame_buffer, uint8_t const *line_emphasis) {
+	__builtin_cpu_init();
+	convert_lines = __builtin_cpu_supports("avx2") ? convert_lines_avx2 : convert_lines_scalar;
+	convert_lines(frame_buffer, internal_frame_buffer, line_emphasis);
+}
+
+void convert_frame_buffer(uint32_t *frame_buffer, uint8_t const *internal_frame_buffer, uint8_t const *line_emphasis) {
+	convert_lines(frame_buffer, internal_frame_buffer, line_emphasis);
+}
+
+/*
+ * Triple buffering between the emulation thread (producer) and the thread that
+ * presents the frames (consumer), without locks. Each side owns one buffer, and
+ * the third one is exchanged atomically between them together with a flag that
+ * tells whether it holds a frame not yet seen by the consumer. The producer never
+ * waits: publishing over a frame that was not acquired drops the older one.
+ */
+#define FRESH 0x04
+
+static uint32_t frame_buffers[3][256 * 240];
+static int back = 0; // producer
+static int front = 1; // consumer
+static atomic_int middle = 2;
+static atomic_ulong dropped_frames = 0;
+
+uint32_t *back_frame_buffer(void) {
+	return frame_buffers[back];
+}
+
+// returns true when the consumer has to be told about the new frame, false if it has not taken the previous one yet
+bool publish_frame_buffer(void) {
+	int previous = atomic_exchange_explicit(&middle, back | FRESH, memory_order_acq_rel);
+	back = previous & 0x03;
+	if (previous & FRESH) {
+		atomic_fetch_add_explicit(&dropped_frames, 1, memory_order_relaxed);
+		return false;
+	}
+	return true;
+}
+
+// the newest complete frame, or NULL if there is none since the last call
+uint32_t const *acquire_frame_buffer(void) {
+	if (!(atomic_load_explicit(&middle, memory_order_relaxed) & FRESH))
+		return NULL;
+	front = atomic_exchange_explicit(&middle, front, memory_order_acq_rel) & 0x03;
+	return frame_buffers[front];
+}
+
+unsigned long dropped_frame_buffers(void) {
+	return atomic_load_explicit(&dropped_frames, memory_order_relaxed);
+}
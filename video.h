@@ -0,0 +1,16 @@
+#ifndef HEADER_VIDEO
+#define HEADER_VIDEO
+
+typedef uint32_t (*map_rgb_function)(void *pixel_format, uint8_t red, uint8_t green, uint8_t blue);
+
+extern uint8_t const palette_rgb[64][3];
+
+void build_color_table(map_rgb_function map_rgb, void *pixel_format);
+uint32_t *back_frame_buffer(void);
+bool publish_frame_buffer(void);
+uint32_t const *acquire_frame_buffer(void);
+unsigned long dropped_frame_buffers(void);
+
+void convert_frame_buffer(uint32_t *frame_buffer, uint8_t const *internal_frame_buffer, uint8_t const *line_emphasis);
+
+#endif